@@ -12,9 +12,25 @@
 // 0: Normal Mode  -> USB1 is Controller, USB2 is Keyboard/Mouse (HID)
 // 1: Swapped Mode -> USB1 is Keyboard/Mouse (HID), USB2 is Controller
 #define USB_SWAP_MODE  0
+
+// 0: Separate absolute (EP2) and relative (EP3) mouse interfaces
+// 1: One mouse interface on EP2 polled every 1 ms, absolute reports with
+//    report ID 1 and relative reports with report ID 2; EP3 stays free.
+//    Linux merges both report IDs into a single input device.
+#define MOUSE_COMPOSITE 0
+
+// 0: The controller talks to the firmware over USB (see USB_SWAP_MODE)
+// 1: Standalone extender: the controller link runs over UART3 (PA4 RX,
+//    PA5 TX) and USB1 is a USB host for a local keyboard/mouse whose input
+//    is merged with the controller's. Requires USB_SWAP_MODE 0.
+#define USB_HOST_PASSTHROUGH 0
 // =======================================================================
 
-#define DEBUG_PRT 0
+#if USB_HOST_PASSTHROUGH && (USB_SWAP_MODE != 0)
+#error "USB_HOST_PASSTHROUGH needs USB1 free, use USB_SWAP_MODE 0"
+#endif
+
+#define DEBUG_PRT 0 // 1: binary event trace on UART1, see TRACE
 #define DevEP0SIZE 0x40
 
 /* -----------------------------------------------------------------------
@@ -25,6 +41,10 @@ __attribute__((aligned(4))) uint8_t EP0_Databuf[64 + 64 + 64];
 __attribute__((aligned(4))) uint8_t EP1_Databuf[64 + 64];
 __attribute__((aligned(4))) uint8_t EP2_Databuf[64 + 64];
 __attribute__((aligned(4))) uint8_t EP3_Databuf[64 + 64];
+#if USB_HOST_PASSTHROUGH
+// Descriptor buffer of the USB host library; combo receivers need over 128
+__attribute__((aligned(4))) uint8_t Com_Buffer[256];
+#endif
 
 // USB2 RAM
 __attribute__((aligned(4))) uint8_t U2EP0_Databuf[64 + 64 + 64];
@@ -55,18 +75,30 @@ const uint8_t HIDDescr[] = {
 const uint8_t U2MyDevDescr[] = {0x12, 0x01, 0x10, 0x01, 0x00, 0x00, 0x00, U2DevEP0SIZE, 
                                 0x3d, 0x41, 0x08, 0x21, 0x00, 0x01, 0x01, 0x02, 0x00, 0x01};
 
+#if MOUSE_COMPOSITE
+const uint8_t U2MyCfgDescr[] = {
+    0x09, 0x02, 0x3B, 0x00, 0x02, 0x01, 0x00, 0xE0, 0x19,
+    0x09, 0x04, 0x00, 0x00, 0x01, 0x03, 0x01, 0x01, 0x00, // KBD
+    0x09, 0x21, 0x11, 0x01, 0x00, 0x01, 0x22, 0x3e, 0x00,
+    0x07, 0x05, 0x81, 0x03, 0x08, 0x00, 0x01,
+    0x09, 0x04, 0x01, 0x00, 0x01, 0x03, 0x01, 0x02, 0x00, // Mouse Abs + Rel
+    0x09, 0x21, 0x10, 0x01, 0x00, 0x01, 0x22, 0x12, 0x01, 
+    0x07, 0x05, 0x82, 0x03, 0x08, 0x00, 0x01
+};
+#else
 const uint8_t U2MyCfgDescr[] = {
     0x09, 0x02, 0x54, 0x00, 0x03, 0x01, 0x00, 0xE0, 0x19,
     0x09, 0x04, 0x00, 0x00, 0x01, 0x03, 0x01, 0x01, 0x00, // KBD
     0x09, 0x21, 0x11, 0x01, 0x00, 0x01, 0x22, 0x3e, 0x00,
     0x07, 0x05, 0x81, 0x03, 0x08, 0x00, 0x01,
-    0x09, 0x04, 0x01, 0x00, 0x01, 0x03, 0x01, 0x02, 0x00, // Mouse Abs
-    0x09, 0x21, 0x10, 0x01, 0x00, 0x01, 0x22, 0x48, 0x00, 
-    0x07, 0x05, 0x82, 0x03, 0x06, 0x00, 0x0a,
+    0x09, 0x04, 0x01, 0x00, 0x01, 0x03, 0x00, 0x00, 0x00, // Mouse Abs (no boot subclass)
+    0x09, 0x21, 0x10, 0x01, 0x00, 0x01, 0x22, 0x89, 0x00, 
+    0x07, 0x05, 0x82, 0x03, 0x08, 0x00, 0x0a,
     0x09, 0x04, 0x02, 0x00, 0x01, 0x03, 0x01, 0x02, 0x00, // Mouse Rel
-    0x09, 0x21, 0x10, 0x01, 0x00, 0x01, 0x22, 0x46, 0x00, 
-    0x07, 0x05, 0x83, 0x03, 0x04, 0x00, 0x0a
+    0x09, 0x21, 0x10, 0x01, 0x00, 0x01, 0x22, 0x85, 0x00, 
+    0x07, 0x05, 0x83, 0x03, 0x08, 0x00, 0x0a
 };
+#endif
 
 const uint8_t U2KeyRepDesc[] = {
     0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 
@@ -76,23 +108,70 @@ const uint8_t U2KeyRepDesc[] = {
     0x00, 0x29, 0x91, 0x81, 0x00, 0xC0
 };
 
+// Absolute mouse: buttons, X/Y 0..32767, wheel, AC Pan (7 bytes). The wheel and
+// pan each sit in a logical collection with a Resolution Multiplier feature
+// (physical 1..8) so the target can switch them to high-resolution units.
 const uint8_t U2MouseRepDesc[] = {
     0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 
     0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01, 0x81, 0x02, 0x75, 0x03, 
     0x95, 0x01, 0x81, 0x03, 0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x00, 0x26, 0xFF, 
-    0x7F, 0x35, 0x00, 0x46, 0xff, 0x7f, 0x75, 0x10, 0x95, 0x02, 0x81, 0x02, 0x09, 0x38, 
-    0x15, 0x81, 0x25, 0x7F, 0x35, 0x81, 0x45, 0x7f, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 
-    0xC0, 0xC0
+    0x7F, 0x35, 0x00, 0x46, 0xff, 0x7f, 0x75, 0x10, 0x95, 0x02, 0x81, 0x02, 
+    0xA1, 0x02, 0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01, 0x45, 0x08, 0x75, 0x02, 
+    0x95, 0x01, 0xB1, 0x02, 0x35, 0x00, 0x45, 0x00, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 
+    0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0xC0, 
+    0xA1, 0x02, 0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01, 0x45, 0x08, 0x75, 0x02, 
+    0x95, 0x01, 0xB1, 0x02, 0x35, 0x00, 0x45, 0x00, 0x05, 0x0C, 0x0A, 0x38, 0x02, 0x15, 
+    0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0x05, 0x01, 0xC0, 
+    0x75, 0x04, 0x95, 0x01, 0xB1, 0x03, 0xC0, 0xC0
 };
 
+// Relative mouse: buttons, X/Y 16-bit (-32767..32767), wheel, AC Pan (7 bytes),
+// with the same Resolution Multiplier features as the absolute interface
 const uint8_t U2MouseRelDesc[] = {
     0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 
     0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01, 0x81, 0x02, 0x75, 0x03, 
-    0x95, 0x01, 0x81, 0x03, 0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7F, 
-    0x35, 0x81, 0x45, 0x7F, 0x75, 0x08, 0x95, 0x02, 0x81, 0x06, 0x09, 0x38, 0x15, 0x81, 
-    0x25, 0x7F, 0x35, 0x81, 0x45, 0x7f, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0xC0, 0xC0
+    0x95, 0x01, 0x81, 0x03, 0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 
+    0xFF, 0x7F, 0x75, 0x10, 0x95, 0x02, 0x81, 0x06, 
+    0xA1, 0x02, 0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01, 0x45, 0x08, 0x75, 0x02, 
+    0x95, 0x01, 0xB1, 0x02, 0x35, 0x00, 0x45, 0x00, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 
+    0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0xC0, 
+    0xA1, 0x02, 0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01, 0x45, 0x08, 0x75, 0x02, 
+    0x95, 0x01, 0xB1, 0x02, 0x35, 0x00, 0x45, 0x00, 0x05, 0x0C, 0x0A, 0x38, 0x02, 0x15, 
+    0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0x05, 0x01, 0xC0, 
+    0x75, 0x04, 0x95, 0x01, 0xB1, 0x03, 0xC0, 0xC0
 };
 
+#if MOUSE_COMPOSITE
+// Both mice in one interface: report ID 1 carries the absolute layout and
+// report ID 2 the relative one. Buttons are shared between them.
+#define MOUSE_REPORT_ID_ABS 1
+#define MOUSE_REPORT_ID_REL 2
+const uint8_t U2MouseCompositeDesc[] = {
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 
+    0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01, 0x81, 0x02, 0x75, 0x03, 
+    0x95, 0x01, 0x81, 0x03, 0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x00, 0x26, 0xFF, 
+    0x7F, 0x35, 0x00, 0x46, 0xff, 0x7f, 0x75, 0x10, 0x95, 0x02, 0x81, 0x02, 
+    0xA1, 0x02, 0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01, 0x45, 0x08, 0x75, 0x02, 
+    0x95, 0x01, 0xB1, 0x02, 0x35, 0x00, 0x45, 0x00, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 
+    0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0xC0, 
+    0xA1, 0x02, 0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01, 0x45, 0x08, 0x75, 0x02, 
+    0x95, 0x01, 0xB1, 0x02, 0x35, 0x00, 0x45, 0x00, 0x05, 0x0C, 0x0A, 0x38, 0x02, 0x15, 
+    0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0x05, 0x01, 0xC0, 
+    0x75, 0x04, 0x95, 0x01, 0xB1, 0x03, 0xC0, 0xC0,
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 
+    0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01, 0x81, 0x02, 0x75, 0x03, 
+    0x95, 0x01, 0x81, 0x03, 0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 
+    0xFF, 0x7F, 0x75, 0x10, 0x95, 0x02, 0x81, 0x06, 
+    0xA1, 0x02, 0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01, 0x45, 0x08, 0x75, 0x02, 
+    0x95, 0x01, 0xB1, 0x02, 0x35, 0x00, 0x45, 0x00, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 
+    0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0xC0, 
+    0xA1, 0x02, 0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01, 0x45, 0x08, 0x75, 0x02, 
+    0x95, 0x01, 0xB1, 0x02, 0x35, 0x00, 0x45, 0x00, 0x05, 0x0C, 0x0A, 0x38, 0x02, 0x15, 
+    0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0x05, 0x01, 0xC0, 
+    0x75, 0x04, 0x95, 0x01, 0xB1, 0x03, 0xC0, 0xC0
+};
+#endif
+
 const uint8_t MyLangDescr[] = {0x04, 0x03, 0x09, 0x04};
 const uint8_t MyManuInfo[] = {0x30, 0x03, 'M', 0, 'o', 0, 'y', 0, 'u', 0, ' ', 0, 'a', 0, 't', 0, ' ', 0, 'w', 0, 'o', 0, 'r', 0, 'k', 0, ' ', 0, 'T', 0, 'e', 0, 'c', 0, 'h', 0, 'n', 0, 'o', 0, 'l', 0, 'o', 0, 'g', 0, 'y', 0};
 const uint8_t MyProdInfo[] = {0x1C, 0x03, 'K', 0, 'V', 0, 'M', 0, ' ', 0, 'C', 0, 'a', 0, 'r', 0, 'd', 0, ' ', 0, 'M', 0, 'i', 0, 'n', 0, 'i', 0};
@@ -107,6 +186,7 @@ uint8_t U2USB_FS_OSC_DESC[sizeof(U2MyCfgDescr)] = {0x09, 0x07};
    ----------------------------------------------------------------------- */
 uint8_t DevConfig, Ready = 0;
 uint8_t SetupReqCode;
+uint8_t SetupReqIntf, SetupReportType;
 uint16_t SetupReqLen;
 const uint8_t *pDescr;
 uint8_t Report_Value = 0x00;
@@ -119,6 +199,7 @@ uint8_t HIDKeyLightsCode = 0;
 
 uint8_t U2DevConfig, U2Ready;
 uint8_t U2SetupReqCode;
+uint8_t U2SetupReqIntf, U2SetupReportType;
 uint16_t U2SetupReqLen;
 const uint8_t *pU2Descr;
 uint8_t U2Report_Value = 0x00;
@@ -126,9 +207,24 @@ uint8_t U2Idle_Value = 0x00;
 uint8_t U2USB_SleepStatus = 0x00;
 
 uint8_t U2HIDMouseRel[6] = {0x0};
-uint8_t U2HIDMouse[6] = {0x0};
+uint8_t U2HIDMouse[7] = {0x0}; // Last absolute report; scroll-only updates reuse its position
 uint8_t U2HIDKey[8] = {0x0};
 
+// Protocol per HID port interface (keyboard, absolute mouse, relative mouse),
+// set by SET_PROTOCOL: 1 = report protocol, 0 = boot protocol. HidIdle is
+// the SET_IDLE duration per interface in 4 ms units, 0 = only on change.
+#if MOUSE_COMPOSITE
+#define HID_INTERFACES   2
+#define MOUSE_REL_INTF   1
+#else
+#define HID_INTERFACES   3
+#define MOUSE_REL_INTF   2
+#endif
+#define HID_BOOT_KEY_MAX 0x65 // highest usage in the boot keyboard descriptor
+uint8_t HidProtocol[3] = {1, 1, 1};
+uint8_t HidIdle[3] = {0, 0, 0};
+static volatile uint8_t KeyEpBusy = 0; // keyboard report armed, not yet polled
+
 uint8_t __IO mode = 0;
 const uint8_t empty_buf[8] = {0x00};
 const uint8_t rgb_ready[3] = {0x00, 0x05, 0x00};
@@ -137,56 +233,1524 @@ void DevEP1_OUT_Deal(uint8_t l);
 void U2DevEP1_OUT_Deal(uint8_t l);
 void DevEP1_IN_Deal(uint8_t l);
 void U2DevEP1_IN_Deal(uint8_t l);
+uint8_t AbsEmu_Step(void);
+void Send_Control_Data(uint8_t *data);
+void Port_Command(const uint8_t *p);
+void Capabilities_Read(const uint8_t *p);
+uint8_t HID_GetIdle(uint8_t intf);
+
+// Per-endpoint last report, see DUPLICATE SUPPRESSION
+#define REPORT_KEY 0
+#define REPORT_EP2 1
+#define REPORT_EP3 2
+uint8_t Report_Unchanged(uint8_t ep, const uint8_t *rep, uint8_t len, uint8_t state_len);
+void Report_Forget(uint8_t ep);
+#if USB_HOST_PASSTHROUGH
+void Link_Send(const uint8_t *data);
+void Local_Command(const uint8_t *p);
+void Local_Release(void);
+#endif
+
+// Trace events; tools/trace-decode.js knows the same ids
+#define TR_LOST       0x01 // records dropped: a low byte, b high byte
+#define TR_CMD_PUSH   0x02 // a opcode, b commands already queued
+#define TR_CMD_DROP   0x03 // a opcode, command ring full
+#define TR_CMD_RUN    0x04 // a opcode, b first payload byte
+#define TR_KEY_SEND   0x05 // a modifiers, b first key
+#define TR_KEY_IN     0x06 // keyboard report polled by the target
+#define TR_MOUSE_SEND 0x07 // a endpoint, b 1 = staged behind an armed report
+#define TR_MOUSE_IN   0x08 // a endpoint, b 1 = staged report armed next
+#define TR_BUS_RESET  0x09 // a USB port
+#define TR_SWITCH     0x0A // a switch state entered, b target
+#define TR_WATCHDOG   0x0B // host silent, input released
+#define TR_HOST_XFER  0x0C // a local endpoint, b USB_INT_ST
+#define TR_PORT_RESET 0x0D // a USB port, b reason
+
+#if DEBUG_PRT
+void Trace(uint8_t id, uint8_t a, uint8_t b);
+#define TRACE(id, a, b) Trace(id, a, b)
+#else
+#define TRACE(id, a, b) ((void)0)
+#endif
 
 /* =======================================================================
    ROUTING HELPERS - DIRECT HARDWARE WRITE
    ======================================================================= */
 void Send_Key_Report(uint8_t *data) {
+    uint8_t rep[8];
+    uint8_t i, n = 2;
+
+    if (HidProtocol[0]) {
+        memcpy(rep, data, 8);
+    } else {
+        // Boot layout: reserved byte zero, only usages a BIOS can decode
+        memset(rep, 0, sizeof(rep));
+        rep[0] = data[0];
+        for (i = 2; i < 8; i++) {
+            if (data[i] && data[i] <= HID_BOOT_KEY_MAX) rep[n++] = data[i];
+        }
+    }
+    if (Report_Unchanged(REPORT_KEY, rep, 8, 8)) return;
+    KeyEpBusy = 1;
+    TRACE(TR_KEY_SEND, rep[0], rep[2]);
 #if (USB_SWAP_MODE == 0)
-    memcpy(pU2EP1_IN_DataBuf, data, 8);
+    memcpy(pU2EP1_IN_DataBuf, rep, 8);
     U2DevEP1_IN_Deal(8);
 #else
-    memcpy(pEP1_IN_DataBuf, data, 8);
+    memcpy(pEP1_IN_DataBuf, rep, 8);
     DevEP1_IN_Deal(8);
 #endif
 }
 
+#define MOUSE_ABS_REPORT_LEN  7 // buttons, X16, Y16, wheel, pan
+#define MOUSE_BOOT_REPORT_LEN 3 // boot layout: buttons, X8, Y8
+
+/* -----------------------------------------------------------------------
+   PING-PONG IN ENDPOINTS
+   The mouse endpoints of the HID port are transmit-only, so both 64-byte
+   halves of their endpoint RAM can hold reports. While one half is armed
+   the next report is staged in the other, and the IN-complete interrupt
+   only repoints the DMA address at it and re-arms; the copy happened
+   before, off the critical path. A report sent with both halves taken
+   replaces the staged one.
+   ----------------------------------------------------------------------- */
+typedef struct {
+    volatile uint16_t *dma;
+    volatile uint8_t *tlen;
+    volatile uint8_t *ctrl;
+    uint8_t *ram;            // two 64-byte halves
+    uint8_t half;            // half holding the armed report
+    volatile uint8_t busy;   // a report is armed
+    volatile uint8_t staged; // length staged in the other half, 0 = none
+} TxPingPong;
+
+#if (USB_SWAP_MODE == 0)
+static TxPingPong MouseEp2Tx = {&R16_U2EP2_DMA, &R8_U2EP2_T_LEN, &R8_U2EP2_CTRL, U2EP2_Databuf, 0, 0, 0};
+#if !MOUSE_COMPOSITE
+static TxPingPong MouseEp3Tx = {&R16_U2EP3_DMA, &R8_U2EP3_T_LEN, &R8_U2EP3_CTRL, U2EP3_Databuf, 0, 0, 0};
+#endif
+#else
+static TxPingPong MouseEp2Tx = {&R16_UEP2_DMA, &R8_UEP2_T_LEN, &R8_UEP2_CTRL, EP2_Databuf, 0, 0, 0};
+#if !MOUSE_COMPOSITE
+static TxPingPong MouseEp3Tx = {&R16_UEP3_DMA, &R8_UEP3_T_LEN, &R8_UEP3_CTRL, EP3_Databuf, 0, 0, 0};
+#endif
+#endif
+
+static void TxPP_Arm(TxPingPong *pp, uint8_t half, uint8_t len) {
+    pp->half = half;
+    *pp->dma = (uint16_t)(uint32_t)(pp->ram + half * 64);
+    *pp->tlen = len;
+    *pp->ctrl = (*pp->ctrl & ~MASK_UEP_T_RES) | UEP_T_RES_ACK;
+    pp->busy = 1;
+}
+
+static void TxPP_Send(TxPingPong *pp, const uint8_t *data, uint8_t len) {
+    uint8_t other = pp->half ^ 1;
+
+    TRACE(TR_MOUSE_SEND, pp == &MouseEp2Tx ? 2 : 3, pp->busy);
+    memcpy(pp->ram + other * 64, data, len);
+    if (pp->busy) pp->staged = len;
+    else TxPP_Arm(pp, other, len);
+}
+
+// IN-complete interrupt: the staged report goes out on the next poll
+static void TxPP_Done(TxPingPong *pp) {
+    TRACE(TR_MOUSE_IN, pp == &MouseEp2Tx ? 2 : 3, pp->staged ? 1 : 0);
+    pp->busy = 0;
+    if (pp->staged) {
+        TxPP_Arm(pp, pp->half ^ 1, pp->staged);
+        pp->staged = 0;
+    }
+}
+
+static uint8_t TxPP_Full(const TxPingPong *pp) {
+    return pp->busy && pp->staged;
+}
+
+static void TxPP_Reset(TxPingPong *pp) {
+    pp->busy = 0;
+    pp->staged = 0;
+    Report_Forget(pp == &MouseEp2Tx ? REPORT_EP2 : REPORT_EP3);
+}
+
+// EP2 of the HID port (absolute mouse, or both mice when composite)
+static void Send_MouseEp2(const uint8_t *data, uint8_t len) {
+    TxPP_Send(&MouseEp2Tx, data, len);
+}
+
 void Send_Mouse_Report(uint8_t *data) {
+    uint8_t rep[MOUSE_ABS_REPORT_LEN + 1] = {0};
+
+    // Positions cannot be expressed in boot protocol; send buttons only
+    if (!HidProtocol[1]) {
+        rep[0] = data[0];
+        if (Report_Unchanged(REPORT_EP2, rep, MOUSE_BOOT_REPORT_LEN, MOUSE_BOOT_REPORT_LEN)) return;
+        Send_MouseEp2(rep, MOUSE_BOOT_REPORT_LEN);
+        return;
+    }
+    // Buttons and position are state, wheel and pan are not
+#if MOUSE_COMPOSITE
+    rep[0] = MOUSE_REPORT_ID_ABS;
+    memcpy(rep + 1, data, MOUSE_ABS_REPORT_LEN);
+    if (Report_Unchanged(REPORT_EP2, rep, MOUSE_ABS_REPORT_LEN + 1, 6)) return;
+    Send_MouseEp2(rep, MOUSE_ABS_REPORT_LEN + 1);
+#else
+    if (Report_Unchanged(REPORT_EP2, data, MOUSE_ABS_REPORT_LEN, 5)) return;
+    Send_MouseEp2(data, MOUSE_ABS_REPORT_LEN);
+#endif
+}
+
+void Send_MouseRel_Report(uint8_t *data, uint8_t len) {
+#if MOUSE_COMPOSITE
+    uint8_t rep[8]; // report ID + relative layout
+
+    // Boot protocol reports carry no report ID
+    if (len == MOUSE_BOOT_REPORT_LEN) {
+        if (Report_Unchanged(REPORT_EP2, data, len, 1)) return;
+        Send_MouseEp2(data, len);
+        return;
+    }
+    rep[0] = MOUSE_REPORT_ID_REL;
+    memcpy(rep + 1, data, len);
+    if (Report_Unchanged(REPORT_EP2, rep, len + 1, 2)) return;
+    Send_MouseEp2(rep, len + 1);
+#else
+    // Only the buttons are state; any motion is new
+    if (Report_Unchanged(REPORT_EP3, data, len, 1)) return;
+    TxPP_Send(&MouseEp3Tx, data, len);
+#endif
+}
+
+/* -----------------------------------------------------------------------
+   RELATIVE MOUSE ACCUMULATOR
+   Commands add motion here; one report is drained per IN transaction. A
+   delta larger than the active layout can carry is split across polls
+   instead of being clipped, and motion arriving faster than the poll
+   interval is merged instead of overwriting the armed report.
+   ----------------------------------------------------------------------- */
+#define MOUSE_REL_REPORT_LEN 7 // buttons, X16, Y16, wheel, pan
+#define MOUSE_REL_ACC_LIMIT  (32767L * 8)
+
+// Wheel and pan motion is accumulated in 1/120 detent units and converted
+// to report counts with the Resolution Multiplier the target selected.
+#define DEF_USB_GET_REPORT      0x01
+#define HID_REPORT_TYPE_FEATURE 0x03
+#define WHEEL_UNITS_PER_NOTCH   120
+#define WHEEL_HIRES_MULTIPLIER  8 // physical maximum of the Resolution Multiplier usages
+
+// Resolution Multiplier feature byte per interface: bits 0-1 wheel, bits 2-3 pan
+uint8_t MouseResMult[3] = {0};
+static int32_t AbsAccWheel, AbsAccPan;
+static volatile int32_t RelAccX, RelAccY, RelAccWheel, RelAccPan;
+static volatile uint8_t RelButtons, RelButtonsSent;
+#if USB_HOST_PASSTHROUGH
+// RelButtons is both ORed
+static uint8_t RelHostButtons, RelLocalButtons;
+#endif
+
+// Busy means both ping-pong halves are taken; a producer waits for the
+// IN-complete instead of replacing the staged report
+#if MOUSE_COMPOSITE
+// Both report IDs share EP2
+#define REL_EP_BUSY TxPP_Full(&MouseEp2Tx)
+#else
+#define REL_EP_BUSY TxPP_Full(&MouseEp3Tx)
+#endif
+#define ABS_EP_BUSY TxPP_Full(&MouseEp2Tx)
+
+// Any mouse report not yet polled
+#if MOUSE_COMPOSITE
+#define MOUSE_TX_BUSY MouseEp2Tx.busy
+#else
+#define MOUSE_TX_BUSY (MouseEp2Tx.busy || MouseEp3Tx.busy)
+#endif
+
+static int32_t ClampRel(int32_t v, int32_t lim) {
+    return v > lim ? lim : (v < -lim ? -lim : v);
+}
+
+static int32_t WheelUnitsPerCount(uint8_t intf, uint8_t pan) {
+    uint8_t mult = pan ? (MouseResMult[intf] >> 2) & 0x03 : MouseResMult[intf] & 0x03;
+    return mult ? WHEEL_UNITS_PER_NOTCH / WHEEL_HIRES_MULTIPLIER : WHEEL_UNITS_PER_NOTCH;
+}
+
+// Takes as many whole report counts out of a 1/120-unit accumulator as fit
+static int32_t TakeWheelCounts(volatile int32_t *acc, int32_t unit) {
+    int32_t counts = ClampRel(*acc / unit, 127);
+    *acc -= counts * unit;
+    return counts;
+}
+
+void MouseRel_Flush(void) {
+    uint8_t rep[MOUSE_REL_REPORT_LEN];
+    uint8_t len;
+    int32_t dx, dy, wheel, pan;
+
+    if (HidProtocol[MOUSE_REL_INTF]) {
+        dx = ClampRel(RelAccX, 32767);
+        dy = ClampRel(RelAccY, 32767);
+        wheel = TakeWheelCounts(&RelAccWheel, WheelUnitsPerCount(2, 0));
+        pan = TakeWheelCounts(&RelAccPan, WheelUnitsPerCount(2, 1));
+    } else {
+        // Boot layout has no wheel or pan; drop them
+        dx = ClampRel(RelAccX, 127);
+        dy = ClampRel(RelAccY, 127);
+        wheel = pan = 0;
+        RelAccWheel = RelAccPan = 0;
+    }
+    if (dx == 0 && dy == 0 && wheel == 0 && pan == 0 && RelButtons == RelButtonsSent) return;
+
+    RelAccX -= dx;
+    RelAccY -= dy;
+
+    rep[0] = RelButtons;
+    if (HidProtocol[MOUSE_REL_INTF]) {
+        rep[1] = (uint8_t)dx; rep[2] = (uint8_t)(dx >> 8);
+        rep[3] = (uint8_t)dy; rep[4] = (uint8_t)(dy >> 8);
+        rep[5] = (uint8_t)wheel;
+        rep[6] = (uint8_t)pan;
+        len = MOUSE_REL_REPORT_LEN;
+    } else {
+        rep[1] = (uint8_t)dx;
+        rep[2] = (uint8_t)dy;
+        len = MOUSE_BOOT_REPORT_LEN;
+    }
+
+    RelButtonsSent = RelButtons;
+#if MOUSE_COMPOSITE
+    U2HIDMouse[0] = RelButtons; // shared button state
+#endif
+    Send_MouseRel_Report(rep, len);
+}
+
+// wheel and pan are in 1/120 detent units
+void MouseRel_Queue(uint8_t buttons, int16_t dx, int16_t dy, int16_t wheel, int16_t pan) {
+#if USB_HOST_PASSTHROUGH
+    RelHostButtons = buttons;
+    buttons |= RelLocalButtons;
+#endif
+    RelButtons = buttons;
+    RelAccX = ClampRel(RelAccX + dx, MOUSE_REL_ACC_LIMIT);
+    RelAccY = ClampRel(RelAccY + dy, MOUSE_REL_ACC_LIMIT);
+    RelAccWheel = ClampRel(RelAccWheel + wheel, MOUSE_REL_ACC_LIMIT);
+    RelAccPan = ClampRel(RelAccPan + pan, MOUSE_REL_ACC_LIMIT);
+    if (!REL_EP_BUSY) MouseRel_Flush();
+}
+
+// Called from the HID port's IN-complete interrupt for the relative endpoint
+void MouseRel_InDone(void) {
+    // Absolute emulation feeds the next step only once earlier motion drained
+    if (RelAccX || RelAccY || !AbsEmu_Step()) MouseRel_Flush();
+}
+
+/* -----------------------------------------------------------------------
+   TIME BASE
+   SysTick runs free at HCLK/8 and is read as a wrapping 32-bit tick count;
+   compare times only through signed differences.
+   ----------------------------------------------------------------------- */
+#define TICKS_PER_MS (FREQ_SYS / 8 / 1000)
+
+void Clock_Init(void) {
+    SysTick->CTLR = SysTick_CTLR_INIT | SysTick_CTLR_STE;
+}
+
+static uint32_t Clock_Now(void) {
+    return SYS_GetSysTickCnt();
+}
+
+// Milliseconds since boot, counted by TMR0. SysTick wraps every ~572 s,
+// so intervals that may be that old (last report, cursor rest) use this.
+static volatile uint32_t ClockMsLo, ClockMsHi;
+
+static uint64_t Clock_Ms(void) {
+    uint32_t hi, lo;
+
+    do {
+        hi = ClockMsHi;
+        lo = ClockMsLo;
+    } while (hi != ClockMsHi);
+    return (uint64_t)hi << 32 | lo;
+}
+
+// TMR0 interrupts once per millisecond to drive work that has to happen
+// without a host command, such as key repeat
+void Timer_Init(void) {
+    TMR0_TimerInit(FREQ_SYS / 1000);
+    TMR0_ITCfg(ENABLE, TMR0_3_IT_CYC_END);
+    PFIC_EnableIRQ(TMR0_IRQn);
+}
+
+#if DEBUG_PRT
+/* -----------------------------------------------------------------------
+   TRACE
+   Interrupts and the main loop log 8-byte records
+   [TRACE_SYNC, id, a, b, time32 LE], time in SysTick ticks, into a RAM
+   ring; the UART1 transmit-empty interrupt refills the TX FIFO from it in
+   the background. Logging costs a few stores, never a wait. A full ring
+   drops records, and a TR_LOST record with the count follows once there
+   is room. tools/trace-decode.js turns a capture into Chrome trace JSON.
+   The vendor libraries' PRINT output shares the port; the decoder skips it.
+   ----------------------------------------------------------------------- */
+#define TRACE_SYNC    0xA5
+#define TRACE_RECORDS 128 // power of two, 1 KiB
+#define TRACE_BAUD    921600
+
+static uint8_t TraceRing[TRACE_RECORDS][8];
+static uint16_t TraceHead = 0, TraceTail = 0; // in records
+static uint8_t TraceByte = 0;                 // next byte of the tail record
+static uint16_t TraceLost = 0;
+
+static uint8_t Trace_Put(uint8_t id, uint8_t a, uint8_t b) {
+    uint32_t t = Clock_Now();
+    uint8_t *r;
+
+    if ((uint16_t)(TraceHead - TraceTail) == TRACE_RECORDS) return 0;
+    r = TraceRing[TraceHead & (TRACE_RECORDS - 1)];
+    r[0] = TRACE_SYNC; r[1] = id; r[2] = a; r[3] = b;
+    r[4] = (uint8_t)t; r[5] = (uint8_t)(t >> 8); r[6] = (uint8_t)(t >> 16); r[7] = (uint8_t)(t >> 24);
+    TraceHead++;
+    return 1;
+}
+
+// Any context
+void Trace(uint8_t id, uint8_t a, uint8_t b) {
+    uint32_t irq;
+
+    SYS_DisableAllIrq(&irq);
+    if (TraceLost && Trace_Put(TR_LOST, (uint8_t)TraceLost, (uint8_t)(TraceLost >> 8))) TraceLost = 0;
+    if (!Trace_Put(id, a, b) && TraceLost != 0xFFFF) TraceLost++;
+    R8_UART1_IER |= RB_IER_THR_EMPTY;
+    SYS_RecoverIrq(irq);
+}
+
+void Trace_Init(void) {
+    UART1_BaudRateCfg(TRACE_BAUD);
+    R8_UART1_MCR |= RB_MCR_INT_OE;
+    PFIC_EnableIRQ(UART1_IRQn);
+}
+
+__INTERRUPT
+__HIGH_CODE
+void UART1_IRQHandler(void) {
+    uint8_t n;
+
+    if (UART1_GetITFlag() != UART_II_THR_EMPTY) return;
+    for (n = 0; n < UART_FIFO_SIZE && TraceTail != TraceHead; n++) {
+        R8_UART1_THR = TraceRing[TraceTail & (TRACE_RECORDS - 1)][TraceByte];
+        if (++TraceByte == 8) {
+            TraceByte = 0;
+            TraceTail++;
+        }
+    }
+    if (TraceTail == TraceHead) R8_UART1_IER &= ~RB_IER_THR_EMPTY;
+}
+#endif
+
+/* -----------------------------------------------------------------------
+   ABSOLUTE-TO-RELATIVE EMULATION
+   BIOS/UEFI setup usually only drives the boot mouse. With emulation on,
+   absolute commands set waypoints instead; the firmware tracks where it
+   believes the cursor is and walks it there with bounded relative steps,
+   one per IN transaction of the relative endpoint. Button changes are
+   applied on arrival. Before the first move, and again after an idle
+   period of EmuHomeMs, the cursor is driven into the top-left corner so
+   the estimate cannot drift for long.
+   ----------------------------------------------------------------------- */
+#define EMU_WAYPOINTS   4
+#define EMU_HOME_MARGIN 4 // homing travels 5/4 of the screen to be sure
+
+typedef struct {
+    int32_t x, y;       // in target counts
+    uint8_t buttons;
+} EmuWaypoint;
+
+uint8_t EmuEnabled = 0;
+uint16_t EmuWidth = 1024, EmuHeight = 768; // target screen in relative counts
+uint16_t EmuHomeMs = 10000;                // 0 = home only when tracking is lost
+uint8_t EmuStep = 16;                      // counts per report and axis, 1..127
+
+static EmuWaypoint EmuWp[EMU_WAYPOINTS];
+static uint8_t EmuWpCount;
+static int32_t EmuX, EmuY;
+static uint8_t EmuButtons;
+static uint16_t EmuHomeSteps;   // homing reports still to send
+static uint8_t EmuHomed;        // estimate is valid
+static uint64_t EmuIdleT;       // Clock_Ms when the cursor last came to rest
+
+static void AbsEmu_Home(void) {
+    uint16_t span = EmuWidth > EmuHeight ? EmuWidth : EmuHeight;
+    span += span / EMU_HOME_MARGIN;
+    EmuHomeSteps = (span + EmuStep - 1) / EmuStep;
+    EmuX = EmuY = 0;
+    EmuHomed = 1;
+}
+
+// Queues the next relative step; returns 0 when there is nothing to do
+uint8_t AbsEmu_Step(void) {
+    EmuWaypoint *wp;
+    int32_t dx, dy, ax, ay, m;
+    uint8_t buttons;
+
+    if (!EmuEnabled) return 0;
+    if (EmuHomeSteps) {
+        EmuHomeSteps--;
+        MouseRel_Queue(EmuButtons, -EmuStep, -EmuStep, 0, 0);
+        return 1;
+    }
+
+    while (EmuWpCount) {
+        wp = &EmuWp[0];
+        dx = wp->x - EmuX;
+        dy = wp->y - EmuY;
+        if (dx || dy) {
+            // Scale both axes together so the path stays straight
+            ax = dx < 0 ? -dx : dx;
+            ay = dy < 0 ? -dy : dy;
+            m = ax > ay ? ax : ay;
+            if (m > EmuStep) {
+                dx = dx * EmuStep / m;
+                dy = dy * EmuStep / m;
+            }
+            EmuX += dx;
+            EmuY += dy;
+            MouseRel_Queue(EmuButtons, (int16_t)dx, (int16_t)dy, 0, 0);
+            return 1;
+        }
+
+        buttons = wp->buttons;
+        memmove(&EmuWp[0], &EmuWp[1], sizeof(EmuWaypoint) * (EMU_WAYPOINTS - 1));
+        EmuWpCount--;
+        EmuIdleT = Clock_Ms();
+        if (buttons != EmuButtons) {
+            EmuButtons = buttons;
+            MouseRel_Queue(EmuButtons, 0, 0, 0, 0);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Adds a waypoint for an absolute position (0..0x7FFF on both axes)
+void AbsEmu_Target(uint8_t buttons, const uint8_t *pos) {
+    int32_t x = (int32_t)(pos[0] | ((pos[1] & 0x7F) << 8)) * EmuWidth >> 15;
+    int32_t y = (int32_t)(pos[2] | ((pos[3] & 0x7F) << 8)) * EmuHeight >> 15;
+    uint8_t idle = EmuWpCount == 0 && EmuHomeSteps == 0;
+
+    if (idle && EmuButtons == 0 && !buttons &&
+        (!EmuHomed || (EmuHomeMs && Clock_Ms() - EmuIdleT > EmuHomeMs))) {
+        AbsEmu_Home();
+    }
+
+    // Coalesce moves that do not change the buttons; keep the rest in order
+    if (EmuWpCount && EmuWp[EmuWpCount - 1].buttons == buttons) EmuWpCount--;
+    else if (EmuWpCount == EMU_WAYPOINTS) EmuWpCount--;
+    EmuWp[EmuWpCount].x = x;
+    EmuWp[EmuWpCount].y = y;
+    EmuWp[EmuWpCount].buttons = buttons;
+    EmuWpCount++;
+
+    if (!REL_EP_BUSY && !AbsEmu_Step()) MouseRel_Flush();
+}
+
+void AbsEmu_Reset(void) {
+    EmuWpCount = 0;
+    EmuHomeSteps = 0;
+    EmuButtons = 0;
+    EmuHomed = 0;
+}
+
+/* -----------------------------------------------------------------------
+   ABSOLUTE POINTER INTERPOLATION
+   Command 0x0A carries a position stamped with the host's millisecond
+   clock. Samples are replayed a bounded delay behind real time, and every
+   IN transaction of the absolute endpoint gets a Catmull-Rom interpolated
+   position between them, so the cursor moves at the poll rate while the
+   host sends one sample per frame. Command 2 still jumps immediately.
+   ----------------------------------------------------------------------- */
+#define ABS_TRACK_LEN         4   // samples kept for the spline look-behind
+#define ABS_MAX_GAP_MS        100 // longer pauses start a new stroke
+#define ABS_DEFAULT_GAP_MS    16
+#define ABS_MIN_DELAY_MS      2
+#define ABS_MAX_DELAY_MS      50  // upper bound on the latency added
+#define ABS_POS_MAX           0x7FFF
+#define ABS_FRAC_BITS         10
+
+typedef struct {
+    uint32_t t;         // tick at which the cursor reaches this sample
+    int32_t x, y;
+    uint8_t buttons;
+} AbsSample;
+
+static AbsSample AbsTrack[ABS_TRACK_LEN]; // oldest first
+static uint8_t AbsTrackLen;
+static uint16_t AbsLastHostMs;
+static uint32_t AbsGapTicks = ABS_DEFAULT_GAP_MS * TICKS_PER_MS; // smoothed sample spacing
+static uint32_t AbsPlayT;                 // playback time of the last report
+static volatile uint8_t AbsPlaying, AbsPending;
+
+// Replay delay: one smoothed sample interval plus a millisecond of margin
+static uint32_t AbsDelay(void) {
+    uint32_t d = AbsGapTicks + TICKS_PER_MS;
+    if (d < ABS_MIN_DELAY_MS * TICKS_PER_MS) d = ABS_MIN_DELAY_MS * TICKS_PER_MS;
+    if (d > ABS_MAX_DELAY_MS * TICKS_PER_MS) d = ABS_MAX_DELAY_MS * TICKS_PER_MS;
+    return d;
+}
+
+// Uniform Catmull-Rom between p1 and p2, u in [0, 1 << ABS_FRAC_BITS)
+static int32_t CatmullRom(int32_t p0, int32_t p1, int32_t p2, int32_t p3, int32_t u) {
+    int32_t a = -p0 + 3 * p1 - 3 * p2 + p3;
+    int32_t b = 2 * p0 - 5 * p1 + 4 * p2 - p3;
+    int32_t c = p2 - p0;
+    int32_t v = ((((a * u) >> ABS_FRAC_BITS) + b) * u) >> ABS_FRAC_BITS;
+    v = (((v + c) * u) >> ABS_FRAC_BITS) + 2 * p1;
+    v >>= 1;
+    // The spline overshoots near sharp turns; keep it on screen
+    return v < 0 ? 0 : (v > ABS_POS_MAX ? ABS_POS_MAX : v);
+}
+
+// Queues the report in U2HIDMouse. On the composite endpoint a staged
+// relative report is never replaced; this one follows on the IN-complete.
+static void MouseAbs_Submit(void) {
+#if MOUSE_COMPOSITE
+    if (ABS_EP_BUSY) {
+        AbsPending = 1;
+        return;
+    }
+    RelButtons = RelButtonsSent = U2HIDMouse[0]; // shared button state
+#endif
+    AbsPending = 0;
+    Send_Mouse_Report(U2HIDMouse);
+}
+
+static void MouseAbs_Send(uint8_t buttons, int32_t x, int32_t y) {
+    U2HIDMouse[0] = buttons;
+    U2HIDMouse[1] = (uint8_t)x; U2HIDMouse[2] = (uint8_t)(x >> 8);
+    U2HIDMouse[3] = (uint8_t)y; U2HIDMouse[4] = (uint8_t)(y >> 8);
+    U2HIDMouse[5] = (uint8_t)TakeWheelCounts(&AbsAccWheel, WheelUnitsPerCount(1, 0));
+    U2HIDMouse[6] = (uint8_t)TakeWheelCounts(&AbsAccPan, WheelUnitsPerCount(1, 1));
+    MouseAbs_Submit();
+}
+
+// Emits the position due now; stops once the newest sample was reached
+static void MouseAbs_Flush(void) {
+    uint32_t play = Clock_Now() - AbsDelay();
+    const AbsSample *s0, *s1, *s2, *s3;
+    uint8_t i, last = AbsTrackLen - 1;
+    int32_t u;
+
+    if ((int32_t)(play - AbsPlayT) < 0) play = AbsPlayT; // never replay backwards
+    AbsPlayT = play;
+
+    if ((int32_t)(play - AbsTrack[last].t) >= 0) {
+        AbsPlaying = 0;
+        MouseAbs_Send(AbsTrack[last].buttons, AbsTrack[last].x, AbsTrack[last].y);
+        return;
+    }
+
+    i = 0;
+    while (i + 1 < last && (int32_t)(play - AbsTrack[i + 1].t) >= 0) i++;
+    s1 = &AbsTrack[i];
+    s2 = &AbsTrack[i + 1];
+    s0 = i > 0 ? &AbsTrack[i - 1] : s1;
+    s3 = i + 2 <= last ? &AbsTrack[i + 2] : s2;
+
+    if ((int32_t)(play - s1->t) <= 0) u = 0;
+    else u = (int32_t)(((play - s1->t) << ABS_FRAC_BITS) / (s2->t - s1->t));
+    MouseAbs_Send(s1->buttons,
+                  CatmullRom(s0->x, s1->x, s2->x, s3->x, u),
+                  CatmullRom(s0->y, s1->y, s2->y, s3->y, u));
+}
+
+static void MouseAbs_Push(uint32_t t, int32_t x, int32_t y, uint8_t buttons) {
+    if (AbsTrackLen == ABS_TRACK_LEN) {
+        memmove(&AbsTrack[0], &AbsTrack[1], sizeof(AbsSample) * (ABS_TRACK_LEN - 1));
+        AbsTrackLen--;
+    }
+    AbsTrack[AbsTrackLen].t = t;
+    AbsTrack[AbsTrackLen].x = x;
+    AbsTrack[AbsTrackLen].y = y;
+    AbsTrack[AbsTrackLen].buttons = buttons;
+    AbsTrackLen++;
+}
+
+// Command 0x0A: [buttons, X16 LE, Y16 LE, host ms16 LE]
+void MouseAbs_Track(const uint8_t *p) {
+    uint32_t now = Clock_Now();
+    uint32_t delay = AbsDelay();
+    uint16_t host_ms = p[5] | (p[6] << 8);
+    int16_t gap = (int16_t)(host_ms - AbsLastHostMs);
+    int32_t x = p[1] | (p[2] << 8);
+    int32_t y = p[3] | (p[4] << 8);
+    AbsSample *last;
+    uint32_t due, earliest;
+
+    if (EmuEnabled) {
+        AbsEmu_Target(p[0], p + 1);
+        return;
+    }
+
+    AbsLastHostMs = host_ms;
+    if (x > ABS_POS_MAX) x = ABS_POS_MAX;
+    if (y > ABS_POS_MAX) y = ABS_POS_MAX;
+
+    if (AbsTrackLen == 0 || gap <= 0 || gap > ABS_MAX_GAP_MS) {
+        // New stroke: glide from where the cursor is over one delay
+        AbsTrackLen = 0;
+        MouseAbs_Push(now - delay,
+                      U2HIDMouse[1] | (U2HIDMouse[2] << 8),
+                      U2HIDMouse[3] | (U2HIDMouse[4] << 8),
+                      U2HIDMouse[0]);
+        due = now;
+    } else {
+        last = &AbsTrack[AbsTrackLen - 1];
+        // Playback caught up and is holding the last sample; restart from there
+        if (!AbsPlaying) last->t = now - delay;
+        AbsGapTicks += ((int32_t)(gap * TICKS_PER_MS) - (int32_t)AbsGapTicks) / 8;
+
+        // Keep the host's spacing, but never schedule past now (extra
+        // latency) or before the playback position (a jump)
+        due = last->t + gap * TICKS_PER_MS;
+        earliest = (int32_t)(now - delay - last->t) > 0 ? now - delay : last->t + 1;
+        if ((int32_t)(due - now) > 0) due = now;
+        if ((int32_t)(due - earliest) < 0) due = earliest;
+    }
+    MouseAbs_Push(due, x, y, p[0]);
+
+    AbsPlaying = 1;
+    if (!ABS_EP_BUSY) MouseAbs_Flush();
+}
+
+// Called from the HID port's IN-complete interrupt for the absolute endpoint
+void MouseAbs_InDone(void) {
+    if (AbsPending) MouseAbs_Submit();
+    else if (AbsPlaying) MouseAbs_Flush();
+}
+
+// TMR0 context: a glide whose last position was dropped as unchanged has
+// no IN-complete to continue from
+void MouseAbs_Tick(void) {
+    if (AbsPlaying && !AbsPending && !MouseEp2Tx.busy) MouseAbs_Flush();
+}
+
+#if MOUSE_COMPOSITE
+// IN-complete on the shared endpoint: relative motion first, then absolute
+void Mouse_InDone(void) {
+    MouseRel_InDone();
+    if (!REL_EP_BUSY) MouseAbs_InDone();
+}
+#endif
+
+// Sends an absolute report. pos is X16/Y16 (4 bytes) or NULL to keep the last
+// position; wheel and pan are in 1/120 detent units.
+void MouseAbs_Report(uint8_t buttons, const uint8_t *pos, int16_t wheel, int16_t pan) {
+    if (EmuEnabled) {
+        if (pos) AbsEmu_Target(buttons, pos);
+        if (wheel || pan) MouseRel_Queue(EmuButtons, 0, 0, wheel, pan);
+        return;
+    }
+
+    AbsAccWheel = ClampRel(AbsAccWheel + wheel, MOUSE_REL_ACC_LIMIT);
+    AbsAccPan = ClampRel(AbsAccPan + pan, MOUSE_REL_ACC_LIMIT);
+
+    U2HIDMouse[0] = buttons;
+    if (pos) {
+        // An explicit position (e.g. a click) overrides any glide in progress
+        memcpy(&U2HIDMouse[1], pos, 4);
+        AbsTrackLen = 0;
+        AbsPlaying = 0;
+    }
+    U2HIDMouse[5] = (uint8_t)TakeWheelCounts(&AbsAccWheel, WheelUnitsPerCount(1, 0));
+    U2HIDMouse[6] = (uint8_t)TakeWheelCounts(&AbsAccPan, WheelUnitsPerCount(1, 1));
+    MouseAbs_Submit();
+}
+
+/* -----------------------------------------------------------------------
+   POINTER BALLISTICS
+   Relative motion from commands 7 and 8 can be run through a transfer
+   curve before it is queued. The gain is looked up by pointer speed and
+   applied in Q8; the fraction of each result is carried per axis so slow
+   motion is not rounded away.
+   ----------------------------------------------------------------------- */
+#define BALLISTICS_CURVES     3
+#define BALLISTICS_LUT_LEN    17
+#define BALLISTICS_SPEED_STEP 2  // counts/ms between LUT entries
+#define BALLISTICS_MAX_DT_MS  16 // motion after a pause is treated as slow
+
+// Gain in Q8 (256 = 1.0) at 0, 2, 4 ... 32 counts/ms; lives in flash
+static const uint16_t BallisticsLut[BALLISTICS_CURVES][BALLISTICS_LUT_LEN] = {
+    // precise: below 1:1 for fine motion, mild boost for sweeps
+    {128, 160, 192, 224, 256, 272, 288, 304, 320, 336, 352, 360, 368, 376, 384, 384, 384},
+    // default
+    {256, 272, 304, 336, 368, 400, 424, 448, 464, 480, 496, 504, 512, 512, 512, 512, 512},
+    // fast
+    {256, 304, 368, 432, 496, 552, 600, 640, 672, 704, 728, 744, 760, 768, 768, 768, 768},
+};
+
+uint8_t BallisticsCurve = 0; // 0 = off (1:1), otherwise 1-based BallisticsLut row
+static int32_t BalRemX, BalRemY;
+static uint32_t BalLastT;
+
+static uint32_t Ballistics_Gain(uint32_t speed_q8) {
+    const uint16_t *lut = BallisticsLut[BallisticsCurve - 1];
+    uint32_t pos = speed_q8 / BALLISTICS_SPEED_STEP;
+    uint32_t i = pos >> 8, frac = pos & 0xFF;
+
+    if (i >= BALLISTICS_LUT_LEN - 1) return lut[BALLISTICS_LUT_LEN - 1];
+    return lut[i] + ((((int32_t)lut[i + 1] - (int32_t)lut[i]) * (int32_t)frac) >> 8);
+}
+
+static int32_t Ballistics_Scale(int32_t d, uint32_t gain, int32_t *rem) {
+    int32_t total = d * (int32_t)gain + *rem;
+    int32_t out = total / 256;
+    *rem = total - out * 256;
+    return out;
+}
+
+// Commands 7 and 8 enter here; firmware-generated motion uses MouseRel_Queue
+void MouseRel_Move(uint8_t buttons, int16_t dx, int16_t dy, int16_t wheel, int16_t pan) {
+    uint32_t now, dt, ax, ay, mag, gain;
+    int32_t ox = dx, oy = dy;
+
+    if (BallisticsCurve && (dx || dy)) {
+        now = Clock_Now();
+        dt = now - BalLastT;
+        BalLastT = now;
+        // Commands arrive at most once per 1 ms frame
+        if (dt > BALLISTICS_MAX_DT_MS * TICKS_PER_MS) dt = BALLISTICS_MAX_DT_MS * TICKS_PER_MS;
+        if (dt < TICKS_PER_MS) dt = TICKS_PER_MS;
+
+        ax = dx < 0 ? -dx : dx;
+        ay = dy < 0 ? -dy : dy;
+        mag = ax > ay ? ax + ((ay * 3) >> 3) : ay + ((ax * 3) >> 3); // ~hypot
+        // Speed in counts/ms, Q8: mag / (dt in ms, Q8), computed without overflow
+        gain = Ballistics_Gain((mag << 16) / ((dt << 8) / TICKS_PER_MS));
+
+        ox = Ballistics_Scale(dx, gain, &BalRemX);
+        oy = Ballistics_Scale(dy, gain, &BalRemY);
+        if (ox == 0 && oy == 0 && wheel == 0 && pan == 0 && buttons == RelButtons) return;
+    }
+    MouseRel_Queue(buttons, (int16_t)ClampRel(ox, 32767), (int16_t)ClampRel(oy, 32767), wheel, pan);
+}
+
+void Mouse_Reset(void) {
+    RelAccX = RelAccY = RelAccWheel = RelAccPan = 0;
+    RelButtons = RelButtonsSent = 0;
+    TxPP_Reset(&MouseEp2Tx);
+#if !MOUSE_COMPOSITE
+    TxPP_Reset(&MouseEp3Tx);
+#endif
+    // Bus reset returns every interface to report protocol and no idle rate
+    memset(HidProtocol, 1, sizeof(HidProtocol));
+    memset(HidIdle, 0, sizeof(HidIdle));
+    AbsAccWheel = AbsAccPan = 0;
+    MouseResMult[1] = MouseResMult[2] = 0;
+    AbsTrackLen = 0;
+    AbsPlaying = AbsPending = 0;
+    AbsEmu_Reset();
+}
+
+/* -----------------------------------------------------------------------
+   TELEMETRY
+   Saturating event counters, read by the host with command 0x0D.
+   ----------------------------------------------------------------------- */
+#define TELEMETRY_WATCHDOG_RELEASES 0 // host went silent with input held
+#define TELEMETRY_TYPEMATIC_STOPS   1 // held keys released after TYPEMATIC_RELEASE_MS
+#define TELEMETRY_CMD_DROPS         2 // command ring was full
+#define TELEMETRY_LINK_ERRORS       3 // UART controller frame with a bad sum
+#define TELEMETRY_PORT_RESETS       4 // wedged USB port reset by the health check
+#define TELEMETRY_DUP_REPORTS       5 // report equal to the last one, not sent
+#define TELEMETRY_COUNTERS          6
+
+uint16_t Telemetry[TELEMETRY_COUNTERS];
+
+static void Telemetry_Count(uint8_t id) {
+    if (Telemetry[id] != 0xFFFF) Telemetry[id]++;
+}
+
+// Command 0x0D: [first] -> [0x0D, first, four counters from first, u16 LE]
+void Telemetry_Read(const uint8_t *p) {
+    uint8_t i, id;
+
+    memset(HID_Buf, 0, sizeof(HID_Buf));
+    HID_Buf[0] = 0x0D;
+    HID_Buf[1] = p[0];
+    for (i = 0; i < 4; i++) {
+        id = p[0] + i;
+        if (id >= TELEMETRY_COUNTERS) break;
+        HID_Buf[2 + 2 * i] = (uint8_t)Telemetry[id];
+        HID_Buf[3 + 2 * i] = (uint8_t)(Telemetry[id] >> 8);
+    }
+    Send_Control_Data(HID_Buf);
+}
+
+/* -----------------------------------------------------------------------
+   CRASH RECORD
+   HardFault_Handler overrides the vendor's weak one: before resetting the
+   same way it saves the fault CSRs, the top of the stack and, in the trace
+   build, the last trace records to the last DataFlash page. The record
+   survives power cycles until the host clears it; command 0x0F reads it
+   and tools/crash-dump.js symbolizes it against the ELF. The fault may be
+   a stack overflow, so a naked entry stub takes sp and ra as the faulting
+   code left them and moves onto CrashStack before any C code runs.
+   ----------------------------------------------------------------------- */
+#define CRASH_ADDR          (EEPROM_MAX_SIZE - EEPROM_PAGE_SIZE) // last DataFlash page
+#define CRASH_MAGIC         0x48535243 // "CRSH"
+#define CRASH_VERSION       1
+#define CRASH_STACK_WORDS   16
+#define CRASH_TRACE_RECORDS 16
+#define CRASH_RAM_START     0x20000000
+#define CRASH_RAM_END       0x20008000
+#define CRASH_CLEAR         0xFF // command 0x0F chunk that erases the record
+#define CRASH_STACK_BYTES   512  // Crash_Save and the flash ROM routines
+#define CRASH_STR_(x)       #x
+#define CRASH_STR(x)        CRASH_STR_(x)
+
+// Little-endian, 224 bytes, read by the host in 8-byte chunks
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t faults;       // since the record was last cleared, saturating
+    uint8_t stackWords;   // valid entries in stack
+    uint8_t traceRecords; // entries in trace, oldest first; unused ones are zero
+    uint32_t mcause, mepc, mtval;
+    uint32_t sp, ra;      // as found on entry to the handler
+    uint32_t ticks;       // SysTick at the fault
+    uint32_t stack[CRASH_STACK_WORDS];
+    uint8_t trace[CRASH_TRACE_RECORDS][8];
+} CrashRecord;
+
+// Not on the stack, which may be what overflowed
+static CrashRecord Crash;
+// Referenced by name from HardFault_Handler, so not static
+uint32_t CrashStack[CRASH_STACK_BYTES / 4] __attribute__((aligned(16)));
+void Crash_Save(uint32_t sp, uint32_t ra) __attribute__((noreturn));
+
+// Never returns, so nothing is saved: hand the faulting sp and ra to
+// Crash_Save on the reserved stack
+__attribute__((naked))
+__HIGH_CODE
+void HardFault_Handler(void) {
+    __asm__ volatile(
+        "mv a0, sp\n"
+        "mv a1, ra\n"
+        "la sp, CrashStack + " CRASH_STR(CRASH_STACK_BYTES) "\n"
+        "tail Crash_Save\n");
+}
+
+__HIGH_CODE
+void Crash_Save(uint32_t sp, uint32_t ra) {
+    uint32_t n;
+
+    WWDG_SetCounter(0); // the DataFlash write must not be cut short
+    FLASH_ROM_SW_RESET();
+    EEPROM_READ(CRASH_ADDR, &Crash, 8);
+    n = Crash.magic == CRASH_MAGIC ? Crash.faults : 0;
+    memset(&Crash, 0, sizeof(Crash));
+    Crash.magic = CRASH_MAGIC;
+    Crash.version = CRASH_VERSION;
+    Crash.faults = n == 0xFF ? n : n + 1;
+    Crash.mcause = read_csr(mcause);
+    Crash.mepc = read_csr(mepc);
+    Crash.mtval = read_csr(mtval);
+    Crash.sp = sp;
+    Crash.ra = ra;
+    Crash.ticks = Clock_Now();
+
+    if (!(sp & 3) && sp >= CRASH_RAM_START && sp < CRASH_RAM_END) {
+        n = (CRASH_RAM_END - sp) / 4;
+        Crash.stackWords = n < CRASH_STACK_WORDS ? n : CRASH_STACK_WORDS;
+        memcpy(Crash.stack, (const void *)sp, Crash.stackWords * 4);
+    }
+#if DEBUG_PRT
+    // Records already sent stay in the ring until overwritten
+    for (n = 0; n < CRASH_TRACE_RECORDS; n++)
+        memcpy(Crash.trace[n], TraceRing[(TraceHead - CRASH_TRACE_RECORDS + n) & (TRACE_RECORDS - 1)], 8);
+    Crash.traceRecords = CRASH_TRACE_RECORDS;
+#endif
+
+    EEPROM_ERASE(CRASH_ADDR, EEPROM_PAGE_SIZE);
+    EEPROM_WRITE(CRASH_ADDR, &Crash, sizeof(Crash));
+
+    sys_safe_access_enable();
+    R16_INT32K_TUNE = 0xFFFF;
+    sys_safe_access_enable();
+    R8_RST_WDOG_CTRL |= RB_SOFTWARE_RESET;
+    sys_safe_access_disable();
+    while (1);
+}
+
+// Command 0x0F: [chunk] -> [0x0F, chunk, record bytes chunk * 8 .. +7].
+// Without a record the magic does not match. [CRASH_CLEAR] erases it.
+// Runs with interrupts enabled; HID_Buf is shared with replies sent from TMR0.
+void Crash_Read(const uint8_t *p) {
+    uint32_t chunk[2] = {0, 0};
+    uint32_t irq;
+
+    if (p[0] == CRASH_CLEAR) {
+        EEPROM_ERASE(CRASH_ADDR, EEPROM_PAGE_SIZE);
+    } else if (p[0] < sizeof(CrashRecord) / 8) {
+        EEPROM_READ(CRASH_ADDR + p[0] * 8, chunk, 8);
+    }
+    SYS_DisableAllIrq(&irq);
+    memset(HID_Buf, 0, sizeof(HID_Buf));
+    HID_Buf[0] = 0x0F;
+    HID_Buf[1] = p[0];
+    memcpy(HID_Buf + 2, chunk, 8);
+    Send_Control_Data(HID_Buf);
+    SYS_RecoverIrq(irq);
+}
+
+/* -----------------------------------------------------------------------
+   DUPLICATE SUPPRESSION
+   The host resends full state on every event. A report equal to the last
+   one handed to its endpoint changes nothing on the target and would only
+   take a poll slot, so it is dropped and counted. Bytes past state_len are
+   relative (motion, wheel): a report with any of them set is always sent.
+   When the target set a non-zero idle rate, an unchanged report older
+   than that period goes out again. Bus resets, port resets and KVM
+   switches forget the last report, so neutral reports always reach a
+   new target.
+   ----------------------------------------------------------------------- */
+#define REPORT_EPS     3
+#define REPORT_MAX_LEN 8
+
+typedef struct {
+    uint8_t data[REPORT_MAX_LEN];
+    uint8_t len; // 0 = none since the last reset
+    uint64_t t; // Clock_Ms
+} LastReport;
+
+static LastReport LastReports[REPORT_EPS];
+
+// Returns 1 if rep should not be sent, otherwise remembers it as sent.
+// ep is also the interface whose SET_IDLE rate applies; in the composite
+// layout both mouse reports share interface 1 and REPORT_EP2.
+uint8_t Report_Unchanged(uint8_t ep, const uint8_t *rep, uint8_t len, uint8_t state_len) {
+    LastReport *last = &LastReports[ep];
+    uint64_t now = Clock_Ms();
+    uint32_t idle = HID_GetIdle(ep) * 4;
+    uint8_t i;
+
+    if (last->len == len && !memcmp(last->data, rep, len) && (!idle || now - last->t < idle)) {
+        for (i = state_len; i < len && !rep[i]; i++);
+        if (i == len) {
+            Telemetry_Count(TELEMETRY_DUP_REPORTS);
+            return 1;
+        }
+    }
+    if (len > REPORT_MAX_LEN) len = 0; // never compared
+    else memcpy(last->data, rep, len);
+    last->len = len;
+    last->t = now;
+    return 0;
+}
+
+void Report_Forget(uint8_t ep) {
+    LastReports[ep].len = 0;
+}
+
+/* -----------------------------------------------------------------------
+   TYPEMATIC
+   Off by default: key reports pass through and the target repeats held keys
+   itself. With a delay set, the firmware repeats instead. Keys stay held on
+   the target exactly as the host reports them; after the delay the most
+   recently pressed key is let go for TYPEMATIC_GAP_MS and pressed again,
+   then once per period for as long as the host reports it held. Every
+   press restarts the target's own repeat delay, so with a delay and period
+   shorter than the target's, the target never repeats on its own. Keys
+   and modifiers held with no key report from the host for
+   TYPEMATIC_RELEASE_MS are released and counted: that stops a key whose
+   key-up was lost on the host side. A key held longer than that with no
+   other key pressed or released is released as well.
+   ----------------------------------------------------------------------- */
+#define TYPEMATIC_GAP_MS     16    // repeated key let go this long before each repeat
+#define TYPEMATIC_MIN_MS     33    // shortest delay/period, ~30 characters/s
+#define TYPEMATIC_RELEASE_MS 30000 // held input released after this long without a key report
+
+uint16_t TypematicDelay = 0; // ms until the first repeat, 0 = off
+uint16_t TypematicPeriod = 100;
+uint8_t TypHost[8];          // last key report from the host, kept even when off
+uint8_t TypOut[8];           // last key report sent to the target
+uint8_t RepKey = 0;          // key being repeated, 0 = none
+uint8_t RepGap = 0;          // RepKey let go until RepGapEnd
+uint32_t RepNext, RepGapEnd;
+uint64_t TypSeen;            // Clock_Ms of the last key report
+
+static uint8_t Key_Held(const uint8_t *rep, uint8_t usage) {
+    uint8_t i;
+    for (i = 2; i < 8; i++) {
+        if (rep[i] == usage) return 1;
+    }
+    return 0;
+}
+
+// Sends the host report, without RepKey during a repeat gap, if changed
+static void Typematic_Update(void) {
+    uint8_t rep[8];
+    uint8_t i, n = 2;
+
+    memset(rep, 0, sizeof(rep));
+    rep[0] = TypHost[0];
+    for (i = 2; i < 8; i++) {
+        if (TypHost[i] && !(RepGap && TypHost[i] == RepKey)) rep[n++] = TypHost[i];
+    }
+    if (memcmp(rep, TypOut, sizeof(rep))) {
+        memcpy(TypOut, rep, sizeof(rep));
+        Send_Key_Report(rep);
+    }
+}
+
+void Typematic_Reset(void) {
+    KeyEpBusy = 0;
+    Report_Forget(REPORT_KEY);
+    memset(TypHost, 0, sizeof(TypHost));
+    memset(TypOut, 0, sizeof(TypOut));
+    RepKey = RepGap = 0;
+}
+
+static void Key_Apply(uint8_t *data) {
+    uint32_t now = Clock_Now();
+    uint8_t i;
+
+    if (!TypematicDelay) {
+        memcpy(TypHost, data, sizeof(TypHost));
+        Send_Key_Report(data);
+        return;
+    }
+    for (i = 2; i < 8; i++) {
+        if (data[i] && !Key_Held(TypHost, data[i])) {
+            RepKey = data[i];
+            RepGap = 0;
+            RepNext = now + TypematicDelay * TICKS_PER_MS;
+        }
+    }
+    memcpy(TypHost, data, sizeof(TypHost));
+    TypSeen = Clock_Ms();
+    if (RepKey && !Key_Held(TypHost, RepKey)) RepKey = RepGap = 0;
+    Typematic_Update();
+}
+
+#if USB_HOST_PASSTHROUGH
+uint8_t KeyHost[8];  // last report from the controller
+uint8_t KeyLocal[8]; // last report from the local keyboard
+
+// Modifiers are ORed and the keys of both joined, six at most
+static void Key_Merge(void) {
+    uint8_t rep[8];
+    uint8_t i, usage, n = 2;
+
+    memset(rep, 0, sizeof(rep));
+    rep[0] = KeyHost[0] | KeyLocal[0];
+    for (i = 2; i < 14 && n < 8; i++) {
+        usage = i < 8 ? KeyHost[i] : KeyLocal[i - 6];
+        if (usage && !Key_Held(rep, usage)) rep[n++] = usage;
+    }
+    Key_Apply(rep);
+}
+
+void Key_Local(const uint8_t *data) {
+    memcpy(KeyLocal, data, sizeof(KeyLocal));
+    Key_Merge();
+}
+#endif
+
+// Commands 1 and 6: [modifiers, 0, key1..key6] from the host
+void Key_Report(uint8_t *data) {
+#if USB_HOST_PASSTHROUGH
+    memcpy(KeyHost, data, sizeof(KeyHost));
+    Key_Merge();
+#else
+    Key_Apply(data);
+#endif
+}
+
+// TMR0 context: issues repeats and releases input the host forgot
+void Typematic_Tick(uint32_t now) {
+    if (!TypematicDelay) return;
+    if (memcmp(TypHost, empty_buf, sizeof(TypHost)) && Clock_Ms() - TypSeen >= TYPEMATIC_RELEASE_MS) {
+        memset(TypHost, 0, sizeof(TypHost)); // the key-up was probably lost
+        RepKey = RepGap = 0;
+        Telemetry_Count(TELEMETRY_TYPEMATIC_STOPS);
+    } else if (RepGap) {
+        if ((int32_t)(now - RepGapEnd) >= 0) RepGap = 0;
+    } else if (RepKey && (int32_t)(now - RepNext) >= 0) {
+        RepGap = 1;
+        RepGapEnd = now + TYPEMATIC_GAP_MS * TICKS_PER_MS;
+        RepNext += TypematicPeriod * TICKS_PER_MS;
+    }
+    Typematic_Update();
+}
+
+/* -----------------------------------------------------------------------
+   HOST WATCHDOG
+   Every controller command, including the 0x0C heartbeat, counts as a sign
+   of life. With a timeout set, a host that stays silent that long while a
+   key or mouse button is down (app crashed, cable pulled) gets everything
+   released on the target, once, until the host is heard from again.
+   ----------------------------------------------------------------------- */
+uint16_t HostTimeoutMs = 0; // 0 = off
+uint32_t HostSeen;
+uint8_t HostLost = 0;
+
+void Host_Alive(void) {
+    HostSeen = Clock_Now();
+    HostLost = 0;
+}
+
+static uint8_t Input_Held(void) {
+#if USB_HOST_PASSTHROUGH
+    // Local input does not depend on the host
+    const uint8_t *keys = KeyHost;
+    uint8_t buttons = RelHostButtons;
+#else
+    const uint8_t *keys = TypHost;
+    uint8_t buttons = RelButtons;
+#endif
+    uint8_t i;
+    for (i = 0; i < 8; i++) {
+        if (keys[i]) return 1;
+    }
+    return buttons || U2HIDMouse[0] || EmuButtons;
+}
+
+// Releases every key and mouse button on the target
+static void Input_ReleaseAll(void) {
+    Key_Report((uint8_t *)empty_buf);
+    if (EmuEnabled) {
+        AbsEmu_Reset();
+    } else if (U2HIDMouse[0]) {
+        AbsTrackLen = 0;
+        AbsPlaying = 0;
+        MouseAbs_Report(0, NULL, 0, 0);
+    }
+    MouseRel_Queue(0, 0, 0, 0, 0);
+}
+
+// TMR0 context
+void Host_Watchdog(uint32_t now) {
+    if (!HostTimeoutMs || HostLost) return;
+    if ((int32_t)(now - HostSeen) < (int32_t)(HostTimeoutMs * TICKS_PER_MS)) return;
+    HostLost = 1;
+    if (!Input_Held()) return;
+
+    Input_ReleaseAll();
+    Telemetry_Count(TELEMETRY_WATCHDOG_RELEASES);
+    TRACE(TR_WATCHDOG, 0, 0);
+}
+
+/* -----------------------------------------------------------------------
+   KVM SWITCH
+   Command 0x6F [target] with target 0..2 runs as a transaction from TMR0:
+   input on the current target is released and the firmware waits until
+   the target polled those reports. The select GPIOs are then set, with the
+   HID port detached from USB for the break time if one is configured.
+   After the settle time the new target gets neutral reports and the host
+   gets [0x6F, 0, target, PB4, PB7, PA12]. Input commands are dropped while
+   the transaction runs. Target 3 reads the GPIOs back.
+   ----------------------------------------------------------------------- */
+#define SWITCH_DRAIN_MAX_MS 50 // a target that stopped polling is not waited for
+
 #if (USB_SWAP_MODE == 0)
-    // Mode 0: USB2 (Use Library Defaults)
-    memcpy(pU2EP2_IN_DataBuf, data, 6);
-    U2DevEP2_IN_Deal(6);
+#define HID_PORT_PULLUP RB_PIN_USB2_DP_PU
+#else
+#define HID_PORT_PULLUP RB_PIN_USB_DP_PU
+#endif
+
+enum { SW_IDLE, SW_DRAIN, SW_BREAK, SW_SETTLE };
+
+uint16_t SwitchBreakMs = 0;  // HID port detached this long, 0 = stays attached
+uint16_t SwitchSettleMs = 20;
+volatile uint8_t SwitchState = SW_IDLE;
+uint8_t SwitchTarget, SwitchNext = 0xFF;
+uint32_t SwitchDue;
+
+static void Switch_Gpio(uint8_t target) {
+    if (target == 0) { GPIOB_ResetBits(GPIO_Pin_4); GPIOB_SetBits(GPIO_Pin_7); GPIOA_SetBits(GPIO_Pin_12); }
+    else if (target == 1) { GPIOB_SetBits(GPIO_Pin_4); GPIOB_ResetBits(GPIO_Pin_7); GPIOA_ResetBits(GPIO_Pin_12); }
+    else { GPIOB_SetBits(GPIO_Pin_4); GPIOB_SetBits(GPIO_Pin_7); GPIOA_ResetBits(GPIO_Pin_12); }
+}
+
+static void Switch_Reply(uint8_t status) {
+    memset(HID_Buf, 0, sizeof(HID_Buf));
+    HID_Buf[0] = 0x6F; HID_Buf[2] = status;
+    HID_Buf[3] = GPIOB_ReadPortPin(GPIO_Pin_4) ? 1 : 0;
+    HID_Buf[4] = GPIOB_ReadPortPin(GPIO_Pin_7) ? 1 : 0;
+    HID_Buf[5] = GPIOA_ReadPortPin(GPIO_Pin_12) ? 1 : 0;
+    Send_Control_Data(HID_Buf);
+}
+
+static void Switch_Begin(uint8_t target) {
+    SwitchTarget = target;
+    // Motion meant for the old target is dropped, not delivered late
+    RelAccX = RelAccY = RelAccWheel = RelAccPan = 0;
+    AbsAccWheel = AbsAccPan = 0;
+    Input_ReleaseAll();
+#if USB_HOST_PASSTHROUGH
+    Local_Release();
+#endif
+    SwitchDue = Clock_Now() + SWITCH_DRAIN_MAX_MS * TICKS_PER_MS;
+    SwitchState = SW_DRAIN;
+    TRACE(TR_SWITCH, SW_DRAIN, target);
+}
+
+// Keyboard and mice in a known idle state on the new target
+static void Switch_Neutral(void) {
+    Typematic_Reset();
+    Report_Forget(REPORT_EP2);
+    Report_Forget(REPORT_EP3);
+    Send_Key_Report((uint8_t *)empty_buf);
+    U2HIDMouse[0] = 0;
+    AbsTrackLen = 0;
+    AbsPlaying = 0;
+    if (EmuEnabled) AbsEmu_Reset(); // the cursor has to be homed on this target
+    RelAccX = RelAccY = RelAccWheel = RelAccPan = 0;
+    RelButtons = 0;
+    RelButtonsSent = 0xFF; // forces one report without motion
+    if (!REL_EP_BUSY) MouseRel_Flush();
+}
+
+static uint8_t Switch_Drained(void) {
+    return !KeyEpBusy && !MOUSE_TX_BUSY && !memcmp(TypOut, empty_buf, sizeof(TypOut));
+}
+
+void Switch_Command(const uint8_t *p) {
+    if (p[0] == 3) {
+        Switch_Reply(3);
+    } else if (p[0] <= 2) {
+        // A request during a running switch is served after it
+        if (SwitchState != SW_IDLE) SwitchNext = p[0];
+        else Switch_Begin(p[0]);
+    }
+}
+
+// TMR0 context
+void Switch_Tick(uint32_t now) {
+    switch (SwitchState) {
+        case SW_DRAIN:
+            if (!Switch_Drained() && (int32_t)(now - SwitchDue) < 0) break;
+            if (SwitchBreakMs) {
+                R16_PIN_ANALOG_IE &= ~HID_PORT_PULLUP;
+                Switch_Gpio(SwitchTarget);
+                SwitchDue = now + SwitchBreakMs * TICKS_PER_MS;
+                SwitchState = SW_BREAK;
+                TRACE(TR_SWITCH, SW_BREAK, SwitchTarget);
+            } else {
+                Switch_Gpio(SwitchTarget);
+                SwitchDue = now + SwitchSettleMs * TICKS_PER_MS;
+                SwitchState = SW_SETTLE;
+                TRACE(TR_SWITCH, SW_SETTLE, SwitchTarget);
+            }
+            break;
+        case SW_BREAK:
+            if ((int32_t)(now - SwitchDue) < 0) break;
+            R16_PIN_ANALOG_IE |= HID_PORT_PULLUP;
+            SwitchDue = now + SwitchSettleMs * TICKS_PER_MS;
+            SwitchState = SW_SETTLE;
+            TRACE(TR_SWITCH, SW_SETTLE, SwitchTarget);
+            break;
+        case SW_SETTLE:
+            if ((int32_t)(now - SwitchDue) < 0) break;
+            Switch_Neutral();
+            Switch_Reply(SwitchTarget);
+            SwitchState = SW_IDLE;
+            TRACE(TR_SWITCH, SW_IDLE, SwitchTarget);
+            if (SwitchNext != 0xFF) {
+                Switch_Begin(SwitchNext);
+                SwitchNext = 0xFF;
+            }
+            break;
+    }
+}
+
+// Commands that produce input on the target
+static uint8_t Cmd_IsInput(uint8_t cmd) {
+    return cmd == 1 || cmd == 2 || cmd == 6 || cmd == 7 || cmd == 8 || cmd == 9 || cmd == 0x0A;
+}
+
+/* -----------------------------------------------------------------------
+   SETTINGS
+   Command 0x0B: [id, value16 LE]. Settings live in RAM; the host sends
+   them again after every connect.
+   ----------------------------------------------------------------------- */
+#define CONFIG_POINTER_CURVE 0x01
+#define CONFIG_ABS_EMULATION 0x02
+#define CONFIG_EMU_WIDTH     0x03
+#define CONFIG_EMU_HEIGHT    0x04
+#define CONFIG_EMU_HOME_MS   0x05
+#define CONFIG_EMU_STEP      0x06
+#define CONFIG_TYPEMATIC_DELAY  0x07
+#define CONFIG_TYPEMATIC_PERIOD 0x08
+#define CONFIG_HOST_TIMEOUT     0x09
+#define CONFIG_SWITCH_BREAK_MS  0x0A
+#define CONFIG_SWITCH_SETTLE_MS 0x0B
+
+void Config_Set(const uint8_t *p) {
+    uint16_t value = p[1] | (p[2] << 8);
+
+    switch (p[0]) {
+        case CONFIG_POINTER_CURVE:
+            BallisticsCurve = value <= BALLISTICS_CURVES ? (uint8_t)value : 0;
+            BalRemX = BalRemY = 0;
+            break;
+        case CONFIG_ABS_EMULATION:
+            EmuEnabled = value ? 1 : 0;
+            AbsEmu_Reset();
+            break;
+        case CONFIG_EMU_WIDTH:
+            if (value) EmuWidth = value;
+            EmuHomed = 0;
+            break;
+        case CONFIG_EMU_HEIGHT:
+            if (value) EmuHeight = value;
+            EmuHomed = 0;
+            break;
+        case CONFIG_EMU_HOME_MS:
+            EmuHomeMs = value;
+            break;
+        case CONFIG_EMU_STEP:
+            EmuStep = value < 1 ? 1 : (value > 127 ? 127 : (uint8_t)value);
+            break;
+        case CONFIG_TYPEMATIC_DELAY:
+            // ms before the first firmware repeat, 0 = off; see TYPEMATIC for the
+            // brief release per repeat and the TYPEMATIC_RELEASE_MS release.
+            // Release everything; the next host report starts from a clean state
+            TypematicDelay = value && value < TYPEMATIC_MIN_MS ? TYPEMATIC_MIN_MS : value;
+            Typematic_Reset();
+            Send_Key_Report((uint8_t *)empty_buf);
+            break;
+        case CONFIG_TYPEMATIC_PERIOD:
+            TypematicPeriod = value < TYPEMATIC_MIN_MS ? TYPEMATIC_MIN_MS : value;
+            break;
+        case CONFIG_HOST_TIMEOUT:
+            HostTimeoutMs = value;
+            break;
+        case CONFIG_SWITCH_BREAK_MS:
+            SwitchBreakMs = value;
+            break;
+        case CONFIG_SWITCH_SETTLE_MS:
+            SwitchSettleMs = value;
+            break;
+    }
+}
+
+void HID_SetProtocol(uint8_t intf, uint8_t protocol) {
+    if (intf < HID_INTERFACES) HidProtocol[intf] = protocol ? 1 : 0;
+}
+
+uint8_t HID_GetProtocol(uint8_t intf) {
+    return intf < HID_INTERFACES ? HidProtocol[intf] : 1;
+}
+
+void HID_SetIdle(uint8_t intf, uint8_t duration) {
+    if (intf < HID_INTERFACES) HidIdle[intf] = duration;
+}
+
+uint8_t HID_GetIdle(uint8_t intf) {
+    return intf < HID_INTERFACES ? HidIdle[intf] : 0;
+}
+
+// Data stage of SET_REPORT on the HID port
+// MouseResMult is indexed by report kind: 1 absolute, 2 relative. That is the
+// interface number in the separate layout and the report ID in the composite one.
+void HID_SetReport(uint8_t intf, uint8_t type, const uint8_t *data, uint8_t len) {
+    if (len == 0) return;
+    if (intf == 0) HIDKeyLightsCode = data[0];
+    else if (type != HID_REPORT_TYPE_FEATURE) return;
+#if MOUSE_COMPOSITE
+    else if (intf == 1 && len >= 2 && (data[0] == MOUSE_REPORT_ID_ABS || data[0] == MOUSE_REPORT_ID_REL))
+        MouseResMult[data[0]] = data[1] & 0x0F;
+#else
+    else if (intf <= 2) MouseResMult[intf] = data[0] & 0x0F;
+#endif
+}
+
+// GET_REPORT on the HID port; returns the report length or 0 to stall
+uint8_t HID_GetReport(uint8_t intf, uint8_t type, uint8_t id, uint8_t *buf) {
+    if (type != HID_REPORT_TYPE_FEATURE) return 0;
+#if MOUSE_COMPOSITE
+    if (intf == 1 && (id == MOUSE_REPORT_ID_ABS || id == MOUSE_REPORT_ID_REL)) {
+        buf[0] = id;
+        buf[1] = MouseResMult[id];
+        return 2;
+    }
 #else
-    // Mode 1: USB1 (Manual Write)
-    // Write directly to EP2_Databuf at offset 64 (The IN Buffer)
-    memcpy(EP2_Databuf + 64, data, 6);
-    
-    // Set Length and Arm the endpoint (ACK)
-    R8_UEP2_T_LEN = 6;
-    R8_UEP2_CTRL = (R8_UEP2_CTRL & ~MASK_UEP_T_RES) | UEP_T_RES_ACK;
+    if (intf >= 1 && intf <= 2) {
+        buf[0] = MouseResMult[intf];
+        return 1;
+    }
 #endif
+    return 0;
+}
+
+// Command 9: [target (0 relative, 1 absolute), buttons, wheel16 LE, pan16 LE]
+// in 1/120 detent units, so sub-notch scrolling is carried instead of lost
+void Mouse_Scroll(const uint8_t *p) {
+    int16_t wheel = (int16_t)(p[2] | (p[3] << 8));
+    int16_t pan = (int16_t)(p[4] | (p[5] << 8));
+    if (p[0] == 1) MouseAbs_Report(p[1], NULL, wheel, pan);
+    else MouseRel_Queue(p[1], 0, 0, wheel, pan);
 }
 
-void Send_MouseRel_Report(uint8_t *data) {
+/* -----------------------------------------------------------------------
+   CONTROLLER REPLIES
+   Command replies from the main loop and switch/port reset replies from
+   TMR0 share EP1 IN of the controller port. A reply is armed only once the
+   host has read the previous one; until then it waits in ReplyQ, and the
+   IN-complete interrupt arms the next. A full queue drops its oldest reply.
+   The standalone build writes replies straight to the UART link.
+   ----------------------------------------------------------------------- */
+#define REPLY_LEN       10
+#define REPLY_QUEUE_LEN 4 // power of two
+
+#if !USB_HOST_PASSTHROUGH
+static uint8_t ReplyQ[REPLY_QUEUE_LEN][REPLY_LEN];
+static volatile uint8_t ReplyHead = 0, ReplyTail = 0;
+static volatile uint8_t ReplyBusy = 0; // a reply is armed, not yet read
+
+// Interrupts masked
+static void Reply_Arm(const uint8_t *data) {
 #if (USB_SWAP_MODE == 0)
-    memcpy(pU2EP3_IN_DataBuf, data, 4);
-    U2DevEP3_IN_Deal(4);
+    memcpy(pEP1_IN_DataBuf, data, REPLY_LEN);
+    DevEP1_IN_Deal(REPLY_LEN);
 #else
-    // Mode 1: USB1 (Manual Write)
-    memcpy(EP3_Databuf + 64, data, 4);
-    
-    R8_UEP3_T_LEN = 4;
-    R8_UEP3_CTRL = (R8_UEP3_CTRL & ~MASK_UEP_T_RES) | UEP_T_RES_ACK;
+    memcpy(pU2EP1_IN_DataBuf, data, REPLY_LEN);
+    U2DevEP1_IN_Deal(REPLY_LEN);
 #endif
+    ReplyBusy = 1;
+}
+
+// IN-complete interrupt of the controller port
+static void Reply_Done(void) {
+    ReplyBusy = 0;
+    if (ReplyTail != ReplyHead) {
+        Reply_Arm(ReplyQ[ReplyTail & (REPLY_QUEUE_LEN - 1)]);
+        ReplyTail++;
+    }
 }
 
+// Bus or port reset of the controller port: nothing is armed any more
+static void Reply_Reset(void) {
+    ReplyBusy = 0;
+    ReplyTail = ReplyHead;
+}
+#endif
+
+// Any context
 void Send_Control_Data(uint8_t *data) {
-#if (USB_SWAP_MODE == 0)
-    memcpy(pEP1_IN_DataBuf, data, 10);
-    DevEP1_IN_Deal(10);
+#if USB_HOST_PASSTHROUGH
+    Link_Send(data);
 #else
-    memcpy(pU2EP1_IN_DataBuf, data, 10);
-    U2DevEP1_IN_Deal(10);
+    uint32_t irq;
+
+    SYS_DisableAllIrq(&irq);
+    if (!ReplyBusy) {
+        Reply_Arm(data);
+    } else {
+        if ((uint8_t)(ReplyHead - ReplyTail) == REPLY_QUEUE_LEN) ReplyTail++;
+        memcpy(ReplyQ[ReplyHead & (REPLY_QUEUE_LEN - 1)], data, REPLY_LEN);
+        ReplyHead++;
+    }
+    SYS_RecoverIrq(irq);
 #endif
 }
 
@@ -195,7 +1759,8 @@ void Send_Control_Data(uint8_t *data) {
    ======================================================================= */
 void USB_DevTransProcess(void) 
 {
-    uint8_t len, chtype;
+    uint16_t len; // report descriptors can exceed 255 bytes
+    uint8_t chtype;
     uint8_t intflag, errflag = 0;
 
     intflag = R8_USB_INT_FG;
@@ -229,7 +1794,7 @@ void USB_DevTransProcess(void)
                 case UIS_TOKEN_OUT:
                     len = R8_USB_RX_LEN;
 #if (USB_SWAP_MODE == 1)
-                    if (SetupReqCode == 0x09 && len > 0) HIDKeyLightsCode = pEP0_DataBuf[0];
+                    if (SetupReqCode == DEF_USB_SET_REPORT) HID_SetReport(SetupReqIntf, SetupReportType, pEP0_DataBuf, len);
 #endif
                     break;
 
@@ -245,16 +1810,33 @@ void USB_DevTransProcess(void)
                     R8_UEP1_CTRL ^= RB_UEP_T_TOG;
                     R8_UEP1_CTRL = (R8_UEP1_CTRL & ~MASK_UEP_T_RES) | UEP_T_RES_NAK;
                     Ready = 1;
+#if (USB_SWAP_MODE == 1)
+                    KeyEpBusy = 0;
+                    TRACE(TR_KEY_IN, 0, 0);
+#elif !USB_HOST_PASSTHROUGH
+                    Reply_Done();
+#endif
                     break;
                 
                 // --- USB1 HID ENDPOINTS ---
                 case UIS_TOKEN_IN | 2: // Mouse Abs
                     R8_UEP2_CTRL ^= RB_UEP_T_TOG;
                     R8_UEP2_CTRL = (R8_UEP2_CTRL & ~MASK_UEP_T_RES) | UEP_T_RES_NAK;
+#if (USB_SWAP_MODE == 1) && MOUSE_COMPOSITE
+                    TxPP_Done(&MouseEp2Tx);
+                    Mouse_InDone();
+#elif (USB_SWAP_MODE == 1)
+                    TxPP_Done(&MouseEp2Tx);
+                    MouseAbs_InDone();
+#endif
                     break;
                 case UIS_TOKEN_IN | 3: // Mouse Rel
                     R8_UEP3_CTRL ^= RB_UEP_T_TOG;
                     R8_UEP3_CTRL = (R8_UEP3_CTRL & ~MASK_UEP_T_RES) | UEP_T_RES_NAK;
+#if (USB_SWAP_MODE == 1) && !MOUSE_COMPOSITE
+                    TxPP_Done(&MouseEp3Tx);
+                    MouseRel_InDone();
+#endif
                     break;
             }
             R8_USB_INT_FG = RB_UIF_TRANSFER;
@@ -264,17 +1846,50 @@ void USB_DevTransProcess(void)
             R8_UEP0_CTRL = RB_UEP_R_TOG | RB_UEP_T_TOG | UEP_R_RES_ACK | UEP_T_RES_NAK;
             SetupReqLen = pSetupReqPak->wLength;
             SetupReqCode = pSetupReqPak->bRequest;
+            SetupReqIntf = pSetupReqPak->wIndex & 0xff;
+            SetupReportType = pSetupReqPak->wValue >> 8;
             chtype = pSetupReqPak->bRequestType;
 
             len = 0; errflag = 0;
             if ((pSetupReqPak->bRequestType & USB_REQ_TYP_MASK) != USB_REQ_TYP_STANDARD) {
                 if (pSetupReqPak->bRequestType & 0x20) {
                     switch (SetupReqCode) {
-                        case DEF_USB_SET_IDLE: Idle_Value = EP0_Databuf[3]; break;
+                        case DEF_USB_SET_IDLE:
+                            Idle_Value = EP0_Databuf[3];
+#if (USB_SWAP_MODE == 1)
+                            HID_SetIdle(EP0_Databuf[4], EP0_Databuf[3]);
+#endif
+                            break;
                         case DEF_USB_SET_REPORT: break;
-                        case DEF_USB_SET_PROTOCOL: Report_Value = EP0_Databuf[2]; break;
-                        case DEF_USB_GET_IDLE: EP0_Databuf[0] = Idle_Value; len = 1; break;
-                        case DEF_USB_GET_PROTOCOL: EP0_Databuf[0] = Report_Value; len = 1; break;
+                        case DEF_USB_SET_PROTOCOL:
+                            Report_Value = EP0_Databuf[2];
+#if (USB_SWAP_MODE == 1)
+                            HID_SetProtocol(EP0_Databuf[4], EP0_Databuf[2]);
+#endif
+                            break;
+                        case DEF_USB_GET_IDLE:
+#if (USB_SWAP_MODE == 1)
+                            EP0_Databuf[0] = HID_GetIdle(SetupReqIntf);
+#else
+                            EP0_Databuf[0] = Idle_Value;
+#endif
+                            len = 1;
+                            break;
+                        case DEF_USB_GET_PROTOCOL:
+#if (USB_SWAP_MODE == 1)
+                            EP0_Databuf[0] = HID_GetProtocol(SetupReqIntf);
+#else
+                            EP0_Databuf[0] = Report_Value;
+#endif
+                            len = 1;
+                            break;
+#if (USB_SWAP_MODE == 1)
+                        case DEF_USB_GET_REPORT:
+                            len = HID_GetReport(SetupReqIntf, SetupReportType, pSetupReqPak->wValue & 0xff, EP0_Databuf);
+                            if (len == 0) errflag = 0xFF;
+                            else if (SetupReqLen > len) SetupReqLen = len;
+                            break;
+#endif
                         default: errflag = 0xFF;
                     }
                 }
@@ -302,7 +1917,9 @@ void USB_DevTransProcess(void)
 #else
                                 if (((pSetupReqPak->wIndex) & 0xff) == 0) { pDescr = (uint8_t *)(&U2MyCfgDescr[18]); len = 9; }
                                 else if (((pSetupReqPak->wIndex) & 0xff) == 1) { pDescr = (uint8_t *)(&U2MyCfgDescr[43]); len = 9; }
+#if !MOUSE_COMPOSITE
                                 else if (((pSetupReqPak->wIndex) & 0xff) == 2) { pDescr = (uint8_t *)(&U2MyCfgDescr[68]); len = 9; }
+#endif
                                 else { errflag = 0xFF; }
 #endif
                                 break;
@@ -311,8 +1928,12 @@ void USB_DevTransProcess(void)
                                 if (((pSetupReqPak->wIndex) & 0xff) == 0) { pDescr = HIDDescr; len = sizeof(HIDDescr); }
 #else
                                 if (((pSetupReqPak->wIndex) & 0xff) == 0) { pDescr = U2KeyRepDesc; len = sizeof(U2KeyRepDesc); }
+#if MOUSE_COMPOSITE
+                                else if (((pSetupReqPak->wIndex) & 0xff) == 1) { pDescr = U2MouseCompositeDesc; len = sizeof(U2MouseCompositeDesc); }
+#else
                                 else if (((pSetupReqPak->wIndex) & 0xff) == 1) { pDescr = U2MouseRepDesc; len = sizeof(U2MouseRepDesc); }
                                 else if (((pSetupReqPak->wIndex) & 0xff) == 2) { pDescr = U2MouseRelDesc; len = sizeof(U2MouseRelDesc); }
+#endif
 #endif
                                 break;
                             case USB_DESCR_TYP_STRING:
@@ -358,6 +1979,13 @@ void USB_DevTransProcess(void)
         R8_UEP1_CTRL = UEP_R_RES_ACK | UEP_T_RES_NAK;
         R8_UEP2_CTRL = UEP_R_RES_ACK | UEP_T_RES_NAK;
         R8_UEP3_CTRL = UEP_R_RES_ACK | UEP_T_RES_NAK;
+#if (USB_SWAP_MODE == 1)
+        Mouse_Reset();
+        Typematic_Reset();
+#elif !USB_HOST_PASSTHROUGH
+        Reply_Reset();
+#endif
+        TRACE(TR_BUS_RESET, 1, 0);
         R8_USB_INT_FG = RB_UIF_BUS_RST;
     }
     else if (intflag & RB_UIF_SUSPEND) R8_USB_INT_FG = RB_UIF_SUSPEND;
@@ -368,7 +1996,8 @@ void USB_DevTransProcess(void)
    USB2 INTERRUPTS
    ======================================================================= */
 void USB2_DevTransProcess(void) {
-    uint8_t len, chtype;
+    uint16_t len; // report descriptors can exceed 255 bytes
+    uint8_t chtype;
     uint8_t intflag, errflag = 0;
 
     intflag = R8_USB2_INT_FG;
@@ -400,7 +2029,7 @@ void USB2_DevTransProcess(void) {
                 case UIS_TOKEN_OUT: {
                     len = R8_USB2_RX_LEN;
 #if (USB_SWAP_MODE == 0)
-                    if (U2SetupReqCode == 0x09) HIDKeyLightsCode = pU2EP0_DataBuf[0];
+                    if (U2SetupReqCode == DEF_USB_SET_REPORT) HID_SetReport(U2SetupReqIntf, U2SetupReportType, pU2EP0_DataBuf, len);
 #endif
                 } break;
 
@@ -416,6 +2045,12 @@ void USB2_DevTransProcess(void) {
                     R8_U2EP1_CTRL ^= RB_UEP_T_TOG;
                     R8_U2EP1_CTRL = (R8_U2EP1_CTRL & ~MASK_UEP_T_RES) | UEP_T_RES_NAK;
                     U2EP1_BUSY = 0;
+#if (USB_SWAP_MODE == 0)
+                    KeyEpBusy = 0;
+                    TRACE(TR_KEY_IN, 0, 0);
+#else
+                    Reply_Done();
+#endif
                     break;
 
                 // --- USB2 HID ENDPOINTS ---
@@ -429,6 +2064,13 @@ void USB2_DevTransProcess(void) {
                     R8_U2EP2_CTRL ^= RB_UEP_T_TOG;
                     R8_U2EP2_CTRL = (R8_U2EP2_CTRL & ~MASK_UEP_T_RES) | UEP_T_RES_NAK;
                     U2EP2_BUSY = 0;
+#if (USB_SWAP_MODE == 0) && MOUSE_COMPOSITE
+                    TxPP_Done(&MouseEp2Tx);
+                    Mouse_InDone();
+#elif (USB_SWAP_MODE == 0)
+                    TxPP_Done(&MouseEp2Tx);
+                    MouseAbs_InDone();
+#endif
                     break;
                 case UIS_TOKEN_OUT | 3:
                      if (R8_USB2_INT_ST & RB_UIS_TOG_OK) {
@@ -439,6 +2081,10 @@ void USB2_DevTransProcess(void) {
                 case UIS_TOKEN_IN | 3:
                     R8_U2EP3_CTRL ^= RB_UEP_T_TOG;
                     R8_U2EP3_CTRL = (R8_U2EP3_CTRL & ~MASK_UEP_T_RES) | UEP_T_RES_NAK;
+#if (USB_SWAP_MODE == 0) && !MOUSE_COMPOSITE
+                    TxPP_Done(&MouseEp3Tx);
+                    MouseRel_InDone();
+#endif
                     break;
             }
             R8_USB2_INT_FG = RB_UIF_TRANSFER;
@@ -448,17 +2094,50 @@ void USB2_DevTransProcess(void) {
             R8_U2EP0_CTRL = RB_UEP_R_TOG | RB_UEP_T_TOG | UEP_R_RES_ACK | UEP_T_RES_NAK;
             U2SetupReqLen = pU2SetupReqPak->wLength;
             U2SetupReqCode = pU2SetupReqPak->bRequest;
+            U2SetupReqIntf = pU2SetupReqPak->wIndex & 0xff;
+            U2SetupReportType = pU2SetupReqPak->wValue >> 8;
             chtype = pU2SetupReqPak->bRequestType;
 
             len = 0; errflag = 0;
             if ((pU2SetupReqPak->bRequestType & USB_REQ_TYP_MASK) != USB_REQ_TYP_STANDARD) {
                  if (pU2SetupReqPak->bRequestType & 0x20) {
                      switch (U2SetupReqCode) {
-                        case DEF_USB_SET_IDLE: U2Idle_Value = EP0_Databuf[3]; break;
+                        case DEF_USB_SET_IDLE:
+                            U2Idle_Value = U2EP0_Databuf[3];
+#if (USB_SWAP_MODE == 0)
+                            HID_SetIdle(U2EP0_Databuf[4], U2EP0_Databuf[3]);
+#endif
+                            break;
                         case DEF_USB_SET_REPORT: break;
-                        case DEF_USB_SET_PROTOCOL: U2Report_Value = U2EP0_Databuf[2]; break;
-                        case DEF_USB_GET_IDLE: U2EP0_Databuf[0] = U2Idle_Value; len = 1; break;
-                        case DEF_USB_GET_PROTOCOL: U2EP0_Databuf[0] = U2Report_Value; len = 1; break;
+                        case DEF_USB_SET_PROTOCOL:
+                            U2Report_Value = U2EP0_Databuf[2];
+#if (USB_SWAP_MODE == 0)
+                            HID_SetProtocol(U2EP0_Databuf[4], U2EP0_Databuf[2]);
+#endif
+                            break;
+                        case DEF_USB_GET_IDLE:
+#if (USB_SWAP_MODE == 0)
+                            U2EP0_Databuf[0] = HID_GetIdle(U2SetupReqIntf);
+#else
+                            U2EP0_Databuf[0] = U2Idle_Value;
+#endif
+                            len = 1;
+                            break;
+                        case DEF_USB_GET_PROTOCOL:
+#if (USB_SWAP_MODE == 0)
+                            U2EP0_Databuf[0] = HID_GetProtocol(U2SetupReqIntf);
+#else
+                            U2EP0_Databuf[0] = U2Report_Value;
+#endif
+                            len = 1;
+                            break;
+#if (USB_SWAP_MODE == 0)
+                        case DEF_USB_GET_REPORT:
+                            len = HID_GetReport(U2SetupReqIntf, U2SetupReportType, pU2SetupReqPak->wValue & 0xff, U2EP0_Databuf);
+                            if (len == 0) errflag = 0xFF;
+                            else if (U2SetupReqLen > len) U2SetupReqLen = len;
+                            break;
+#endif
                         default: errflag = 0xFF;
                      }
                  }
@@ -484,7 +2163,9 @@ void USB2_DevTransProcess(void) {
 #if (USB_SWAP_MODE == 0)
                                 if (((pU2SetupReqPak->wIndex) & 0xff) == 0) { pU2Descr = (uint8_t *)(&U2MyCfgDescr[18]); len = 9; }
                                 else if (((pU2SetupReqPak->wIndex) & 0xff) == 1) { pU2Descr = (uint8_t *)(&U2MyCfgDescr[43]); len = 9; }
+#if !MOUSE_COMPOSITE
                                 else if (((pU2SetupReqPak->wIndex) & 0xff) == 2) { pU2Descr = (uint8_t *)(&U2MyCfgDescr[68]); len = 9; }
+#endif
                                 else { errflag = 0xFF; }
 #else
                                 pU2Descr = (uint8_t *)(&MyCfgDescr[18]); len = 9;
@@ -493,8 +2174,12 @@ void USB2_DevTransProcess(void) {
                             case USB_DESCR_TYP_REPORT:
 #if (USB_SWAP_MODE == 0)
                                 if (((pU2SetupReqPak->wIndex) & 0xff) == 0) { pU2Descr = U2KeyRepDesc; len = sizeof(U2KeyRepDesc); }
+#if MOUSE_COMPOSITE
+                                else if (((pU2SetupReqPak->wIndex) & 0xff) == 1) { pU2Descr = U2MouseCompositeDesc; len = sizeof(U2MouseCompositeDesc); U2Ready = 1; }
+#else
                                 else if (((pU2SetupReqPak->wIndex) & 0xff) == 1) { pU2Descr = U2MouseRepDesc; len = sizeof(U2MouseRepDesc); }
                                 else if (((pU2SetupReqPak->wIndex) & 0xff) == 2) { pU2Descr = U2MouseRelDesc; len = sizeof(U2MouseRelDesc); U2Ready = 1; }
+#endif
 #else
                                 if (((pU2SetupReqPak->wIndex) & 0xff) == 0) { pU2Descr = HIDDescr; len = sizeof(HIDDescr); }
 #endif
@@ -543,42 +2228,803 @@ void USB2_DevTransProcess(void) {
         R8_U2EP1_CTRL = UEP_R_RES_ACK | UEP_T_RES_NAK;
         R8_U2EP2_CTRL = UEP_R_RES_ACK | UEP_T_RES_NAK;
         R8_U2EP3_CTRL = UEP_R_RES_ACK | UEP_T_RES_NAK;
+#if (USB_SWAP_MODE == 0)
+        Mouse_Reset();
+        Typematic_Reset();
+#else
+        Reply_Reset();
+#endif
+        TRACE(TR_BUS_RESET, 2, 0);
         R8_USB2_INT_FG = RB_UIF_BUS_RST;
     }
     else if (intflag & RB_UIF_SUSPEND) R8_USB2_INT_FG = RB_UIF_SUSPEND;
     else R8_USB2_INT_FG = intflag;
 }
 
-// OUT Handler USB1
-void DevEP1_OUT_Deal(uint8_t l) {
-#if (USB_SWAP_MODE == 1)
-    // Mode 1: USB1 is HID. Do not process control commands here.
+/* -----------------------------------------------------------------------
+   COMMAND RING
+   The controller port's OUT interrupt (UART receive in the standalone
+   build) only copies each command into this single-producer/single-
+   consumer ring; the main loop dispatches them. The
+   ISR alone writes CmdHead and the main loop alone writes CmdTail, so
+   neither side takes a lock. When a command fills the ring, EP1 OUT of
+   the controller port answers NAK until the main loop frees a slot, so
+   the host retries instead of a command, key-up included, being lost.
+   The UART link has no flow control: a frame that arrives at a full ring
+   is dropped and counted, and once the ring has drained the host gets an
+   unrequested telemetry reply [0x0D, TELEMETRY_CMD_DROPS, drops16 LE, ...]
+   so it learns that commands were lost.
+   ----------------------------------------------------------------------- */
+#define CMD_RING_LEN 16 // power of two
+#define CMD_LEN      10 // [cmd, 0, payload8]
+
+// Controller port EP1 OUT receive response
+#if USB_HOST_PASSTHROUGH
+#define CMD_OUT_RES(res) ((void)0)
+#elif (USB_SWAP_MODE == 0)
+#define CMD_OUT_RES(res) (R8_UEP1_CTRL = (R8_UEP1_CTRL & ~MASK_UEP_R_RES) | (res))
 #else
-    // Mode 0: USB1 is Controller
-    switch (pEP1_OUT_DataBuf[0]) {
-        case 1: Send_Key_Report(pEP1_OUT_DataBuf + 2); break;
-        case 2: Send_Mouse_Report(pEP1_OUT_DataBuf + 2); break;
+#define CMD_OUT_RES(res) (R8_U2EP1_CTRL = (R8_U2EP1_CTRL & ~MASK_UEP_R_RES) | (res))
+#endif
+
+static uint8_t CmdRing[CMD_RING_LEN][CMD_LEN];
+static volatile uint8_t CmdHead = 0, CmdTail = 0;
+static volatile uint8_t CmdOutPaused = 0; // EP1 OUT NAKs while the ring is full
+static volatile uint8_t CmdDropped = 0;   // drops not yet reported to the host
+
+// Keeps the compiler from moving buffer accesses across an index update
+#define COMPILER_BARRIER() __asm__ volatile("" ::: "memory")
+
+// OUT or UART interrupt context
+static void Cmd_Push(const uint8_t *buf, uint8_t len) {
+    uint8_t head = CmdHead;
+    uint8_t *slot;
+
+    if ((uint8_t)(head - CmdTail) == CMD_RING_LEN) {
+        Telemetry_Count(TELEMETRY_CMD_DROPS);
+        TRACE(TR_CMD_DROP, buf[0], 0);
+        CmdDropped = 1;
+        return;
+    }
+    TRACE(TR_CMD_PUSH, buf[0], (uint8_t)(head - CmdTail));
+    slot = CmdRing[head & (CMD_RING_LEN - 1)];
+    if (len > CMD_LEN) len = CMD_LEN;
+    memcpy(slot, buf, len);
+    memset(slot + len, 0, CMD_LEN - len);
+    COMPILER_BARRIER();
+    CmdHead = head + 1;
+    if ((uint8_t)(head + 1 - CmdTail) == CMD_RING_LEN) {
+        CMD_OUT_RES(UEP_R_RES_NAK);
+        CmdOutPaused = 1;
+    }
+}
+
+static void Cmd_Execute(uint8_t *p) {
+    TRACE(TR_CMD_RUN, p[0], p[2]);
+    Host_Alive();
+    if (SwitchState != SW_IDLE && Cmd_IsInput(p[0])) return;
+    switch (p[0]) {
+        case 1: Key_Report(p + 2); break;
+        case 2: MouseAbs_Report(p[2], p + 3, (int8_t)p[7] * WHEEL_UNITS_PER_NOTCH, 0); break;
         case 3:
             HID_Buf[0] = 3; HID_Buf[2] = HIDKeyLightsCode;
             Send_Control_Data(HID_Buf);
             break;
         case 4: SYS_ResetExecute(); break;
-        case 5: SendOnePix(pEP1_OUT_DataBuf + 2); break;
-        case 6: Send_Key_Report(pEP1_OUT_DataBuf + 2); mode = 1; break;
-        case 7: Send_MouseRel_Report(pEP1_OUT_DataBuf + 2); break;
-        case 0x6F:
-             if (pEP1_OUT_DataBuf[2] == 0) { GPIOB_ResetBits(GPIO_Pin_4); GPIOB_SetBits(GPIO_Pin_7); GPIOA_SetBits(GPIO_Pin_12); }
-             else if (pEP1_OUT_DataBuf[2] == 1) { GPIOB_SetBits(GPIO_Pin_4); GPIOB_ResetBits(GPIO_Pin_7); GPIOA_ResetBits(GPIO_Pin_12); }
-             else if (pEP1_OUT_DataBuf[2] == 2) { GPIOB_SetBits(GPIO_Pin_4); GPIOB_SetBits(GPIO_Pin_7); GPIOA_ResetBits(GPIO_Pin_12); }
-             else if (pEP1_OUT_DataBuf[2] == 3) {
-                 HID_Buf[0] = 0x6F; HID_Buf[2] = 3;
-                 HID_Buf[3] = GPIOB_ReadPortPin(GPIO_Pin_4) ? 1 : 0;
-                 HID_Buf[4] = GPIOB_ReadPortPin(GPIO_Pin_7) ? 1 : 0;
-                 HID_Buf[5] = GPIOA_ReadPortPin(GPIO_Pin_12) ? 1 : 0;
-                 Send_Control_Data(HID_Buf);
-             }
-             break;
+        case 5: SendOnePix(p + 2); break;
+        case 6: Key_Report(p + 2); mode = 1; break;
+        case 7: MouseRel_Move(p[2], (int8_t)p[3], (int8_t)p[4], (int8_t)p[5] * WHEEL_UNITS_PER_NOTCH, 0); break;
+        case 8: // [buttons, dx16 LE, dy16 LE, wheel, pan]
+            MouseRel_Move(p[2],
+                          (int16_t)(p[3] | (p[4] << 8)),
+                          (int16_t)(p[5] | (p[6] << 8)),
+                          (int8_t)p[7] * WHEEL_UNITS_PER_NOTCH,
+                          (int8_t)p[8] * WHEEL_UNITS_PER_NOTCH);
+            break;
+        case 9: Mouse_Scroll(p + 2); break;
+        case 0x0A: MouseAbs_Track(p + 2); break;
+        case 0x0B: Config_Set(p + 2); break;
+        case 0x0C: break; // heartbeat
+        case 0x0D: Telemetry_Read(p + 2); break;
+#if USB_HOST_PASSTHROUGH
+        case 0x0E: Local_Command(p + 2); break;
+#endif
+        case 0x0F: Crash_Read(p + 2); break;
+        case 0x10: Port_Command(p + 2); break;
+        case 0x11: Capabilities_Read(p + 2); break;
+        case 0x6F: Switch_Command(p + 2); break;
+    }
+}
+
+// Crash_Read masks interrupts itself, only around its reply, so the slow
+// DataFlash access does not hold them off
+static uint8_t Cmd_Unmasked(uint8_t cmd) {
+    return cmd == 0x0F;
+}
+
+// Main loop: runs queued commands. They update reports, IN buffers or
+// switch state that the USB and timer interrupts also use, so they run
+// with those masked as they did inside the OUT interrupt before. That
+// includes command 5: an interrupt during the WS2812 bit-bang would
+// stretch a bit past the latch time and corrupt the colour.
+void Cmd_Dispatch(void) {
+    static const uint8_t drops[1] = {TELEMETRY_CMD_DROPS};
+    uint8_t cmd[CMD_LEN];
+    uint32_t irq;
+
+    while (CmdTail != CmdHead) {
+        COMPILER_BARRIER();
+        memcpy(cmd, CmdRing[CmdTail & (CMD_RING_LEN - 1)], CMD_LEN);
+        COMPILER_BARRIER();
+        CmdTail++;
+        if (CmdOutPaused) {
+            SYS_DisableAllIrq(&irq);
+            CmdOutPaused = 0;
+            CMD_OUT_RES(UEP_R_RES_ACK);
+            SYS_RecoverIrq(irq);
+        }
+
+        if (Cmd_Unmasked(cmd[0])) {
+            Cmd_Execute(cmd);
+        } else {
+            SYS_DisableAllIrq(&irq);
+            Cmd_Execute(cmd);
+            SYS_RecoverIrq(irq);
+        }
+    }
+    if (CmdDropped) {
+        CmdDropped = 0;
+        SYS_DisableAllIrq(&irq);
+        Telemetry_Read(drops);
+        SYS_RecoverIrq(irq);
+    }
+}
+
+/* -----------------------------------------------------------------------
+   CAPABILITIES
+   Command 0x11 [page] lets the host find out once per connect what this
+   build understands instead of being told by the user. Page 0 answers
+   [0x11, 0, version, features16 LE, command ring depth, commands per
+   packet, keyboard/absolute/relative mouse bInterval in ms]; other pages
+   answer version 0 and are reserved. Stock firmware does not answer.
+   ----------------------------------------------------------------------- */
+#define PROTOCOL_VERSION    1
+#define CMDS_PER_PACKET     1 // one command per OUT packet or UART frame
+
+#define CAP_REL16           0x0001 // command 8
+#define CAP_HIRES_SCROLL    0x0002 // command 9
+#define CAP_ABS_TIMESTAMPS  0x0004 // command 0x0A
+#define CAP_CONFIG          0x0008 // command 0x0B
+#define CAP_HOST_WATCHDOG   0x0010 // command 0x0C and CONFIG_HOST_TIMEOUT
+#define CAP_TELEMETRY       0x0020 // command 0x0D
+#define CAP_LOCAL_INPUT     0x0040 // command 0x0E
+#define CAP_CRASH_RECORD    0x0080 // command 0x0F
+#define CAP_PORT_RESET      0x0100 // command 0x10
+#define CAP_SWITCH_REPLY    0x0200 // command 0x6F answers when done
+#define CAP_MOUSE_COMPOSITE 0x0400 // both mice on EP2, see MOUSE_COMPOSITE
+#define CAP_TRACE           0x0800 // event trace on UART1
+#define CAP_DUP_SUPPRESSION 0x1000 // unchanged reports are not resent
+
+#if USB_HOST_PASSTHROUGH
+#define CAP_BUILD_LOCAL CAP_LOCAL_INPUT
+#else
+#define CAP_BUILD_LOCAL 0
+#endif
+#if MOUSE_COMPOSITE
+#define CAP_BUILD_MOUSE CAP_MOUSE_COMPOSITE
+#else
+#define CAP_BUILD_MOUSE 0
+#endif
+#if DEBUG_PRT
+#define CAP_BUILD_TRACE CAP_TRACE
+#else
+#define CAP_BUILD_TRACE 0
+#endif
+
+#define CAPABILITIES (CAP_REL16 | CAP_HIRES_SCROLL | CAP_ABS_TIMESTAMPS | CAP_CONFIG | \
+                      CAP_HOST_WATCHDOG | CAP_TELEMETRY | CAP_CRASH_RECORD | CAP_PORT_RESET | \
+                      CAP_SWITCH_REPLY | CAP_DUP_SUPPRESSION | \
+                      CAP_BUILD_LOCAL | CAP_BUILD_MOUSE | CAP_BUILD_TRACE)
+
+// bInterval of each HID port endpoint in U2MyCfgDescr
+#define KEY_INTERVAL_AT       33
+#define MOUSE_ABS_INTERVAL_AT 58
+#if MOUSE_COMPOSITE
+#define MOUSE_REL_INTERVAL_AT MOUSE_ABS_INTERVAL_AT // relative reports share EP2
+#else
+#define MOUSE_REL_INTERVAL_AT 83
+#endif
+
+void Capabilities_Read(const uint8_t *p) {
+    memset(HID_Buf, 0, sizeof(HID_Buf));
+    HID_Buf[0] = 0x11;
+    HID_Buf[1] = p[0];
+    if (p[0] == 0) {
+        HID_Buf[2] = PROTOCOL_VERSION;
+        HID_Buf[3] = (uint8_t)CAPABILITIES;
+        HID_Buf[4] = (uint8_t)(CAPABILITIES >> 8);
+        HID_Buf[5] = CMD_RING_LEN;
+        HID_Buf[6] = CMDS_PER_PACKET;
+        HID_Buf[7] = U2MyCfgDescr[KEY_INTERVAL_AT];
+        HID_Buf[8] = U2MyCfgDescr[MOUSE_ABS_INTERVAL_AT];
+        HID_Buf[9] = U2MyCfgDescr[MOUSE_REL_INTERVAL_AT];
+    }
+    Send_Control_Data(HID_Buf);
+}
+
+#if USB_HOST_PASSTHROUGH
+/* -----------------------------------------------------------------------
+   STANDALONE EXTENDER
+   The controller link runs over UART3. A command travels as
+   [LINK_SYNC, cmd, 0, payload8, sum], sum being the low byte of the ten
+   command bytes added up, and replies use the same framing. A frame with a
+   bad sum is dropped and counted; the receiver hunts for the next sync.
+
+   USB1 is a host for one local keyboard, mouse or combo receiver (hubs are
+   not enumerated). Its boot interfaces are put into the boot protocol so
+   their reports have a fixed layout, and each interrupt endpoint is polled
+   at its bInterval. A report is merged with the controller's input as
+   soon as it is read: keys and modifiers joined, mouse buttons ORed and
+   motion added, then it waits only for the next poll of the HID port. Right Ctrl + Scroll Lock on the local keyboard
+   hands the target to the controller alone and back. Command 0x0E [state]
+   does the same from the controller (0 controller only, 1 local input on,
+   2 query); each is answered with [0x0E, 0, state].
+   ----------------------------------------------------------------------- */
+#define LINK_BAUD      921600
+#define LINK_SYNC      0xA5
+#define LINK_FRAME_LEN (CMD_LEN + 2)
+
+#define LOCAL_EPS         4
+#define LOCAL_ATTACH_MS   200  // a new device settles this long
+#define LOCAL_KBD_PROTO   1    // boot interface protocols
+#define LOCAL_MOUSE_PROTO 2
+#define LOCAL_HOTKEY_MOD  0x10 // Right Ctrl
+#define LOCAL_HOTKEY_KEY  0x47 // Scroll Lock
+#define HID_ERR_ROLLOVER  0x01 // too many keys down, report carries no state
+#define HOST_XFER_MAX_MS  3    // a transaction never completed is abandoned
+
+typedef struct LocalEp LocalEp;
+struct LocalEp {
+    uint8_t ep;
+    uint8_t intf;
+    uint8_t proto;
+    uint8_t tog;
+    uint8_t interval; // ms
+    uint8_t queued;   // waiting in HostQ or in flight
+    uint32_t due;
+    void (*done)(const LocalEp *lp, const uint8_t *data, uint8_t len);
+};
+
+static LocalEp LocalEps[LOCAL_EPS];
+static volatile uint8_t LocalEpCount = 0;
+static uint8_t LocalActive = 1;     // local input reaches the target
+static uint8_t LocalHotkeyHeld = 0; // local keys ignored until all released
+static volatile uint8_t LocalAttachPending = 0;
+static uint32_t LocalAttachDue;
+
+static uint8_t LinkRx[LINK_FRAME_LEN];
+static uint8_t LinkRxLen = 0;
+
+void Link_Send(const uint8_t *data) {
+    uint8_t frame[LINK_FRAME_LEN];
+    uint8_t i, sum = 0;
+
+    frame[0] = LINK_SYNC;
+    for (i = 0; i < CMD_LEN; i++) {
+        frame[1 + i] = data[i];
+        sum += data[i];
+    }
+    frame[LINK_FRAME_LEN - 1] = sum;
+    UART3_SendString(frame, LINK_FRAME_LEN);
+}
+
+static void Link_Init(void) {
+    GPIOA_SetBits(GPIO_Pin_5);
+    GPIOA_ModeCfg(GPIO_Pin_4, GPIO_ModeIN_PU);
+    GPIOA_ModeCfg(GPIO_Pin_5, GPIO_ModeOut_PP_5mA);
+    UART3_DefInit();
+    UART3_BaudRateCfg(LINK_BAUD);
+    UART3_ByteTrigCfg(UART_7BYTE_TRIG);
+    UART3_INTCfg(ENABLE, RB_IER_RECV_RDY | RB_IER_LINE_STAT);
+    PFIC_EnableIRQ(UART3_IRQn);
+}
+
+__INTERRUPT
+__HIGH_CODE
+void UART3_IRQHandler(void) {
+    uint8_t b, i, sum;
+
+    switch (UART3_GetITFlag()) {
+        case UART_II_LINE_STAT:
+            (void)UART3_GetLinSTA(); // reading clears the error
+            LinkRxLen = 0;
+            break;
+        case UART_II_RECV_RDY:
+        case UART_II_RECV_TOUT:
+            while (R8_UART3_RFC) {
+                b = UART3_RecvByte();
+                if (LinkRxLen == 0 && b != LINK_SYNC) continue;
+                LinkRx[LinkRxLen++] = b;
+                if (LinkRxLen < LINK_FRAME_LEN) continue;
+                LinkRxLen = 0;
+                for (i = 1, sum = 0; i <= CMD_LEN; i++) sum += LinkRx[i];
+                if (sum == LinkRx[LINK_FRAME_LEN - 1]) Cmd_Push(LinkRx + 1, CMD_LEN);
+                else Telemetry_Count(TELEMETRY_LINK_ERRORS);
+            }
+            break;
+    }
+}
+
+// Releases whatever the local devices hold on the target
+void Local_Release(void) {
+    if (memcmp(KeyLocal, empty_buf, sizeof(KeyLocal))) Key_Local(empty_buf);
+    if (RelLocalButtons) {
+        RelLocalButtons = 0;
+        MouseRel_Queue(RelHostButtons, 0, 0, 0, 0);
+    }
+}
+
+static void Local_Notify(void) {
+    memset(HID_Buf, 0, sizeof(HID_Buf));
+    HID_Buf[0] = 0x0E;
+    HID_Buf[2] = LocalActive;
+    Send_Control_Data(HID_Buf);
+}
+
+static void Local_SetActive(uint8_t active) {
+    LocalActive = active;
+    Local_Release();
+    Local_Notify();
+}
+
+// Command 0x0E: [state]
+void Local_Command(const uint8_t *p) {
+    if (p[0] <= 1 && p[0] != LocalActive) Local_SetActive(p[0]);
+    else Local_Notify();
+}
+
+// Returns 1 when the keyboard report belongs to the hot-key and is not forwarded
+static uint8_t Local_Hotkey(const uint8_t *rep) {
+    if (LocalHotkeyHeld) {
+        if (!memcmp(rep, empty_buf, 8)) LocalHotkeyHeld = 0;
+        return 1;
+    }
+    if ((rep[0] & LOCAL_HOTKEY_MOD) && Key_Held(rep, LOCAL_HOTKEY_KEY)) {
+        LocalHotkeyHeld = 1;
+        Local_SetActive(!LocalActive);
+        return 1;
+    }
+    return 0;
+}
+
+static void Local_Report(const LocalEp *lp, const uint8_t *rep, uint8_t len) {
+    if (lp->proto == LOCAL_KBD_PROTO) {
+        if (len < 8 || rep[2] == HID_ERR_ROLLOVER) return;
+        if (Local_Hotkey(rep) || !LocalActive) return;
+        Key_Local(rep);
+    } else if (len >= 3 && LocalActive) {
+        // Boot mice put the wheel, if any, in a fourth byte
+        RelLocalButtons = rep[0];
+        MouseRel_Queue(RelHostButtons, (int8_t)rep[1], (int8_t)rep[2],
+                       len >= 4 ? (int8_t)rep[3] * WHEEL_UNITS_PER_NOTCH : 0, 0);
+    }
+}
+
+static uint8_t Local_ClassRequest(uint8_t request, uint8_t intf) {
+    pSetupReq->bRequestType = USB_REQ_TYP_OUT | USB_REQ_TYP_CLASS | USB_REQ_RECIP_INTERF;
+    pSetupReq->bRequest = request;
+    pSetupReq->wValue = 0; // boot protocol, or no idle reports
+    pSetupReq->wIndex = intf;
+    pSetupReq->wLength = 0;
+    return HostCtrlTransfer(NULL, NULL);
+}
+
+// Blocks the main loop for the enumeration, ~150 ms after each plug-in.
+// InitRootDevice only accepts devices whose first interface is a boot
+// keyboard or mouse, so the configuration is parsed and set again here.
+// The endpoints are published to the transfer queue only at the end.
+static void Local_Enumerate(void) {
+    PUSB_ITF_DESCR itf;
+    PUSB_ENDP_DESCR ep;
+    uint16_t i, total;
+    uint8_t cfg, len, n = 0, intf = 0, proto = 0;
+    LocalEp *lp;
+
+    // The blocking library calls take a while on a slow device
+    InitRootDevice();
+    WWDG_SetCounter(0);
+    if (!ThisUsbDev.DeviceAddress || ThisUsbDev.DeviceType == USB_DEV_CLASS_HUB) return;
+    SelectHubPort(0);
+    if (CtrlGetConfigDescr() != ERR_SUCCESS) return;
+
+    cfg = ((PUSB_CFG_DESCR)Com_Buffer)->bConfigurationValue;
+    total = ((PUSB_CFG_DESCR)Com_Buffer)->wTotalLength;
+    if (total > sizeof(Com_Buffer)) total = sizeof(Com_Buffer);
+    for (i = 0; i + 2 <= total; i += len) {
+        len = Com_Buffer[i];
+        if (len < 2) break;
+        if (Com_Buffer[i + 1] == USB_DESCR_TYP_INTERF) {
+            itf = (PUSB_ITF_DESCR)(Com_Buffer + i);
+            intf = itf->bInterfaceNumber;
+            proto = itf->bInterfaceClass == USB_DEV_CLASS_HID && itf->bInterfaceSubClass == 1 ? itf->bInterfaceProtocol : 0;
+        } else if (Com_Buffer[i + 1] == USB_DESCR_TYP_ENDP && (proto == LOCAL_KBD_PROTO || proto == LOCAL_MOUSE_PROTO)) {
+            ep = (PUSB_ENDP_DESCR)(Com_Buffer + i);
+            if ((ep->bmAttributes & USB_ENDP_TYPE_MASK) != USB_ENDP_TYPE_INTER || !(ep->bEndpointAddress & USB_ENDP_DIR_MASK)) continue;
+            if (n == LOCAL_EPS) break;
+            lp = &LocalEps[n++];
+            lp->ep = ep->bEndpointAddress & USB_ENDP_ADDR_MASK;
+            lp->intf = intf;
+            lp->proto = proto;
+            lp->tog = 0;
+            lp->interval = ep->bInterval ? ep->bInterval : 1;
+            proto = 0; // one report endpoint per interface
+        }
+    }
+    WWDG_SetCounter(0);
+    if (CtrlSetUsbConfig(cfg) != ERR_SUCCESS) return;
+    for (i = 0; i < n; i++) {
+        lp = &LocalEps[i];
+        Local_ClassRequest(HID_SET_PROTOCOL, lp->intf);
+        if (lp->proto == LOCAL_KBD_PROTO) Local_ClassRequest(HID_SET_IDLE, lp->intf);
+        lp->queued = 0;
+        lp->due = Clock_Now();
+        lp->done = Local_Report;
+    }
+    SelectHubPort(0);
+    LocalEpCount = n;
+}
+
+/* Host transfer queue. TMR0 queues each endpoint when its interval is up
+   and the USB interrupt runs one IN transaction at a time, calling the
+   endpoint's done() with the data, so nothing spins on R8_USB_INT_FG. A
+   NAK, timeout or toggle mismatch leaves the endpoint to its next
+   interval. Both contexts have the same priority and never preempt each
+   other; the main loop only takes the port for enumeration, with the USB
+   interrupt off because the library polls the flags itself. */
+static LocalEp *HostQ[LOCAL_EPS];   // each endpoint is queued at most once
+static uint8_t HostQHead = 0, HostQLen = 0;
+static LocalEp *HostCur = NULL;     // transaction in flight
+static uint32_t HostCurStart;
+
+static void Host_Start(void) {
+    LocalEp *lp;
+
+    if (HostCur || !HostQLen) return;
+    lp = HostQ[HostQHead];
+    HostQHead = (HostQHead + 1) % LOCAL_EPS;
+    HostQLen--;
+    HostCur = lp;
+    HostCurStart = Clock_Now();
+    R8_UH_RX_CTRL = R8_UH_TX_CTRL = lp->tog ? RB_UH_R_TOG | RB_UH_T_TOG : 0;
+    R8_USB_INT_FG = RB_UIF_TRANSFER;
+    R8_UH_EP_PID = USB_PID_IN << 4 | lp->ep;
+}
+
+static void Host_Flush(void) {
+    R8_UH_EP_PID = 0;
+    HostCur = NULL;
+    HostQLen = 0;
+}
+
+// TMR0 context: queues due endpoints and restarts a stalled queue
+void Host_Tick(uint32_t now) {
+    LocalEp *lp;
+    uint8_t i;
+
+    if (HostCur && (int32_t)(now - HostCurStart) >= (int32_t)(HOST_XFER_MAX_MS * TICKS_PER_MS)) {
+        R8_UH_EP_PID = 0;
+        HostCur->queued = 0;
+        HostCur = NULL;
+    }
+    for (i = 0; i < LocalEpCount; i++) {
+        lp = &LocalEps[i];
+        if (lp->queued || (int32_t)(now - lp->due) < 0) continue;
+        lp->due = now + lp->interval * TICKS_PER_MS;
+        lp->queued = 1;
+        HostQ[(HostQHead + HostQLen++) % LOCAL_EPS] = lp;
+    }
+    Host_Start();
+}
+
+static void Local_Event(uint8_t s) {
+    if (s == ERR_USB_CONNECT) {
+        LocalAttachPending = 1;
+        LocalAttachDue = Clock_Now() + LOCAL_ATTACH_MS * TICKS_PER_MS;
+    } else if (s == ERR_USB_DISCON) {
+        LocalAttachPending = 0;
+        LocalEpCount = 0;
+        LocalHotkeyHeld = 0;
+        Host_Flush();
+        Local_Release();
+    }
+}
+
+// USB1 interrupt in host mode
+void USB_HostTransProcess(void) {
+    uint8_t intflag = R8_USB_INT_FG;
+    uint8_t status = R8_USB_INT_ST;
+    LocalEp *lp = HostCur;
+
+    if (intflag & RB_UIF_DETECT) {
+        R8_USB_INT_FG = RB_UIF_DETECT;
+        Local_Event(AnalyzeRootHub());
+    }
+    if (intflag & RB_UIF_TRANSFER) {
+        R8_UH_EP_PID = 0; // no token is repeated by hardware
+        R8_USB_INT_FG = RB_UIF_TRANSFER;
+        HostCur = NULL;
+        if (lp) TRACE(TR_HOST_XFER, lp->ep, status);
+        if (lp && LocalEpCount) {
+            lp->queued = 0;
+            if (status & RB_UIS_TOG_OK) {
+                lp->tog ^= 1;
+                lp->done(lp, pHOST_RX_RAM_Addr, R8_USB_RX_LEN);
+            }
+        }
+        Host_Start();
+    }
+    intflag &= ~(RB_UIF_DETECT | RB_UIF_TRANSFER);
+    if (intflag) R8_USB_INT_FG = intflag;
+}
+
+// Main loop: enumerates a device once it settled
+void Local_Poll(void) {
+    uint32_t irq;
+
+    if (!LocalAttachPending || (int32_t)(Clock_Now() - LocalAttachDue) < 0) return;
+    PFIC_DisableIRQ(USB_IRQn);
+    SYS_DisableAllIrq(&irq);
+    LocalAttachPending = 0;
+    LocalEpCount = 0;
+    Host_Flush();
+    SYS_RecoverIrq(irq);
+    Local_Enumerate();
+    PFIC_EnableIRQ(USB_IRQn);
+}
+#endif
+
+/* -----------------------------------------------------------------------
+   USB HEALTH
+   The main loop feeds the chip watchdog (8-bit count at Fsys/131072,
+   ~560 ms at 60 MHz), which resets everything if the loop stops. Short of
+   that, the loop checks both device ports every HEALTH_CHECK_MS for a
+   state machine that can no longer make progress: the SIE off, an
+   interrupt left pending, a report marked in flight on an endpoint the SIE
+   NAKs, or the controller's OUT endpoint refusing commands. A port wedged
+   for HEALTH_STUCK_MS is reset alone: SIE reset and pull-up dropped, then
+   re-initialised and attached PORT_DETACH_MS later, so only its host
+   re-enumerates while the other port keeps running. Command 0x10 lets the
+   host do the same to the HID port, or only flush the report queues.
+   ----------------------------------------------------------------------- */
+#define HEALTH_CHECK_MS 5
+#define HEALTH_STUCK_MS 20
+#define PORT_DETACH_MS  10 // long enough for the host to see a disconnect
+
+#if (USB_SWAP_MODE == 0)
+#define HID_PORT 2
+#else
+#define HID_PORT 1
+#endif
+
+#define PORT_RESET_QUEUES 0 // command 0x10 scopes
+#define PORT_RESET_HID    1
+
+// Why a port was reset, the b value of TR_PORT_RESET
+enum { PORT_OK, PORT_SIE_OFF, PORT_INT_STUCK, PORT_IN_STUCK, PORT_OUT_STUCK, PORT_HOST_REQUEST };
+
+static volatile uint8_t PortDetached = 0; // bit (port - 1): reset running
+static uint8_t PortReplyPending = 0;      // host waits for the HID port reset
+static uint32_t PortAttachDue[2];
+static uint8_t PortWedged = 0;            // bit (port - 1): failing since PortWedgedT
+static uint32_t PortWedgedT[2];
+static uint32_t HealthT;
+
+#if !USB_HOST_PASSTHROUGH
+// USB1 as a device, at startup and after a port reset
+static void Port1_Init(void) {
+    USB_DeviceInit();
+#if (USB_SWAP_MODE == 0)
+    // Ensure USB1 (Controller) EP1 is ready for RX.
+    R8_UEP4_1_MOD |= RB_UEP1_RX_EN;
+    R8_UEP1_CTRL  = UEP_T_RES_NAK | UEP_R_RES_ACK;
+#else
+    // USB1 = HID
+    // A. Manually register DMA addresses for USB1
+    R16_UEP2_DMA = (uint16_t)(uint32_t)EP2_Databuf;
+    R16_UEP3_DMA = (uint16_t)(uint32_t)EP3_Databuf;
+
+    // B. Transmit (TX) only for EP2 and EP3: both halves of their RAM are
+    //    ping-pong IN buffers, the DMA address is repointed per report
+    R8_UEP2_3_MOD = RB_UEP2_TX_EN | RB_UEP3_TX_EN;
+
+    // C. RESET TOGGLE BITS & SET NAK (CRITICAL FIX)
+    // We explicitly clear the T_TOG bit to ensure the first packet is DATA0.
+    // If this is random, the Host will reject the mouse packets.
+    R8_UEP2_T_LEN = 0;
+    R8_UEP2_CTRL = UEP_T_RES_NAK | UEP_R_RES_ACK;
+    R8_UEP2_CTRL &= ~RB_UEP_T_TOG; // Force DATA0 expectation
+
+    R8_UEP3_T_LEN = 0;
+    R8_UEP3_CTRL = UEP_T_RES_NAK | UEP_R_RES_ACK;
+    R8_UEP3_CTRL &= ~RB_UEP_T_TOG; // Force DATA0 expectation
+#endif
+}
+#endif
+
+// USB2 as a device, at startup and after a port reset
+static void Port2_Init(void) {
+    USB2_DeviceInit();
+#if (USB_SWAP_MODE == 0)
+    // USB2 = HID: library defaults, except that the mouse endpoints are
+    // transmit-only so both halves of their RAM serve as ping-pong buffers.
+    R8_U2EP2_3_MOD = RB_UEP2_TX_EN | RB_UEP3_TX_EN;
+#else
+    // USB2 = Controller: just ensure EP1 is ready for commands
+    R8_U2EP4_1_MOD |= RB_UEP1_RX_EN;
+    R8_U2EP1_CTRL  = UEP_T_RES_NAK | UEP_R_RES_ACK;
+#endif
+}
+
+// Interrupts masked; detached for ms, then attached again from TMR0
+static void Port_Detach(uint8_t port, uint8_t reason, uint16_t ms) {
+    if (port == 1) {
+        R16_PIN_ANALOG_IE &= ~RB_PIN_USB_DP_PU;
+        R8_USB_CTRL = RB_UC_RESET_SIE | RB_UC_CLR_ALL;
+    } else {
+        R16_PIN_ANALOG_IE &= ~RB_PIN_USB2_DP_PU;
+        R8_USB2_CTRL = RB_UC_RESET_SIE | RB_UC_CLR_ALL;
+    }
+    PortDetached |= 1 << (port - 1);
+    PortWedged &= ~(1 << (port - 1));
+    PortAttachDue[port - 1] = Clock_Now() + ms * TICKS_PER_MS;
+    TRACE(TR_PORT_RESET, port, reason);
+}
+
+static void Port_Attach(uint8_t port) {
+#if !USB_HOST_PASSTHROUGH
+    if (port == 1) Port1_Init();
+    else
+#endif
+    Port2_Init();
+    // Whatever was in flight is gone, as after a bus reset
+    if (port == HID_PORT) {
+        Mouse_Reset();
+        Typematic_Reset();
+    }
+#if !USB_HOST_PASSTHROUGH
+    else {
+        Reply_Reset();
+    }
+#endif
+    PortDetached &= ~(1 << (port - 1));
+}
+
+static void Port_Reply(uint8_t scope, uint8_t status) {
+    memset(HID_Buf, 0, sizeof(HID_Buf));
+    HID_Buf[0] = 0x10; HID_Buf[2] = scope; HID_Buf[3] = status;
+    Send_Control_Data(HID_Buf);
+}
+
+// TMR0 context
+void Port_Tick(uint32_t now) {
+    uint8_t i;
+
+    for (i = 0; i < 2; i++) {
+        if (!(PortDetached & (1 << i)) || (int32_t)(now - PortAttachDue[i]) < 0) continue;
+        Port_Attach(i + 1);
+        if (i + 1 == HID_PORT && PortReplyPending) {
+            PortReplyPending = 0;
+            Port_Reply(PORT_RESET_HID, 0);
+        }
+    }
+}
+
+// Staged reports and accumulated motion are dropped; reports already armed
+// go out, followed by neutral ones
+static void Port_ResetQueues(void) {
+    MouseEp2Tx.staged = 0;
+#if !MOUSE_COMPOSITE
+    MouseEp3Tx.staged = 0;
+#endif
+    AbsAccWheel = AbsAccPan = 0;
+#if USB_HOST_PASSTHROUGH
+    Local_Release();
+#endif
+    Switch_Neutral();
+}
+
+// Command 0x10: [scope, detach_ms] resets target-side state without
+// touching the controller link and answers [0x10, 0, scope, status], with
+// status 0 once done, 1 while a KVM switch or port reset is running, or
+// 2 for a scope this firmware does not know.
+// PORT_RESET_QUEUES flushes the report queues and sends neutral reports.
+// PORT_RESET_HID resets the HID port like the health check, detached for
+// detach_ms (0 = PORT_DETACH_MS), and answers once it is attached again.
+void Port_Command(const uint8_t *p) {
+    if (p[0] != PORT_RESET_QUEUES && p[0] != PORT_RESET_HID) {
+        Port_Reply(p[0], 2);
+    } else if (SwitchState != SW_IDLE || (PortDetached & (1 << (HID_PORT - 1)))) {
+        Port_Reply(p[0], 1);
+    } else if (p[0] == PORT_RESET_QUEUES) {
+        Port_ResetQueues();
+        Port_Reply(p[0], 0);
+    } else if (p[0] == PORT_RESET_HID) {
+        PortReplyPending = 1;
+        Port_Detach(HID_PORT, PORT_HOST_REQUEST, p[1] ? p[1] : PORT_DETACH_MS);
     }
+}
+
+static uint8_t Ep_InStuck(uint8_t busy, uint8_t ctrl) {
+    return busy && (ctrl & MASK_UEP_T_RES) != UEP_T_RES_ACK;
+}
+
+// Interrupts masked: what keeps the port from making progress, or PORT_OK
+static uint8_t Port_Check(uint8_t port) {
+    uint8_t ctrl, flags, mod, ep1;
+
+    if (port == 1) {
+        ctrl = R8_USB_CTRL; flags = R8_USB_INT_FG; mod = R8_UEP4_1_MOD; ep1 = R8_UEP1_CTRL;
+    } else {
+        ctrl = R8_USB2_CTRL; flags = R8_USB2_INT_FG; mod = R8_U2EP4_1_MOD; ep1 = R8_U2EP1_CTRL;
+    }
+    if ((ctrl & (RB_UC_RESET_SIE | RB_UC_DMA_EN)) != RB_UC_DMA_EN) return PORT_SIE_OFF;
+    // With RB_UC_INT_BUSY the SIE NAKs everything while a flag is pending
+    if (flags & (RB_UIF_TRANSFER | RB_UIF_BUS_RST)) return PORT_INT_STUCK;
+    if (port == HID_PORT) {
+        if (Ep_InStuck(KeyEpBusy, ep1) || Ep_InStuck(MouseEp2Tx.busy, *MouseEp2Tx.ctrl)) return PORT_IN_STUCK;
+#if !MOUSE_COMPOSITE
+        if (Ep_InStuck(MouseEp3Tx.busy, *MouseEp3Tx.ctrl)) return PORT_IN_STUCK;
+#endif
+    } else if (!(mod & RB_UEP1_RX_EN) || ((ep1 & MASK_UEP_R_RES) != UEP_R_RES_ACK && !CmdOutPaused)) {
+        // NAK is only a fault when it is not backpressure from the command ring
+        return PORT_OUT_STUCK;
+    }
+    return PORT_OK;
+}
+
+// Main loop
+void Usb_Health(void) {
+    uint32_t now = Clock_Now(), irq;
+    uint8_t port, bit, reason;
+
+    if ((int32_t)(now - HealthT) < HEALTH_CHECK_MS * TICKS_PER_MS) return;
+    HealthT = now;
+    SYS_DisableAllIrq(&irq);
+    for (port = 1; port <= 2; port++) {
+        bit = 1 << (port - 1);
+#if USB_HOST_PASSTHROUGH
+        if (port == 1) continue; // the host engine supervises its own transfers
+#endif
+        // A KVM switch may hold the HID port detached on purpose
+        if ((PortDetached & bit) || (port == HID_PORT && SwitchState != SW_IDLE)) reason = PORT_OK;
+        else reason = Port_Check(port);
+
+        if (reason == PORT_OK) {
+            PortWedged &= ~bit;
+        } else if (!(PortWedged & bit)) {
+            PortWedged |= bit;
+            PortWedgedT[port - 1] = now;
+        } else if ((int32_t)(now - PortWedgedT[port - 1]) >= HEALTH_STUCK_MS * TICKS_PER_MS) {
+            Port_Detach(port, reason, PORT_DETACH_MS);
+            Telemetry_Count(TELEMETRY_PORT_RESETS);
+        }
+    }
+    SYS_RecoverIrq(irq);
+}
+
+// Called last before the main loop, so startup delays do not count
+void Watchdog_Init(void) {
+    WWDG_SetCounter(0);
+    WWDG_ResetCfg(ENABLE);
+}
+
+// OUT Handler USB1
+void DevEP1_OUT_Deal(uint8_t l) {
+#if (USB_SWAP_MODE == 1)
+    // Mode 1: USB1 is HID. Do not process control commands here.
+#else
+    // Mode 0: USB1 is Controller
+    Cmd_Push(pEP1_OUT_DataBuf, l);
 #endif
 }
 
@@ -586,15 +3032,7 @@ void DevEP1_OUT_Deal(uint8_t l) {
 void U2DevEP1_OUT_Deal(uint8_t l) {
 #if (USB_SWAP_MODE == 1)
     // Mode 1: USB2 is Controller
-    switch (pU2EP1_OUT_DataBuf[0]) {
-        case 1: Send_Key_Report(pU2EP1_OUT_DataBuf + 2); break;
-        case 2: Send_Mouse_Report(pU2EP1_OUT_DataBuf + 2); break;
-        case 3:
-            HID_Buf[0] = 3; HID_Buf[2] = HIDKeyLightsCode;
-            Send_Control_Data(HID_Buf);
-            break;
-        case 7: Send_MouseRel_Report(pU2EP1_OUT_DataBuf + 2); break;
-    }
+    Cmd_Push(pU2EP1_OUT_DataBuf, l);
 #else
     // Mode 0: USB2 is HID. Default Echo/Invert logic
     uint8_t i;
@@ -624,11 +3062,18 @@ void DebugInit(void) {
     GPIOA_ModeCfg(GPIO_Pin_8, GPIO_ModeIN_PU);
     GPIOA_ModeCfg(GPIO_Pin_9, GPIO_ModeOut_PP_5mA);
     UART1_DefInit();
+#if DEBUG_PRT
+    Trace_Init();
+#endif
 }
 
 __attribute__((interrupt("WCH-Interrupt-fast")))
 __attribute__((section(".highcode"))) void USB_IRQHandler(void) {
+#if USB_HOST_PASSTHROUGH
+    USB_HostTransProcess();
+#else
     USB_DevTransProcess();
+#endif
 }
 
 __INTERRUPT
@@ -637,11 +3082,30 @@ void USB2_IRQHandler(void) {
     USB2_DevTransProcess();
 }
 
+// Same priority as the USB interrupts, so neither preempts the other
+__INTERRUPT
+__HIGH_CODE
+void TMR0_IRQHandler(void) {
+    uint32_t now = Clock_Now();
+
+    TMR0_ClearITFlag(TMR0_3_IT_CYC_END);
+    if (!++ClockMsLo) ClockMsHi++;
+    Typematic_Tick(now);
+    Host_Watchdog(now);
+    Switch_Tick(now);
+    Port_Tick(now);
+    MouseAbs_Tick();
+#if USB_HOST_PASSTHROUGH
+    Host_Tick(now);
+#endif
+}
+
 /* =======================================================================
    MAIN - WITH TOGGLE BIT RESET
    ======================================================================= */
 int main() {
     SetSysClock(CLK_SOURCE_PLL_60MHz);
+    Clock_Init();
     DebugInit();
 
     // 1. Assign RAM pointers
@@ -656,51 +3120,23 @@ int main() {
     pU2EP3_RAM_Addr = U2EP3_Databuf;
 
     // 2. Initialize USB Hardware
-    USB_DeviceInit();
-    USB2_DeviceInit();
-
-    // 3. Conditional Configuration
-#if (USB_SWAP_MODE == 0)
-    // -------------------------------------------------------------------
-    // MODE 0: ORIGINAL SETUP (USB1=Ctrl, USB2=HID)
-    // -------------------------------------------------------------------
-    // Use library defaults for USB2.
-    // Ensure USB1 (Controller) EP1 is ready for RX.
-    R8_UEP4_1_MOD |= RB_UEP1_RX_EN; 
-    R8_UEP1_CTRL  = UEP_T_RES_NAK | UEP_R_RES_ACK; 
-    
-#else
-    // -------------------------------------------------------------------
-    // MODE 1: SWAPPED SETUP (USB1=HID, USB2=Ctrl)
-    // -------------------------------------------------------------------
-    
-    // A. Manually register DMA addresses for USB1
-    R16_UEP2_DMA = (uint16_t)(uint32_t)EP2_Databuf;
-    R16_UEP3_DMA = (uint16_t)(uint32_t)EP3_Databuf;
-
-    // B. Enable Transmit (TX) for EP2 and EP3
-    R8_UEP2_3_MOD |= RB_UEP2_TX_EN | RB_UEP3_TX_EN;
-    
-    // C. RESET TOGGLE BITS & SET NAK (CRITICAL FIX)
-    // We explicitly clear the T_TOG bit to ensure the first packet is DATA0.
-    // If this is random, the Host will reject the mouse packets.
-    
-    R8_UEP2_T_LEN = 0;
-    R8_UEP2_CTRL = UEP_T_RES_NAK | UEP_R_RES_ACK; 
-    R8_UEP2_CTRL &= ~RB_UEP_T_TOG; // Force DATA0 expectation
-
-    R8_UEP3_T_LEN = 0;
-    R8_UEP3_CTRL = UEP_T_RES_NAK | UEP_R_RES_ACK;
-    R8_UEP3_CTRL &= ~RB_UEP_T_TOG; // Force DATA0 expectation
-
-    // D. USB2 Config (Controller)
-    // Just ensure EP1 is ready for commands
-    R8_U2EP4_1_MOD |= RB_UEP1_RX_EN;
-    R8_U2EP1_CTRL  = UEP_T_RES_NAK | UEP_R_RES_ACK;
+#if USB_HOST_PASSTHROUGH
+    // USB1 is a host; its unused EP2/EP3 RAM holds the host buffers
+    pHOST_RX_RAM_Addr = EP2_Databuf;
+    pHOST_TX_RAM_Addr = EP3_Databuf;
+    USB_HostInit();
+#else
+    Port1_Init();
 #endif
+    Port2_Init();
 
+#if USB_HOST_PASSTHROUGH
+    // The controller link is UART3; USB1 interrupts drive host transfers
+    Link_Init();
+#endif
     PFIC_EnableIRQ(USB_IRQn);
     PFIC_EnableIRQ(USB2_IRQn);
+    Timer_Init();
 
     /* GPIO Config */
     GPIOA_ModeCfg(GPIO_Pin_13, GPIO_ModeOut_PP_20mA); 
@@ -717,13 +3153,26 @@ int main() {
     GPIOB_ResetBits(GPIO_Pin_7);
     GPIOA_ResetBits(GPIO_Pin_12);
 
+    Watchdog_Init();
     while (1) {
+        WWDG_SetCounter(0);
+        Cmd_Dispatch();
+#if USB_HOST_PASSTHROUGH
+        Local_Poll();
+#endif
+        Usb_Health();
         if (mode != 0) {
             switch (mode) {
-                case 1:
-                    Send_Key_Report((uint8_t*)empty_buf);
+                case 1: {
+                    // Command 6: release once the target polled the press
+                    uint32_t irq;
+                    if (KeyEpBusy) break;
+                    SYS_DisableAllIrq(&irq);
+                    Key_Report((uint8_t*)empty_buf);
+                    SYS_RecoverIrq(irq);
                     mode = 0;
                     break;
+                }
                 default:
                     mode = 0;
                     break;
@@ -0,0 +1,152 @@
+#!/usr/bin/env node
+// Reads the crash record the firmware's HardFault_Handler left in DataFlash
+// (command 0x0F, see CRASH RECORD in src/Main.c) and symbolizes it against
+// the ELF of the firmware that crashed.
+//
+//   node crash-dump.js [firmware.elf] [--save record.bin] [--clear]
+//   node crash-dump.js [firmware.elf] --record record.bin
+//
+// Run from the repository root so node-hid resolves. --record decodes a
+// saved record instead of asking the controller; --clear erases the record
+// on the controller after reading it. Symbols come from addr2line, set
+// ADDR2LINE to use another toolchain prefix.
+
+const fs = require('fs');
+const { spawnSync } = require('child_process');
+const path = require('path');
+const { EVENTS, TICKS_PER_US, parseRecords, recordArgs } = require('./trace-decode');
+
+const CRASH_MAGIC = 0x48535243;
+const STACK_OFFSET = 32;
+const TRACE_OFFSET = 96;
+const ADDR2LINE = process.env.ADDR2LINE || 'riscv-none-embed-addr2line';
+
+// Code lives in flash from 0 and, for __HIGH_CODE, at the bottom of RAM
+const FLASH_END = 0x70000;
+const RAM_START = 0x20000000;
+const RAM_END = 0x20008000;
+
+const MCAUSE = {
+  0: 'instruction address misaligned',
+  1: 'instruction access fault',
+  2: 'illegal instruction',
+  3: 'breakpoint',
+  4: 'load address misaligned',
+  5: 'load access fault',
+  6: 'store address misaligned',
+  7: 'store access fault',
+  8: 'ecall from U-mode',
+  11: 'ecall from M-mode'
+};
+
+const hex32 = (v) => '0x' + (v >>> 0).toString(16).padStart(8, '0');
+
+function parseArgs(argv) {
+  const opts = { elf: null, record: null, save: null, clear: false };
+  for (let i = 0; i < argv.length; i++) {
+    if (argv[i] === '--record') opts.record = argv[++i];
+    else if (argv[i] === '--save') opts.save = argv[++i];
+    else if (argv[i] === '--clear') opts.clear = true;
+    else opts.elf = argv[i];
+  }
+  return opts;
+}
+
+async function readFromController(clear) {
+  const HIDManager = require(path.join(__dirname, '../../src/hid-manager'));
+  const hid = new HIDManager();
+  const devices = hid.getDevices();
+  if (devices.length === 0) throw new Error('controller not found');
+  const result = await hid.connect(devices[0].path);
+  if (!result.success) throw new Error(result.error);
+  try {
+    const record = await hid.readCrashRecord();
+    if (record && clear && !(await hid.clearCrashRecord())) console.error('clearing the record failed');
+    return record;
+  } finally {
+    hid.disconnect();
+  }
+}
+
+function decode(buf) {
+  const r = {
+    version: buf[4],
+    faults: buf[5],
+    stackWords: buf[6],
+    traceRecords: buf[7],
+    mcause: buf.readUInt32LE(8),
+    mepc: buf.readUInt32LE(12),
+    mtval: buf.readUInt32LE(16),
+    sp: buf.readUInt32LE(20),
+    ra: buf.readUInt32LE(24),
+    ticks: buf.readUInt32LE(28),
+    stack: []
+  };
+  for (let i = 0; i < r.stackWords; i++) r.stack.push(buf.readUInt32LE(STACK_OFFSET + 4 * i));
+  r.trace = parseRecords(buf.subarray(TRACE_OFFSET, TRACE_OFFSET + 8 * r.traceRecords)).records;
+  return r;
+}
+
+const isCode = (v) => (v > 0 && v < FLASH_END) || (v >= RAM_START && v < RAM_END);
+
+// address -> 'function at file:line', only for addresses addr2line knows
+function symbolize(elf, addrs) {
+  const symbols = new Map();
+  if (!elf || addrs.length === 0) return symbols;
+  const res = spawnSync(ADDR2LINE, ['-f', '-p', '-C', '-e', elf, ...addrs.map(hex32)], { encoding: 'utf8' });
+  if (res.error || res.status !== 0) {
+    console.error(`${ADDR2LINE} failed: ${res.error ? res.error.message : res.stderr.trim()}`);
+    return symbols;
+  }
+  res.stdout.trim().split('\n').forEach((line, i) => {
+    if (!line.startsWith('??')) symbols.set(addrs[i], line.trim());
+  });
+  return symbols;
+}
+
+function print(r, symbols) {
+  const sym = (v) => (symbols.has(v) ? '  ' + symbols.get(v) : '');
+  const cause = r.mcause & 0x80000000 ? 'interrupt ' + (r.mcause & 0x7FFFFFFF) : MCAUSE[r.mcause] || 'unknown';
+
+  console.log(`crash record v${r.version}, ${r.faults} fault(s) since cleared`);
+  console.log(`mcause ${hex32(r.mcause)}  ${cause}`);
+  console.log(`mepc   ${hex32(r.mepc)}${sym(r.mepc)}`);
+  console.log(`mtval  ${hex32(r.mtval)}`);
+  console.log(`ra     ${hex32(r.ra)}${sym(r.ra)}`);
+  console.log(`sp     ${hex32(r.sp)}`);
+  console.log(`uptime ${(r.ticks / TICKS_PER_US / 1e6).toFixed(3)} s (SysTick wraps every ~9.5 min)`);
+
+  if (r.stack.length) {
+    console.log('\nstack');
+    r.stack.forEach((v, i) => console.log(`  sp+${String(4 * i).padEnd(3)} ${hex32(v)}${sym(v)}`));
+  }
+  if (r.trace.length) {
+    // The fault time shares the trace's wrapping tick base
+    const end = r.trace[r.trace.length - 1].ticks + ((r.ticks - r.trace[r.trace.length - 1].ticks) >>> 0);
+    console.log('\nlast trace events');
+    for (const t of r.trace) {
+      const before = ((end - t.ticks) / TICKS_PER_US / 1000).toFixed(3);
+      console.log(`  -${before.padStart(9)} ms  ${EVENTS[t.id].name.padEnd(10)} ${JSON.stringify(recordArgs(t))}`);
+    }
+  }
+}
+
+async function main() {
+  const opts = parseArgs(process.argv.slice(2));
+  const buf = opts.record ? fs.readFileSync(opts.record) : await readFromController(opts.clear);
+
+  if (!buf || buf.length < TRACE_OFFSET || buf.readUInt32LE(0) !== CRASH_MAGIC) {
+    console.log('no crash record');
+    return;
+  }
+  if (opts.save) fs.writeFileSync(opts.save, buf);
+
+  const r = decode(buf);
+  const addrs = [...new Set([r.mepc, r.ra, ...r.stack].filter(isCode))];
+  print(r, symbolize(opts.elf, addrs));
+}
+
+main().catch((error) => {
+  console.error(error.message);
+  process.exit(1);
+});
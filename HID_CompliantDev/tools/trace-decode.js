@@ -0,0 +1,145 @@
+#!/usr/bin/env node
+// Turns a raw UART1 capture of the firmware event trace (DEBUG_PRT 1 in
+// src/Main.c) into Chrome trace JSON for chrome://tracing or Perfetto.
+//
+//   node trace-decode.js capture.bin [trace.json]
+//
+// Records are [0xA5, id, a, b, time32 LE] with time in SysTick ticks
+// (FREQ_SYS / 8). Bytes that do not form a record, such as library PRINT
+// output on the same port, are skipped.
+
+const fs = require('fs');
+
+const TRACE_SYNC = 0xA5;
+const RECORD_LEN = 8;
+const TICKS_PER_US = 60000000 / 8 / 1e6;
+
+// Keep in sync with the TR_* ids in src/Main.c
+const EVENTS = {
+  0x01: { name: 'lost', track: 'trace' },
+  0x02: { name: 'cmd push', track: 'commands' },
+  0x03: { name: 'cmd drop', track: 'commands' },
+  0x04: { name: 'cmd run', track: 'commands' },
+  0x05: { name: 'key send', track: 'keyboard' },
+  0x06: { name: 'key IN', track: 'keyboard' },
+  0x07: { name: 'mouse send', track: 'mouse' },
+  0x08: { name: 'mouse IN', track: 'mouse' },
+  0x09: { name: 'bus reset', track: 'usb' },
+  0x0A: { name: 'switch', track: 'switch' },
+  0x0B: { name: 'watchdog', track: 'commands' },
+  0x0C: { name: 'host xfer', track: 'usb host' },
+  0x0D: { name: 'port reset', track: 'usb' }
+};
+const TRACKS = ['commands', 'keyboard', 'mouse', 'usb', 'usb host', 'switch', 'trace'];
+const SWITCH_STATES = ['idle', 'drain', 'break', 'settle'];
+const PORT_RESET_REASONS = ['ok', 'SIE off', 'interrupt stuck', 'IN stuck', 'OUT stuck', 'host request'];
+
+const hex = (v) => '0x' + v.toString(16).padStart(2, '0');
+
+function parseRecords(buf) {
+  const records = [];
+  let skipped = 0;
+  let base = 0;
+  let last = null;
+  let i = 0;
+
+  while (i + RECORD_LEN <= buf.length) {
+    const id = buf[i + 1];
+    if (buf[i] !== TRACE_SYNC || !EVENTS[id]) {
+      skipped++;
+      i++;
+      continue;
+    }
+    const ticks = buf.readUInt32LE(i + 4);
+    // The tick counter wraps every ~9.5 minutes
+    if (last !== null && ticks < last && last - ticks > 0x80000000) base += 0x100000000;
+    last = ticks;
+    records.push({ id, a: buf[i + 2], b: buf[i + 3], ticks: base + ticks });
+    i += RECORD_LEN;
+  }
+  return { records, skipped: skipped + (buf.length - i) };
+}
+
+function recordArgs(r) {
+  switch (r.id) {
+    case 0x01: return { dropped: r.a | (r.b << 8) };
+    case 0x02: return { opcode: hex(r.a), queued: r.b };
+    case 0x03: return { opcode: hex(r.a) };
+    case 0x04: return { opcode: hex(r.a), payload0: hex(r.b) };
+    case 0x05: return { modifiers: hex(r.a), key: hex(r.b) };
+    case 0x07: return { endpoint: r.a, staged: r.b };
+    case 0x08: return { endpoint: r.a, next: r.b };
+    case 0x09: return { port: r.a };
+    case 0x0A: return { state: SWITCH_STATES[r.a] || r.a, target: r.b };
+    case 0x0C: return { endpoint: r.a, status: hex(r.b) };
+    case 0x0D: return { port: r.a, reason: PORT_RESET_REASONS[r.b] || r.b };
+    default: return {};
+  }
+}
+
+function toChromeTrace(records) {
+  const events = [];
+  const tid = (track) => TRACKS.indexOf(track) + 1;
+  const t0 = records.length ? records[0].ticks : 0;
+  const us = (r) => (r.ticks - t0) / TICKS_PER_US;
+  const slice = (track, name, from, to, args) => {
+    events.push({ name, ph: 'X', pid: 1, tid: tid(track), ts: us(from), dur: us(to) - us(from), args });
+  };
+
+  TRACKS.forEach((track) => {
+    events.push({ name: 'thread_name', ph: 'M', pid: 1, tid: tid(track), args: { name: track } });
+  });
+
+  // Spans derived from matching records: time a command waited in the
+  // ring, and time a report waited for the target's IN token
+  const pushed = [];
+  let keySent = null;
+  const mouseSent = { 2: [], 3: [] };
+
+  for (const r of records) {
+    const ev = EVENTS[r.id];
+    events.push({ name: ev.name, ph: 'i', s: r.id === 0x01 ? 'g' : 't', pid: 1, tid: tid(ev.track), ts: us(r), args: recordArgs(r) });
+
+    if (r.id === 0x02) {
+      pushed.push(r);
+    } else if (r.id === 0x04 && pushed.length) {
+      slice('commands', 'queued ' + hex(r.a), pushed.shift(), r, {});
+    } else if (r.id === 0x05) {
+      if (!keySent) keySent = r;
+    } else if (r.id === 0x06 && keySent) {
+      slice('keyboard', 'key report', keySent, r, {});
+      keySent = null;
+    } else if (r.id === 0x07 && mouseSent[r.a]) {
+      // A report sent with both halves taken replaces the staged one
+      const q = mouseSent[r.a];
+      if (q.length < 2) q.push(r);
+    } else if (r.id === 0x08 && mouseSent[r.a] && mouseSent[r.a].length) {
+      slice('mouse', 'EP' + r.a + ' report', mouseSent[r.a].shift(), r, {});
+    } else if (r.id === 0x09 || r.id === 0x0D) {
+      keySent = null;
+      mouseSent[2] = [];
+      mouseSent[3] = [];
+    }
+  }
+  return { traceEvents: events, displayTimeUnit: 'ns' };
+}
+
+function main() {
+  const [input, output] = process.argv.slice(2);
+  if (!input) {
+    console.error('usage: node trace-decode.js capture.bin [trace.json]');
+    process.exit(1);
+  }
+
+  const { records, skipped } = parseRecords(fs.readFileSync(input));
+  const json = JSON.stringify(toChromeTrace(records));
+  if (output) fs.writeFileSync(output, json);
+  else process.stdout.write(json + '\n');
+
+  const lost = records.filter((r) => r.id === 0x01).reduce((n, r) => n + (r.a | (r.b << 8)), 0);
+  console.error(`${records.length} records, ${lost} dropped in firmware, ${skipped} bytes skipped`);
+}
+
+if (require.main === module) main();
+
+module.exports = { EVENTS, TICKS_PER_US, parseRecords, recordArgs };
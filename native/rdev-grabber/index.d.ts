@@ -3,17 +3,78 @@
 
 /* auto-generated by NAPI-RS */
 
-export interface KeyEvent {
-  key: string
-  code: string
-  eventType: string
-  ctrl: boolean
-  alt: boolean
-  shift: boolean
-  meta: boolean
-  platformCode: number
-  scanCode: number
-  usbHid: number
-}
-export declare function start_grab(callback: (...args: any[]) => any): void
+/**
+ * Starts grabbing the keyboard. The callback receives batches of packed
+ * events, two u32 words each:
+ *   word 0: HID usage (bits 0-15) | modifier mask (bits 16-23) | flags (bits 24-31)
+ *   word 1: grab timestamp in microseconds (see now_us), wrapping
+ * Modifier mask: 0x01 Ctrl, 0x02 Shift, 0x04 Alt, 0x08 Meta.
+ * Flags: 0x01 key down, 0x02 already written by the direct HID path.
+ */
+export declare function start_grab(callback: (batch: Uint32Array) => void): void
 export declare function stop_grab(): void
+/**
+ * Tears down the persistent grab service (Linux). stop_grab only disables
+ * grabbing so the next start_grab is immediate; call this on app exit.
+ */
+export declare function shutdown_grab(): void
+/**
+ * Opens the controller at `path` so grabbed keys are written to it directly
+ * from the grab thread instead of being forwarded through JS.
+ */
+export declare function open_direct_hid(path: string): void
+export declare function close_direct_hid(): void
+export declare function is_direct_hid_open(): boolean
+/**
+ * Applies a key change from JS (virtual keyboard, paste) to the native key
+ * state and writes the report, so that while the direct HID path is open
+ * it alone owns the keyboard state. Returns false when no device is open
+ * or the write failed.
+ */
+export declare function direct_hid_key(usage: number, isDown: boolean): boolean
+/**
+ * Releases every key held on the direct HID path and writes the empty
+ * report. Returns false when no device is open or the write failed.
+ */
+export declare function direct_hid_release_keys(): boolean
+/**
+ * Selects the controller firmware extensions the direct HID path may use
+ * (bit 0x01: 16-bit relative mouse command, bit 0x02: high-resolution
+ * wheel and horizontal pan).
+ */
+export declare function set_direct_hid_features(features: number): void
+/**
+ * Current value of the clock used for event timestamps, for measuring
+ * grab-to-USB latency from JS.
+ */
+export declare function now_us(): number
+/** DOM code name for a HID usage carried in a packed event. */
+export declare function usage_name(usage: number): string
+/** Number of events dropped because the JS side stopped draining the queue. */
+export declare function dropped_events(): number
+/**
+ * Watches for the controller's hidraw nodes appearing or disappearing
+ * (Linux udev netlink). The callback receives the action ("add"/"remove")
+ * and the device node. Returns false where hotplug notifications are not
+ * supported, in which case the caller has to keep polling.
+ */
+export declare function watch_hotplug(vendorId: number, productId: number, callback: (action: string, devnode: string) => void): boolean
+export declare function unwatch_hotplug(): void
+export interface EvdevGrabOptions {
+  keyboard?: boolean
+  mouse?: boolean
+}
+/**
+ * Starts the Linux evdev backend: grabs keyboards and/or mice with EVIOCGRAB
+ * and delivers raw events in packed four-word records. Returns the number of
+ * devices grabbed.
+ *   word 0: HID usage or mouse button mask (bits 0-15) | modifier mask (bits 16-23) | flags (bits 24-31)
+ *   word 1: kernel event timestamp in microseconds (see now_us), wrapping
+ *   word 2: dx (i16, bits 0-15) | dy (i16, bits 16-31)
+ *   word 3: wheel (i16) | hwheel (i16) << 16, in 1/120 detent units
+ * Flags: 0x01 key down, 0x02 already written by the direct HID path, 0x04 mouse record.
+ */
+export declare function start_evdev_grab(callback: (batch: Uint32Array) => void, options?: EvdevGrabOptions | undefined | null): number
+export declare function stop_evdev_grab(): void
+/** Number of evdev records dropped because the JS side stopped draining. */
+export declare function dropped_evdev_events(): number
@@ -310,7 +310,40 @@ if (!nativeBinding) {
   throw new Error(`Failed to load native binding`)
 }
 
-const { start_grab, stop_grab } = nativeBinding
+const {
+  start_grab,
+  stop_grab,
+  shutdown_grab,
+  open_direct_hid,
+  close_direct_hid,
+  is_direct_hid_open,
+  direct_hid_key,
+  direct_hid_release_keys,
+  set_direct_hid_features,
+  now_us,
+  usage_name,
+  dropped_events,
+  start_evdev_grab,
+  stop_evdev_grab,
+  dropped_evdev_events,
+  watch_hotplug,
+  unwatch_hotplug,
+} = nativeBinding
 
 module.exports.start_grab = start_grab
 module.exports.stop_grab = stop_grab
+module.exports.shutdown_grab = shutdown_grab
+module.exports.open_direct_hid = open_direct_hid
+module.exports.close_direct_hid = close_direct_hid
+module.exports.is_direct_hid_open = is_direct_hid_open
+module.exports.direct_hid_key = direct_hid_key
+module.exports.direct_hid_release_keys = direct_hid_release_keys
+module.exports.set_direct_hid_features = set_direct_hid_features
+module.exports.now_us = now_us
+module.exports.usage_name = usage_name
+module.exports.dropped_events = dropped_events
+module.exports.start_evdev_grab = start_evdev_grab
+module.exports.stop_evdev_grab = stop_evdev_grab
+module.exports.dropped_evdev_events = dropped_evdev_events
+module.exports.watch_hotplug = watch_hotplug
+module.exports.unwatch_hotplug = unwatch_hotplug
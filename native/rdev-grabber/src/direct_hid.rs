@@ -0,0 +1,415 @@
+// Direct keyboard report path: the grab thread owns a hidapi handle to the
+// KVM controller and writes keyboard reports itself, so a grabbed key reaches
+// USB without a round trip through the Node event loop.
+//
+// The report layouts mirror HIDManager in src/hid-manager.js:
+//   keyboard (sendKeyboardEvent): [report_id=0, cmd=1, 0, modifiers, 0, key1..key6]
+//   relative mouse (sendMouseEvent 'move'): [report_id=0, cmd=7, 0, buttons, dx, dy, wheel, 0, 0]
+//   16-bit relative mouse (writeRelativeMotion): [report_id=0, cmd=8, 0, buttons, dx16, dy16, wheel, pan, 0]
+
+use hidapi::{HidApi, HidDevice};
+use std::ffi::CString;
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::Mutex;
+
+const KEYBOARD_CMD: u8 = 0x01;
+const REPORT_LEN: usize = 11;
+const RELATIVE_MOUSE_CMD: u8 = 0x07;
+const MOUSE_REPORT_LEN: usize = 9;
+const RELATIVE_MOUSE16_CMD: u8 = 0x08;
+const SCROLL_CMD: u8 = 0x09;
+
+/// Controller firmware extensions, see HIDManager.features.
+pub const FEATURE_MOUSE_REL16: u32 = 0x01;
+pub const FEATURE_HIRES_SCROLL: u32 = 0x02;
+static FEATURES: AtomicU32 = AtomicU32::new(0);
+// Wheel input arrives in 1/120 detent units (REL_WHEEL_HI_RES)
+const WHEEL_UNITS_PER_NOTCH: i32 = 120;
+const MAX_TRACKED_KEYS: usize = 16;
+
+// Keyboard state behind the report, kept apart from the device handle
+struct KeyState {
+    modifiers: u8,
+    // Pressed non-modifier usages in press order; the first six are reported.
+    keys: [u8; MAX_TRACKED_KEYS],
+    key_count: usize,
+}
+
+struct DirectHid {
+    // Kept alive for the lifetime of the device handle.
+    _api: HidApi,
+    device: HidDevice,
+    keys: KeyState,
+    // Mouse buttons held in the last relative report
+    buttons: u8,
+    // Sub-detent wheel motion not yet sent
+    wheel_remainder: i32,
+}
+
+static DIRECT: Mutex<Option<DirectHid>> = Mutex::new(None);
+
+impl KeyState {
+    const fn new() -> Self {
+        Self {
+            modifiers: 0,
+            keys: [0; MAX_TRACKED_KEYS],
+            key_count: 0,
+        }
+    }
+
+    /// Returns false when the event leaves the report unchanged (OS auto-repeat
+    /// of a held key), so only key edges reach the controller.
+    fn apply(&mut self, usage: u8, is_down: bool) -> bool {
+        if (0xE0..=0xE7).contains(&usage) {
+            let bit = 1u8 << (usage - 0xE0);
+            let before = self.modifiers;
+            if is_down {
+                self.modifiers |= bit;
+            } else {
+                self.modifiers &= !bit;
+            }
+            return self.modifiers != before;
+        }
+
+        let held = &self.keys[..self.key_count];
+        let pos = held.iter().position(|&k| k == usage);
+        match (is_down, pos) {
+            (true, None) if self.key_count < MAX_TRACKED_KEYS => {
+                self.keys[self.key_count] = usage;
+                self.key_count += 1;
+                true
+            }
+            (false, Some(i)) => {
+                self.keys.copy_within(i + 1..self.key_count, i);
+                self.key_count -= 1;
+                true
+            }
+            _ => false,
+        }
+    }
+
+    fn report(&self) -> [u8; REPORT_LEN] {
+        let mut report = [0u8; REPORT_LEN];
+        report[1] = KEYBOARD_CMD;
+        report[3] = self.modifiers;
+        let n = self.key_count.min(6);
+        report[5..5 + n].copy_from_slice(&self.keys[..n]);
+        report
+    }
+
+    fn is_empty(&self) -> bool {
+        self.modifiers == 0 && self.key_count == 0
+    }
+
+    fn clear(&mut self) {
+        self.modifiers = 0;
+        self.key_count = 0;
+    }
+}
+
+impl DirectHid {
+    fn write_report(&self) -> bool {
+        self.device.write(&self.keys.report()).is_ok()
+    }
+
+    fn write_mouse16_report(&self, buttons: u8, dx: i16, dy: i16, wheel: i8) -> bool {
+        let [dx_lo, dx_hi] = dx.to_le_bytes();
+        let [dy_lo, dy_hi] = dy.to_le_bytes();
+        let report: [u8; REPORT_LEN] = [
+            0,
+            RELATIVE_MOUSE16_CMD,
+            0,
+            buttons,
+            dx_lo,
+            dx_hi,
+            dy_lo,
+            dy_hi,
+            wheel as u8,
+            0,
+            0,
+        ];
+        self.device.write(&report).is_ok()
+    }
+
+    // Wheel and pan in 1/120 detent units, applied to the relative mouse
+    fn write_scroll_report(&self, buttons: u8, wheel: i16, pan: i16) -> bool {
+        let [wheel_lo, wheel_hi] = wheel.to_le_bytes();
+        let [pan_lo, pan_hi] = pan.to_le_bytes();
+        let report: [u8; REPORT_LEN] = [
+            0,
+            SCROLL_CMD,
+            0,
+            0,
+            buttons,
+            wheel_lo,
+            wheel_hi,
+            pan_lo,
+            pan_hi,
+            0,
+            0,
+        ];
+        self.device.write(&report).is_ok()
+    }
+
+    fn write_mouse_report(&self, buttons: u8, dx: i8, dy: i8, wheel: i8) -> bool {
+        let report: [u8; MOUSE_REPORT_LEN] = [
+            0,
+            RELATIVE_MOUSE_CMD,
+            0,
+            buttons,
+            dx as u8,
+            dy as u8,
+            wheel as u8,
+            0,
+            0,
+        ];
+        self.device.write(&report).is_ok()
+    }
+
+    fn clear(&mut self) {
+        self.keys.clear();
+        self.wheel_remainder = 0;
+    }
+}
+
+pub fn open(path: &str) -> Result<(), String> {
+    let api = HidApi::new_without_enumerate().map_err(|e| e.to_string())?;
+    let c_path = CString::new(path).map_err(|e| e.to_string())?;
+    let device = api.open_path(&c_path).map_err(|e| e.to_string())?;
+
+    let mut guard = DIRECT.lock().unwrap_or_else(|e| e.into_inner());
+    *guard = Some(DirectHid {
+        _api: api,
+        device,
+        keys: KeyState::new(),
+        buttons: 0,
+        wheel_remainder: 0,
+    });
+    Ok(())
+}
+
+pub fn close() {
+    let mut guard = DIRECT.lock().unwrap_or_else(|e| e.into_inner());
+    if let Some(hid) = guard.as_mut() {
+        hid.clear();
+        let _ = hid.write_report();
+    }
+    *guard = None;
+}
+
+pub fn is_open() -> bool {
+    DIRECT
+        .lock()
+        .map(|guard| guard.is_some())
+        .unwrap_or(false)
+}
+
+/// Updates the native key state and writes the resulting report.
+/// Returns false when no device is open or the write failed, in which case
+/// the caller must let the JS path deliver the key instead.
+pub fn key_event(usage: u32, is_down: bool) -> bool {
+    if usage == 0 || usage > 0xFF {
+        return false;
+    }
+    let mut guard = match DIRECT.lock() {
+        Ok(guard) => guard,
+        Err(_) => return false,
+    };
+    match guard.as_mut() {
+        Some(hid) => !hid.keys.apply(usage as u8, is_down) || hid.write_report(),
+        None => false,
+    }
+}
+
+pub fn set_features(features: u32) {
+    FEATURES.store(features, Ordering::Relaxed);
+}
+
+/// Writes relative motion as a single report, clamping deltas to the
+/// report's range (+-127 for cmd 7, +-32767 for cmd 8). Back-to-back cmd-7
+/// writes would overwrite each other in the stock firmware's EP3 buffer, so
+/// splitting is left to the extended firmware's queue. `wheel` is in
+/// 1/120 detent units; with high-resolution scrolling it is forwarded as is
+/// together with `hwheel` (cmd 9), otherwise sub-detent remainders carry over
+/// to the next call and `hwheel` is dropped.
+/// Returns false when no device is open or a write failed.
+pub fn mouse_event(buttons: u32, dx: i32, dy: i32, wheel: i32, hwheel: i32) -> bool {
+    let features = FEATURES.load(Ordering::Relaxed);
+    let rel16 = features & FEATURE_MOUSE_REL16 != 0;
+    let hires = features & FEATURE_HIRES_SCROLL != 0;
+    let limit = if rel16 { i16::MAX as i32 } else { 127 };
+    let mut guard = match DIRECT.lock() {
+        Ok(guard) => guard,
+        Err(_) => return false,
+    };
+    let hid = match guard.as_mut() {
+        Some(hid) => hid,
+        None => return false,
+    };
+
+    hid.buttons = buttons as u8;
+    let mut notches = 0;
+    if !hires {
+        hid.wheel_remainder += wheel;
+        notches = hid.wheel_remainder / WHEEL_UNITS_PER_NOTCH;
+        hid.wheel_remainder -= notches * WHEEL_UNITS_PER_NOTCH;
+    }
+
+    // In high-resolution mode a pure scroll goes out as cmd 9 alone, which
+    // carries the buttons as well
+    let send_motion = !hires || dx != 0 || dy != 0 || (wheel == 0 && hwheel == 0);
+    if send_motion {
+        let dx = dx.clamp(-limit, limit);
+        let dy = dy.clamp(-limit, limit);
+        // Detents beyond one report's reach carry over like a remainder
+        let step_wheel = notches.clamp(-127, 127);
+        hid.wheel_remainder += (notches - step_wheel) * WHEEL_UNITS_PER_NOTCH;
+        let written = if rel16 {
+            hid.write_mouse16_report(buttons as u8, dx as i16, dy as i16, step_wheel as i8)
+        } else {
+            hid.write_mouse_report(buttons as u8, dx as i8, dy as i8, step_wheel as i8)
+        };
+        if !written {
+            return false;
+        }
+    }
+
+    if !hires {
+        return true;
+    }
+    let (mut wheel, mut hwheel) = (wheel, hwheel);
+    while wheel != 0 || hwheel != 0 {
+        let step_wheel = wheel.clamp(-(i16::MAX as i32), i16::MAX as i32);
+        let step_pan = hwheel.clamp(-(i16::MAX as i32), i16::MAX as i32);
+        if !hid.write_scroll_report(buttons as u8, step_wheel as i16, step_pan as i16) {
+            return false;
+        }
+        wheel -= step_wheel;
+        hwheel -= step_pan;
+    }
+    true
+}
+
+/// Releases held keys and modifiers, leaving mouse state alone. Returns
+/// false when no device is open or the write failed.
+pub fn release_keys() -> bool {
+    let mut guard = match DIRECT.lock() {
+        Ok(guard) => guard,
+        Err(_) => return false,
+    };
+    match guard.as_mut() {
+        Some(hid) => {
+            hid.keys.clear();
+            hid.write_report()
+        }
+        None => false,
+    }
+}
+
+/// Releases every key still held by the native state machine.
+pub fn release_all() {
+    let mut guard = DIRECT.lock().unwrap_or_else(|e| e.into_inner());
+    if let Some(hid) = guard.as_mut() {
+        if !hid.keys.is_empty() {
+            hid.clear();
+            let _ = hid.write_report();
+        }
+        if hid.buttons != 0 {
+            hid.buttons = 0;
+            // Same report mouse_event would use, so the release goes to the
+            // interface the buttons were pressed on
+            if FEATURES.load(Ordering::Relaxed) & FEATURE_MOUSE_REL16 != 0 {
+                let _ = hid.write_mouse16_report(0, 0, 0, 0);
+            } else {
+                let _ = hid.write_mouse_report(0, 0, 0, 0);
+            }
+        }
+        hid.wheel_remainder = 0;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const KEY_A: u8 = 0x04;
+    const LEFT_CTRL: u8 = 0xE0;
+    const LEFT_SHIFT: u8 = 0xE1;
+
+    fn reported_keys(state: &KeyState) -> Vec<u8> {
+        state.report()[5..]
+            .iter()
+            .copied()
+            .filter(|&k| k != 0)
+            .collect()
+    }
+
+    #[test]
+    fn press_and_release_change_the_report() {
+        let mut state = KeyState::new();
+        assert!(state.apply(KEY_A, true));
+        assert_eq!(
+            state.report(),
+            [0, KEYBOARD_CMD, 0, 0, 0, KEY_A, 0, 0, 0, 0, 0]
+        );
+        assert!(state.apply(KEY_A, false));
+        assert_eq!(state.report(), [0, KEYBOARD_CMD, 0, 0, 0, 0, 0, 0, 0, 0, 0]);
+        assert!(state.is_empty());
+    }
+
+    #[test]
+    fn auto_repeat_and_stray_releases_are_suppressed() {
+        let mut state = KeyState::new();
+        assert!(!state.apply(KEY_A, false));
+        assert!(state.apply(KEY_A, true));
+        assert!(!state.apply(KEY_A, true));
+        assert!(!state.apply(LEFT_SHIFT, false));
+        assert!(state.apply(LEFT_SHIFT, true));
+        assert!(!state.apply(LEFT_SHIFT, true));
+        assert_eq!(reported_keys(&state), vec![KEY_A]);
+    }
+
+    #[test]
+    fn modifiers_are_bits_not_key_slots() {
+        let mut state = KeyState::new();
+        assert!(state.apply(LEFT_CTRL, true));
+        assert!(state.apply(LEFT_SHIFT, true));
+        assert!(state.apply(KEY_A, true));
+        assert_eq!(state.report()[3], 0x03);
+        assert_eq!(reported_keys(&state), vec![KEY_A]);
+        assert!(state.apply(LEFT_CTRL, false));
+        assert_eq!(state.report()[3], 0x02);
+        assert!(!state.is_empty());
+    }
+
+    #[test]
+    fn keys_beyond_six_are_tracked_and_reported_as_slots_free_up() {
+        let mut state = KeyState::new();
+        let keys: Vec<u8> = (KEY_A..KEY_A + 8).collect();
+        for &key in &keys {
+            assert!(state.apply(key, true));
+        }
+        assert_eq!(reported_keys(&state), keys[..6]);
+        // Releasing an early key shifts the seventh into the report
+        assert!(state.apply(keys[1], false));
+        assert_eq!(
+            reported_keys(&state),
+            vec![keys[0], keys[2], keys[3], keys[4], keys[5], keys[6]]
+        );
+        // A release of a key beyond the reported six still counts
+        assert!(state.apply(keys[7], false));
+        assert_eq!(state.key_count, 6);
+    }
+
+    #[test]
+    fn presses_past_the_tracking_limit_are_ignored() {
+        let mut state = KeyState::new();
+        for key in KEY_A..KEY_A + MAX_TRACKED_KEYS as u8 {
+            assert!(state.apply(key, true));
+        }
+        assert!(!state.apply(KEY_A + MAX_TRACKED_KEYS as u8, true));
+        assert!(!state.apply(KEY_A + MAX_TRACKED_KEYS as u8, false));
+        state.clear();
+        assert!(state.is_empty());
+    }
+}
@@ -0,0 +1,1050 @@
+// Direct evdev capture backend (Linux).
+//
+// Opens /dev/input/event* keyboards and mice, takes them exclusively with
+// EVIOCGRAB and multiplexes them with epoll on one thread. Keys are forwarded
+// as HID usages; relative motion, wheel and buttons are accumulated per device
+// until SYN_REPORT and forwarded once per report, at the device rate and with
+// the kernel's CLOCK_MONOTONIC timestamp. Unlike the browser pointer lock this
+// sees raw, unaccelerated counts. Devices plugged in during a grab are picked
+// up through inotify on /dev/input; keys and buttons an unplugged device held
+// are released.
+
+use std::fs;
+use std::io;
+use std::mem;
+use std::ffi::CString;
+use std::os::unix::ffi::OsStrExt;
+use std::path::PathBuf;
+use std::sync::Mutex;
+use std::thread::{self, JoinHandle};
+
+const EV_SYN: u16 = 0x00;
+const EV_KEY: u16 = 0x01;
+const EV_REL: u16 = 0x02;
+const SYN_REPORT: u16 = 0;
+const SYN_DROPPED: u16 = 3;
+
+const REL_X: u16 = 0x00;
+const REL_Y: u16 = 0x01;
+const REL_HWHEEL: u16 = 0x06;
+const REL_WHEEL: u16 = 0x08;
+const REL_WHEEL_HI_RES: u16 = 0x0b;
+const REL_HWHEEL_HI_RES: u16 = 0x0c;
+
+const KEY_A: usize = 30;
+const KEY_Z: usize = 44;
+const BTN_LEFT: u16 = 0x110;
+const BTN_RIGHT: u16 = 0x111;
+const BTN_MIDDLE: u16 = 0x112;
+const BTN_SIDE: u16 = 0x113;
+const BTN_EXTRA: u16 = 0x114;
+const KEY_CNT: usize = 0x300;
+
+const INPUT_DIR: &str = "/dev/input";
+const STOP_TOKEN: u64 = u64::MAX;
+const WATCH_TOKEN: u64 = u64::MAX - 1;
+
+// One legacy wheel detent in REL_*_HI_RES units
+pub const WHEEL_HI_RES_PER_NOTCH: i32 = 120;
+
+const IOC_WRITE: libc::c_ulong = 1;
+const IOC_READ: libc::c_ulong = 2;
+
+const fn ioc(dir: libc::c_ulong, nr: libc::c_ulong, size: libc::c_ulong) -> libc::c_ulong {
+    (dir << 30) | (size << 16) | ((b'E' as libc::c_ulong) << 8) | nr
+}
+
+const fn eviocgbit(ev: libc::c_ulong, len: libc::c_ulong) -> libc::c_ulong {
+    ioc(IOC_READ, 0x20 + ev, len)
+}
+
+const fn eviocgname(len: libc::c_ulong) -> libc::c_ulong {
+    ioc(IOC_READ, 0x06, len)
+}
+
+const EVIOCGRAB: libc::c_ulong = ioc(IOC_WRITE, 0x90, mem::size_of::<libc::c_int>() as libc::c_ulong);
+const EVIOCSCLOCKID: libc::c_ulong =
+    ioc(IOC_WRITE, 0xa0, mem::size_of::<libc::c_int>() as libc::c_ulong);
+
+pub enum InputEvent {
+    Key {
+        usage: u32,
+        down: bool,
+        modifiers: u32,
+        time_us: u32,
+    },
+    Mouse {
+        buttons: u32,
+        dx: i32,
+        dy: i32,
+        // REL_*_HI_RES units, WHEEL_HI_RES_PER_NOTCH per detent
+        wheel: i32,
+        hwheel: i32,
+        time_us: u32,
+    },
+}
+
+#[derive(Clone, Copy)]
+pub struct Options {
+    pub keyboard: bool,
+    pub mouse: bool,
+}
+
+struct Device {
+    fd: libc::c_int,
+    path: PathBuf,
+    is_keyboard: bool,
+    is_mouse: bool,
+    // The kernel also emits legacy REL_WHEEL/REL_HWHEEL for hi-res wheels;
+    // only one of each pair may be counted.
+    hires_wheel: bool,
+    hires_hwheel: bool,
+    dx: i32,
+    dy: i32,
+    wheel: i32,
+    hwheel: i32,
+    dirty: bool,
+    // HID usages and mouse buttons this device holds down, released for it
+    // when it is unplugged mid-grab
+    keys: [u8; 32],
+    buttons: u32,
+}
+
+// Which devices a grab takes. Tests narrow it to their own uinput device.
+#[derive(Clone)]
+struct Scope {
+    options: Options,
+    name: Option<String>,
+}
+
+struct Worker {
+    stop_fd: libc::c_int,
+    thread: JoinHandle<()>,
+}
+
+static WORKER: Mutex<Option<Worker>> = Mutex::new(None);
+
+pub fn monotonic_us() -> u32 {
+    let mut ts = libc::timespec {
+        tv_sec: 0,
+        tv_nsec: 0,
+    };
+    unsafe { libc::clock_gettime(libc::CLOCK_MONOTONIC, &mut ts) };
+    (ts.tv_sec as u64 * 1_000_000 + ts.tv_nsec as u64 / 1_000) as u32
+}
+
+pub fn is_running() -> bool {
+    WORKER
+        .lock()
+        .map(|worker| worker.is_some())
+        .unwrap_or(false)
+}
+
+pub fn start<F>(options: Options, sink: F) -> io::Result<usize>
+where
+    F: FnMut(InputEvent) + Send + 'static,
+{
+    start_scoped(Scope { options, name: None }, sink)
+}
+
+fn start_scoped<F>(scope: Scope, sink: F) -> io::Result<usize>
+where
+    F: FnMut(InputEvent) + Send + 'static,
+{
+    let mut worker = WORKER.lock().unwrap_or_else(|e| e.into_inner());
+    if worker.is_some() {
+        return Ok(0);
+    }
+
+    let devices = scan(&scope, &[])?;
+    if devices.is_empty() {
+        return Err(io::Error::new(
+            io::ErrorKind::NotFound,
+            "no accessible evdev keyboard or mouse (check /dev/input permissions)",
+        ));
+    }
+
+    let epoll_fd = unsafe { libc::epoll_create1(libc::EPOLL_CLOEXEC) };
+    if epoll_fd < 0 {
+        let err = io::Error::last_os_error();
+        release_devices(&devices);
+        return Err(err);
+    }
+    let stop_fd = unsafe { libc::eventfd(0, libc::EFD_CLOEXEC | libc::EFD_NONBLOCK) };
+    if stop_fd < 0 {
+        let err = io::Error::last_os_error();
+        release_devices(&devices);
+        unsafe { libc::close(epoll_fd) };
+        return Err(err);
+    }
+
+    // epoll data: device index, STOP_TOKEN or WATCH_TOKEN
+    if let Err(err) = epoll_add(epoll_fd, stop_fd, STOP_TOKEN) {
+        release_devices(&devices);
+        unsafe {
+            libc::close(stop_fd);
+            libc::close(epoll_fd);
+        }
+        return Err(err);
+    }
+    // A device epoll refuses would stay grabbed without ever being read
+    let mut registered = Vec::with_capacity(devices.len());
+    for device in devices {
+        match epoll_add(epoll_fd, device.fd, registered.len() as u64) {
+            Ok(()) => registered.push(device),
+            Err(err) => {
+                eprintln!("evdev: cannot watch device, releasing it: {}", err);
+                release_devices(std::slice::from_ref(&device));
+            }
+        }
+    }
+    if registered.is_empty() {
+        unsafe {
+            libc::close(stop_fd);
+            libc::close(epoll_fd);
+        }
+        return Err(io::Error::other("could not watch any evdev device"));
+    }
+    let count = registered.len();
+
+    // Devices plugged in during the grab; without inotify only the initial
+    // set is grabbed
+    let watch_fd = watch_input_dir(epoll_fd).unwrap_or_else(|err| {
+        eprintln!("evdev: not watching {} for new devices: {}", INPUT_DIR, err);
+        -1
+    });
+
+    let thread = thread::spawn(move || run(epoll_fd, watch_fd, scope, registered, sink));
+    *worker = Some(Worker { stop_fd, thread });
+    Ok(count)
+}
+
+pub fn stop() {
+    let worker = WORKER.lock().unwrap_or_else(|e| e.into_inner()).take();
+    if let Some(worker) = worker {
+        let one: u64 = 1;
+        unsafe {
+            libc::write(
+                worker.stop_fd,
+                &one as *const u64 as *const libc::c_void,
+                mem::size_of::<u64>(),
+            )
+        };
+        let _ = worker.thread.join();
+        unsafe { libc::close(worker.stop_fd) };
+    }
+}
+
+fn epoll_add(epoll_fd: libc::c_int, fd: libc::c_int, data: u64) -> io::Result<()> {
+    let mut event = libc::epoll_event {
+        events: libc::EPOLLIN as u32,
+        u64: data,
+    };
+    if unsafe { libc::epoll_ctl(epoll_fd, libc::EPOLL_CTL_ADD, fd, &mut event) } < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+// udev creates the node first and fixes its permissions afterwards, so both
+// creation and attribute changes trigger a rescan
+fn watch_input_dir(epoll_fd: libc::c_int) -> io::Result<libc::c_int> {
+    let fd = unsafe { libc::inotify_init1(libc::IN_NONBLOCK | libc::IN_CLOEXEC) };
+    if fd < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    let dir = CString::new(INPUT_DIR).unwrap();
+    let added = unsafe {
+        libc::inotify_add_watch(fd, dir.as_ptr(), libc::IN_CREATE | libc::IN_ATTRIB)
+    };
+    if added < 0 {
+        let err = io::Error::last_os_error();
+        unsafe { libc::close(fd) };
+        return Err(err);
+    }
+    if let Err(err) = epoll_add(epoll_fd, fd, WATCH_TOKEN) {
+        unsafe { libc::close(fd) };
+        return Err(err);
+    }
+    Ok(fd)
+}
+
+fn test_bit(bits: &[u8], bit: usize) -> bool {
+    bits.get(bit / 8).map_or(false, |b| b & (1 << (bit % 8)) != 0)
+}
+
+fn set_bit(bits: &mut [u8], bit: usize, on: bool) {
+    if let Some(b) = bits.get_mut(bit / 8) {
+        if on {
+            *b |= 1 << (bit % 8);
+        } else {
+            *b &= !(1 << (bit % 8));
+        }
+    }
+}
+
+// Event nodes in INPUT_DIR that are not open yet, grabbed
+fn scan(scope: &Scope, open: &[Device]) -> io::Result<Vec<Device>> {
+    let mut devices = Vec::new();
+    for entry in fs::read_dir(INPUT_DIR)? {
+        let path = entry?.path();
+        let is_event_node = path
+            .file_name()
+            .map_or(false, |name| name.as_bytes().starts_with(b"event"));
+        if !is_event_node || open.iter().any(|d| d.fd >= 0 && d.path == path) {
+            continue;
+        }
+        if let Some(device) = open_device(path, scope) {
+            devices.push(device);
+        }
+    }
+    Ok(devices)
+}
+
+fn open_device(path: PathBuf, scope: &Scope) -> Option<Device> {
+    let mut c_path = path.as_os_str().as_bytes().to_vec();
+    c_path.push(0);
+    let fd = unsafe {
+        libc::open(
+            c_path.as_ptr() as *const libc::c_char,
+            libc::O_RDONLY | libc::O_NONBLOCK | libc::O_CLOEXEC,
+        )
+    };
+    if fd < 0 {
+        return None;
+    }
+
+    if let Some(wanted) = scope.name.as_deref() {
+        let mut name = [0u8; 256];
+        let len = unsafe { libc::ioctl(fd, eviocgname(name.len() as _), name.as_mut_ptr()) };
+        let name = &name[..len.max(0) as usize];
+        if name.split(|&b| b == 0).next() != Some(wanted.as_bytes()) {
+            unsafe { libc::close(fd) };
+            return None;
+        }
+    }
+
+    let mut ev_bits = [0u8; 4];
+    let mut key_bits = [0u8; KEY_CNT / 8];
+    let mut rel_bits = [0u8; 2];
+    unsafe {
+        libc::ioctl(fd, eviocgbit(0, ev_bits.len() as _), ev_bits.as_mut_ptr());
+        libc::ioctl(fd, eviocgbit(EV_KEY as _, key_bits.len() as _), key_bits.as_mut_ptr());
+        libc::ioctl(fd, eviocgbit(EV_REL as _, rel_bits.len() as _), rel_bits.as_mut_ptr());
+    }
+
+    let options = scope.options;
+    let has_keys = test_bit(&ev_bits, EV_KEY as usize);
+    let is_keyboard = options.keyboard
+        && has_keys
+        && test_bit(&key_bits, KEY_A)
+        && test_bit(&key_bits, KEY_Z);
+    let is_mouse = options.mouse
+        && test_bit(&ev_bits, EV_REL as usize)
+        && test_bit(&rel_bits, REL_X as usize)
+        && test_bit(&rel_bits, REL_Y as usize)
+        && test_bit(&key_bits, BTN_LEFT as usize);
+
+    if !is_keyboard && !is_mouse {
+        unsafe { libc::close(fd) };
+        return None;
+    }
+
+    let clock: libc::c_int = libc::CLOCK_MONOTONIC;
+    let grabbed = unsafe {
+        libc::ioctl(fd, EVIOCSCLOCKID, &clock);
+        libc::ioctl(fd, EVIOCGRAB, 1 as libc::c_int)
+    };
+    if grabbed < 0 {
+        // Somebody else holds it exclusively
+        unsafe { libc::close(fd) };
+        return None;
+    }
+
+    Some(Device {
+        fd,
+        path,
+        is_keyboard,
+        is_mouse,
+        hires_wheel: test_bit(&rel_bits, REL_WHEEL_HI_RES as usize),
+        hires_hwheel: test_bit(&rel_bits, REL_HWHEEL_HI_RES as usize),
+        dx: 0,
+        dy: 0,
+        wheel: 0,
+        hwheel: 0,
+        dirty: false,
+        keys: [0; 32],
+        buttons: 0,
+    })
+}
+
+fn release_devices(devices: &[Device]) {
+    for device in devices {
+        if device.fd >= 0 {
+            unsafe {
+                libc::ioctl(device.fd, EVIOCGRAB, 0 as libc::c_int);
+                libc::close(device.fd);
+            }
+        }
+    }
+}
+
+// Modifier bits (usages 0xE0-0xE7) held on any device
+fn modifiers_of(devices: &[Device]) -> u32 {
+    devices
+        .iter()
+        .filter(|d| d.fd >= 0)
+        .fold(0, |bits, d| bits | d.keys[0xE0 / 8] as u32)
+}
+
+fn buttons_of(devices: &[Device]) -> u32 {
+    devices
+        .iter()
+        .filter(|d| d.fd >= 0)
+        .fold(0, |bits, d| bits | d.buttons)
+}
+
+// Picks up devices plugged in since the last scan, reusing unplugged slots
+fn add_new_devices(epoll_fd: libc::c_int, watch_fd: libc::c_int, scope: &Scope, devices: &mut Vec<Device>) {
+    let mut buf = [0u8; 4096];
+    while unsafe { libc::read(watch_fd, buf.as_mut_ptr() as *mut libc::c_void, buf.len()) } > 0 {}
+
+    let found = match scan(scope, devices) {
+        Ok(found) => found,
+        Err(_) => return,
+    };
+    for device in found {
+        let index = devices.iter().position(|d| d.fd < 0).unwrap_or(devices.len());
+        if let Err(err) = epoll_add(epoll_fd, device.fd, index as u64) {
+            eprintln!("evdev: cannot watch device, releasing it: {}", err);
+            release_devices(std::slice::from_ref(&device));
+            continue;
+        }
+        if index == devices.len() {
+            devices.push(device);
+        } else {
+            devices[index] = device;
+        }
+    }
+}
+
+// An unplugged device sends no more releases, so whatever it held is
+// released here unless another device holds it too
+fn remove_device<F>(epoll_fd: libc::c_int, devices: &mut [Device], index: usize, sink: &mut F)
+where
+    F: FnMut(InputEvent),
+{
+    let device = &mut devices[index];
+    unsafe {
+        libc::epoll_ctl(epoll_fd, libc::EPOLL_CTL_DEL, device.fd, std::ptr::null_mut());
+        libc::close(device.fd);
+    }
+    device.fd = -1;
+    let keys = mem::take(&mut device.keys);
+    let held_buttons = mem::take(&mut device.buttons);
+    let time_us = monotonic_us();
+
+    for usage in 0..keys.len() * 8 {
+        if !test_bit(&keys, usage) || devices.iter().any(|d| d.fd >= 0 && test_bit(&d.keys, usage)) {
+            continue;
+        }
+        sink(InputEvent::Key {
+            usage: usage as u32,
+            down: false,
+            modifiers: modifiers_of(devices),
+            time_us,
+        });
+    }
+    if held_buttons & !buttons_of(devices) != 0 {
+        sink(InputEvent::Mouse {
+            buttons: buttons_of(devices),
+            dx: 0,
+            dy: 0,
+            wheel: 0,
+            hwheel: 0,
+            time_us,
+        });
+    }
+}
+
+fn run<F>(epoll_fd: libc::c_int, watch_fd: libc::c_int, scope: Scope, mut devices: Vec<Device>, mut sink: F)
+where
+    F: FnMut(InputEvent),
+{
+    let mut ready: [libc::epoll_event; 16] = unsafe { mem::zeroed() };
+    let mut events: [libc::input_event; 64] = unsafe { mem::zeroed() };
+
+    'outer: loop {
+        let n = unsafe { libc::epoll_wait(epoll_fd, ready.as_mut_ptr(), ready.len() as _, -1) };
+        if n < 0 {
+            if io::Error::last_os_error().kind() == io::ErrorKind::Interrupted {
+                continue;
+            }
+            break;
+        }
+
+        for slot in ready.iter().take(n as usize) {
+            let data = slot.u64;
+            if data == STOP_TOKEN {
+                break 'outer;
+            }
+            if data == WATCH_TOKEN {
+                add_new_devices(epoll_fd, watch_fd, &scope, &mut devices);
+                continue;
+            }
+            let index = data as usize;
+            if !matches!(devices.get(index), Some(d) if d.fd >= 0) {
+                continue;
+            }
+
+            let unplugged = loop {
+                let bytes = unsafe {
+                    libc::read(
+                        devices[index].fd,
+                        events.as_mut_ptr() as *mut libc::c_void,
+                        mem::size_of_val(&events),
+                    )
+                };
+                if bytes <= 0 {
+                    let err = io::Error::last_os_error();
+                    break bytes == 0 || err.raw_os_error() == Some(libc::ENODEV);
+                }
+
+                let count = bytes as usize / mem::size_of::<libc::input_event>();
+                for ev in &events[..count] {
+                    let time_us = (ev.time.tv_sec as u64 * 1_000_000 + ev.time.tv_usec as u64) as u32;
+                    let device = &mut devices[index];
+                    match (ev.type_, ev.code) {
+                        (EV_KEY, code) if ev.value != 2 => {
+                            let down = ev.value != 0;
+                            if let Some(bit) = button_bit(code) {
+                                if device.is_mouse {
+                                    device.buttons = if down { device.buttons | bit } else { device.buttons & !bit };
+                                    device.dirty = true;
+                                }
+                            } else if device.is_keyboard {
+                                let usage = evdev_to_usb_hid(code);
+                                if usage == 0 {
+                                    continue;
+                                }
+                                set_bit(&mut device.keys, usage as usize, down);
+                                sink(InputEvent::Key {
+                                    usage,
+                                    down,
+                                    modifiers: modifiers_of(&devices),
+                                    time_us,
+                                });
+                            }
+                        }
+                        (EV_REL, REL_X) => {
+                            device.dx += ev.value;
+                            device.dirty = true;
+                        }
+                        (EV_REL, REL_Y) => {
+                            device.dy += ev.value;
+                            device.dirty = true;
+                        }
+                        (EV_REL, REL_WHEEL_HI_RES) => {
+                            device.wheel += ev.value;
+                            device.dirty = true;
+                        }
+                        (EV_REL, REL_WHEEL) if !device.hires_wheel => {
+                            device.wheel += ev.value * WHEEL_HI_RES_PER_NOTCH;
+                            device.dirty = true;
+                        }
+                        (EV_REL, REL_HWHEEL_HI_RES) => {
+                            device.hwheel += ev.value;
+                            device.dirty = true;
+                        }
+                        (EV_REL, REL_HWHEEL) if !device.hires_hwheel => {
+                            device.hwheel += ev.value * WHEEL_HI_RES_PER_NOTCH;
+                            device.dirty = true;
+                        }
+                        (EV_SYN, SYN_REPORT) if device.dirty => {
+                            let (dx, dy, wheel, hwheel) = (device.dx, device.dy, device.wheel, device.hwheel);
+                            device.dx = 0;
+                            device.dy = 0;
+                            device.wheel = 0;
+                            device.hwheel = 0;
+                            device.dirty = false;
+                            sink(InputEvent::Mouse {
+                                buttons: buttons_of(&devices),
+                                dx,
+                                dy,
+                                wheel,
+                                hwheel,
+                                time_us,
+                            });
+                        }
+                        (EV_SYN, SYN_DROPPED) => {
+                            // Kernel buffer overrun; partial motion is discarded
+                            device.dx = 0;
+                            device.dy = 0;
+                            device.wheel = 0;
+                            device.hwheel = 0;
+                            device.dirty = false;
+                        }
+                        _ => {}
+                    }
+                }
+            };
+            if unplugged {
+                remove_device(epoll_fd, &mut devices, index, &mut sink);
+            }
+        }
+    }
+
+    release_devices(&devices);
+    unsafe {
+        if watch_fd >= 0 {
+            libc::close(watch_fd);
+        }
+        libc::close(epoll_fd);
+    }
+}
+
+fn button_bit(code: u16) -> Option<u32> {
+    // Same bit layout as HIDManager.getMouseButtonCode
+    match code {
+        BTN_LEFT => Some(0x01),
+        BTN_RIGHT => Some(0x02),
+        BTN_MIDDLE => Some(0x04),
+        BTN_SIDE => Some(0x08),
+        BTN_EXTRA => Some(0x10),
+        _ => None,
+    }
+}
+
+fn evdev_to_usb_hid(code: u16) -> u32 {
+    // Linux input-event-codes.h KEY_* to USB HID Usage IDs (Keyboard/Keypad Page 0x07)
+    match code {
+        1 => 0x29,  // ESC
+        2 => 0x1E,  // 1
+        3 => 0x1F,  // 2
+        4 => 0x20,  // 3
+        5 => 0x21,  // 4
+        6 => 0x22,  // 5
+        7 => 0x23,  // 6
+        8 => 0x24,  // 7
+        9 => 0x25,  // 8
+        10 => 0x26, // 9
+        11 => 0x27, // 0
+        12 => 0x2D, // MINUS
+        13 => 0x2E, // EQUAL
+        14 => 0x2A, // BACKSPACE
+        15 => 0x2B, // TAB
+        16 => 0x14, // Q
+        17 => 0x1A, // W
+        18 => 0x08, // E
+        19 => 0x15, // R
+        20 => 0x17, // T
+        21 => 0x1C, // Y
+        22 => 0x18, // U
+        23 => 0x0C, // I
+        24 => 0x12, // O
+        25 => 0x13, // P
+        26 => 0x2F, // LEFTBRACE
+        27 => 0x30, // RIGHTBRACE
+        28 => 0x28, // ENTER
+        29 => 0xE0, // LEFTCTRL
+        30 => 0x04, // A
+        31 => 0x16, // S
+        32 => 0x07, // D
+        33 => 0x09, // F
+        34 => 0x0A, // G
+        35 => 0x0B, // H
+        36 => 0x0D, // J
+        37 => 0x0E, // K
+        38 => 0x0F, // L
+        39 => 0x33, // SEMICOLON
+        40 => 0x34, // APOSTROPHE
+        41 => 0x35, // GRAVE
+        42 => 0xE1, // LEFTSHIFT
+        43 => 0x31, // BACKSLASH
+        44 => 0x1D, // Z
+        45 => 0x1B, // X
+        46 => 0x06, // C
+        47 => 0x19, // V
+        48 => 0x05, // B
+        49 => 0x11, // N
+        50 => 0x10, // M
+        51 => 0x36, // COMMA
+        52 => 0x37, // DOT
+        53 => 0x38, // SLASH
+        54 => 0xE5, // RIGHTSHIFT
+        55 => 0x55, // KPASTERISK
+        56 => 0xE2, // LEFTALT
+        57 => 0x2C, // SPACE
+        58 => 0x39, // CAPSLOCK
+        59..=68 => 0x3A + (code as u32 - 59), // F1-F10
+        69 => 0x53, // NUMLOCK
+        70 => 0x47, // SCROLLLOCK
+        71 => 0x5F, // KP7
+        72 => 0x60, // KP8
+        73 => 0x61, // KP9
+        74 => 0x56, // KPMINUS
+        75 => 0x5C, // KP4
+        76 => 0x5D, // KP5
+        77 => 0x5E, // KP6
+        78 => 0x57, // KPPLUS
+        79 => 0x59, // KP1
+        80 => 0x5A, // KP2
+        81 => 0x5B, // KP3
+        82 => 0x62, // KP0
+        83 => 0x63, // KPDOT
+        85 => 0x94, // ZENKAKUHANKAKU
+        86 => 0x64, // 102ND
+        87 => 0x44, // F11
+        88 => 0x45, // F12
+        89 => 0x87, // RO
+        90 => 0x92, // KATAKANA
+        91 => 0x93, // HIRAGANA
+        92 => 0x8A, // HENKAN
+        93 => 0x88, // KATAKANAHIRAGANA
+        94 => 0x8B, // MUHENKAN
+        95 => 0x8C, // KPJPCOMMA
+        96 => 0x58, // KPENTER
+        97 => 0xE4, // RIGHTCTRL
+        98 => 0x54, // KPSLASH
+        99 => 0x46, // SYSRQ
+        100 => 0xE6, // RIGHTALT
+        102 => 0x4A, // HOME
+        103 => 0x52, // UP
+        104 => 0x4B, // PAGEUP
+        105 => 0x50, // LEFT
+        106 => 0x4F, // RIGHT
+        107 => 0x4D, // END
+        108 => 0x51, // DOWN
+        109 => 0x4E, // PAGEDOWN
+        110 => 0x49, // INSERT
+        111 => 0x4C, // DELETE
+        113 => 0x7F, // MUTE
+        114 => 0x81, // VOLUMEDOWN
+        115 => 0x80, // VOLUMEUP
+        116 => 0x66, // POWER
+        117 => 0x67, // KPEQUAL
+        119 => 0x48, // PAUSE
+        121 => 0x85, // KPCOMMA
+        122 => 0x90, // HANGEUL
+        123 => 0x91, // HANJA
+        124 => 0x89, // YEN
+        125 => 0xE3, // LEFTMETA
+        126 => 0xE7, // RIGHTMETA
+        127 => 0x65, // COMPOSE
+        183..=194 => 0x68 + (code as u32 - 183), // F13-F24
+        _ => 0x00,
+    }
+}
+
+// These drive the grab path with virtual devices and need write access to
+// /dev/uinput (root, or the uinput group); without it they pass as skipped.
+// They only grab devices named after the test, never real input devices.
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::mpsc::{channel, Receiver};
+    use std::time::Duration;
+
+    const UI_DEV_CREATE: libc::c_ulong = ui_ioc(0, 1, 0);
+    const UI_DEV_DESTROY: libc::c_ulong = ui_ioc(0, 2, 0);
+    // struct uinput_setup: input_id (8) + name[80] + ff_effects_max (4)
+    const UI_DEV_SETUP: libc::c_ulong = ui_ioc(IOC_WRITE, 3, 92);
+    const UI_SET_EVBIT: libc::c_ulong = ui_ioc(IOC_WRITE, 100, 4);
+    const UI_SET_KEYBIT: libc::c_ulong = ui_ioc(IOC_WRITE, 101, 4);
+    const UI_SET_RELBIT: libc::c_ulong = ui_ioc(IOC_WRITE, 102, 4);
+    const SYSNAME_LEN: usize = 32;
+    const UI_GET_SYSNAME: libc::c_ulong = ui_ioc(IOC_READ, 44, SYSNAME_LEN as libc::c_ulong);
+
+    const KEY_LEFTSHIFT: u16 = 42;
+
+    // The worker is global, so tests take turns
+    static SERIAL: Mutex<()> = Mutex::new(());
+
+    const fn ui_ioc(dir: libc::c_ulong, nr: libc::c_ulong, size: libc::c_ulong) -> libc::c_ulong {
+        (dir << 30) | (size << 16) | ((b'U' as libc::c_ulong) << 8) | nr
+    }
+
+    #[repr(C)]
+    struct UinputSetup {
+        bustype: u16,
+        vendor: u16,
+        product: u16,
+        version: u16,
+        name: [u8; 80],
+        ff_effects_max: u32,
+    }
+
+    struct Uinput {
+        fd: libc::c_int,
+    }
+
+    impl Uinput {
+        fn keyboard(name: &str) -> Option<Uinput> {
+            let dev = Uinput::open()?;
+            dev.set(UI_SET_EVBIT, EV_KEY);
+            for code in 1..=127 {
+                dev.set(UI_SET_KEYBIT, code);
+            }
+            dev.create(name)
+        }
+
+        fn mouse(name: &str) -> Option<Uinput> {
+            let dev = Uinput::open()?;
+            dev.set(UI_SET_EVBIT, EV_KEY);
+            dev.set(UI_SET_EVBIT, EV_REL);
+            for code in BTN_LEFT..=BTN_EXTRA {
+                dev.set(UI_SET_KEYBIT, code);
+            }
+            dev.set(UI_SET_RELBIT, REL_X);
+            dev.set(UI_SET_RELBIT, REL_Y);
+            dev.set(UI_SET_RELBIT, REL_WHEEL);
+            dev.create(name)
+        }
+
+        fn open() -> Option<Uinput> {
+            let fd = unsafe {
+                libc::open(
+                    c"/dev/uinput".as_ptr(),
+                    libc::O_WRONLY | libc::O_NONBLOCK | libc::O_CLOEXEC,
+                )
+            };
+            if fd < 0 {
+                eprintln!("skipped: /dev/uinput not writable ({})", io::Error::last_os_error());
+                return None;
+            }
+            Some(Uinput { fd })
+        }
+
+        fn set(&self, request: libc::c_ulong, code: u16) {
+            unsafe { libc::ioctl(self.fd, request, code as libc::c_int) };
+        }
+
+        fn create(self, name: &str) -> Option<Uinput> {
+            let mut setup = UinputSetup {
+                bustype: 0x03, // BUS_USB
+                vendor: 0x1234,
+                product: 0x5678,
+                version: 1,
+                name: [0; 80],
+                ff_effects_max: 0,
+            };
+            setup.name[..name.len()].copy_from_slice(name.as_bytes());
+            let ok = unsafe {
+                libc::ioctl(self.fd, UI_DEV_SETUP, &setup) >= 0 && libc::ioctl(self.fd, UI_DEV_CREATE) >= 0
+            };
+            if !ok {
+                eprintln!("skipped: cannot create uinput device ({})", io::Error::last_os_error());
+                return None;
+            }
+            Some(self)
+        }
+
+        fn emit(&self, type_: u16, code: u16, value: i32) {
+            let mut ev: libc::input_event = unsafe { mem::zeroed() };
+            ev.type_ = type_;
+            ev.code = code;
+            ev.value = value;
+            let written = unsafe {
+                libc::write(
+                    self.fd,
+                    &ev as *const libc::input_event as *const libc::c_void,
+                    mem::size_of::<libc::input_event>(),
+                )
+            };
+            assert_eq!(written as usize, mem::size_of::<libc::input_event>());
+        }
+
+        fn key(&self, code: u16, down: bool) {
+            self.emit(EV_KEY, code, down as i32);
+            self.emit(EV_SYN, SYN_REPORT, 0);
+        }
+
+        // /dev/input/eventN of this device, once sysfs lists it
+        fn event_node(&self) -> Option<PathBuf> {
+            let mut sysname = [0u8; SYSNAME_LEN];
+            if unsafe { libc::ioctl(self.fd, UI_GET_SYSNAME, sysname.as_mut_ptr()) } < 0 {
+                return None;
+            }
+            let len = sysname.iter().position(|&b| b == 0).unwrap_or(SYSNAME_LEN);
+            let sysname = std::str::from_utf8(&sysname[..len]).ok()?;
+            fs::read_dir(format!("/sys/class/input/{}", sysname))
+                .ok()?
+                .filter_map(|entry| entry.ok())
+                .find(|entry| entry.file_name().as_bytes().starts_with(b"event"))
+                .map(|entry| PathBuf::from(INPUT_DIR).join(entry.file_name()))
+        }
+    }
+
+    impl Drop for Uinput {
+        fn drop(&mut self) {
+            unsafe {
+                libc::ioctl(self.fd, UI_DEV_DESTROY);
+                libc::close(self.fd);
+            }
+        }
+    }
+
+    fn test_name(test: &str) -> String {
+        format!("rdev-grabber {} {}", test, std::process::id())
+    }
+
+    // udev may publish the node a little after UI_DEV_CREATE
+    fn start_for(name: &str) -> Receiver<InputEvent> {
+        let (tx, rx) = channel();
+        for _ in 0..50 {
+            let scope = Scope {
+                options: Options {
+                    keyboard: true,
+                    mouse: true,
+                },
+                name: Some(name.to_string()),
+            };
+            let tx = tx.clone();
+            if start_scoped(scope, move |event| {
+                let _ = tx.send(event);
+            })
+            .is_ok()
+            {
+                return rx;
+            }
+            thread::sleep(Duration::from_millis(20));
+        }
+        panic!("uinput device {:?} was not grabbed", name);
+    }
+
+    // Polls until the grab thread holds `dev` exclusively, i.e. our own
+    // EVIOCGRAB on its node fails with EBUSY. Should the probe win the race
+    // against the rescan, it lets go and touches the node so the worker
+    // rescans. Keys sent before this returns would reach the desktop.
+    fn wait_for_grab(dev: &Uinput) -> bool {
+        for _ in 0..100 {
+            thread::sleep(Duration::from_millis(20));
+            let Some(node) = dev.event_node() else { continue };
+            let c_node = CString::new(node.as_os_str().as_bytes()).unwrap();
+            let fd = unsafe { libc::open(c_node.as_ptr(), libc::O_RDONLY | libc::O_CLOEXEC) };
+            if fd < 0 {
+                continue;
+            }
+            let busy = unsafe { libc::ioctl(fd, EVIOCGRAB, 1 as libc::c_int) } < 0
+                && io::Error::last_os_error().raw_os_error() == Some(libc::EBUSY);
+            unsafe {
+                if !busy {
+                    libc::ioctl(fd, EVIOCGRAB, 0 as libc::c_int);
+                }
+                libc::close(fd);
+                if !busy {
+                    libc::utimensat(libc::AT_FDCWD, c_node.as_ptr(), std::ptr::null(), 0);
+                }
+            }
+            if busy {
+                return true;
+            }
+        }
+        false
+    }
+
+    fn next(rx: &Receiver<InputEvent>) -> InputEvent {
+        rx.recv_timeout(Duration::from_secs(2))
+            .expect("no event from the grab thread")
+    }
+
+    fn expect_key(rx: &Receiver<InputEvent>, usage: u32, down: bool) {
+        match next(rx) {
+            InputEvent::Key { usage: u, down: d, .. } => assert_eq!((u, d), (usage, down)),
+            InputEvent::Mouse { .. } => panic!("mouse record instead of key 0x{:02x}", usage),
+        }
+    }
+
+    fn expect_buttons(rx: &Receiver<InputEvent>, buttons: u32) {
+        match next(rx) {
+            InputEvent::Mouse { buttons: b, .. } => assert_eq!(b, buttons),
+            InputEvent::Key { usage, .. } => panic!("key 0x{:02x} instead of a mouse record", usage),
+        }
+    }
+
+    // Stops the worker even when an assertion fails
+    struct Grab;
+
+    impl Drop for Grab {
+        fn drop(&mut self) {
+            stop();
+        }
+    }
+
+    #[test]
+    fn grabbed_keyboard_delivers_keys() {
+        let _serial = SERIAL.lock().unwrap_or_else(|e| e.into_inner());
+        let name = test_name("keys");
+        let Some(kbd) = Uinput::keyboard(&name) else { return };
+        let rx = start_for(&name);
+        let _grab = Grab;
+
+        kbd.key(KEY_LEFTSHIFT, true);
+        kbd.key(KEY_A as u16, true);
+        match next(&rx) {
+            InputEvent::Key { usage, down, modifiers, .. } => {
+                assert_eq!((usage, down), (0xE1, true));
+                assert_eq!(modifiers, 0x02);
+            }
+            InputEvent::Mouse { .. } => panic!("mouse record from a keyboard"),
+        }
+        expect_key(&rx, 0x04, true);
+        kbd.key(KEY_A as u16, false);
+        expect_key(&rx, 0x04, false);
+        kbd.key(KEY_LEFTSHIFT, false);
+        expect_key(&rx, 0xE1, false);
+    }
+
+    #[test]
+    fn unplugged_keyboard_releases_held_keys() {
+        let _serial = SERIAL.lock().unwrap_or_else(|e| e.into_inner());
+        let name = test_name("unplug");
+        let Some(kbd) = Uinput::keyboard(&name) else { return };
+        let rx = start_for(&name);
+        let _grab = Grab;
+
+        kbd.key(KEY_LEFTSHIFT, true);
+        kbd.key(KEY_A as u16, true);
+        expect_key(&rx, 0xE1, true);
+        expect_key(&rx, 0x04, true);
+        drop(kbd);
+        expect_key(&rx, 0x04, false);
+        expect_key(&rx, 0xE1, false);
+    }
+
+    #[test]
+    fn unplugged_mouse_releases_held_buttons() {
+        let _serial = SERIAL.lock().unwrap_or_else(|e| e.into_inner());
+        let name = test_name("mouse");
+        let Some(mouse) = Uinput::mouse(&name) else { return };
+        let rx = start_for(&name);
+        let _grab = Grab;
+
+        mouse.emit(EV_REL, REL_X, 5);
+        mouse.emit(EV_KEY, BTN_LEFT, 1);
+        mouse.emit(EV_SYN, SYN_REPORT, 0);
+        match next(&rx) {
+            InputEvent::Mouse { buttons, dx, .. } => assert_eq!((buttons, dx), (0x01, 5)),
+            InputEvent::Key { .. } => panic!("key from a mouse"),
+        }
+        drop(mouse);
+        expect_buttons(&rx, 0);
+    }
+
+    #[test]
+    fn keyboard_plugged_in_during_grab_is_grabbed() {
+        let _serial = SERIAL.lock().unwrap_or_else(|e| e.into_inner());
+        let name = test_name("hotplug");
+        let Some(first) = Uinput::keyboard(&name) else { return };
+        let rx = start_for(&name);
+        let _grab = Grab;
+
+        let Some(second) = Uinput::keyboard(&name) else { return };
+        assert!(wait_for_grab(&second), "device added during the grab was not picked up");
+        second.key(KEY_Z as u16, true);
+        expect_key(&rx, 0x1D, true);
+        second.key(KEY_Z as u16, false);
+        expect_key(&rx, 0x1D, false);
+        drop(first);
+    }
+}
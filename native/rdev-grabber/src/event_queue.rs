@@ -0,0 +1,119 @@
+// Bounded batch queue between a capture thread and the JS thread.
+//
+// Producers append fixed-size records to a preallocated buffer; only the
+// first push after a drain asks the caller to schedule a TSFN call, and that
+// call drains everything accumulated up to that point into one batch.
+
+use std::sync::atomic::{AtomicBool, AtomicU32, Ordering};
+use std::sync::Mutex;
+
+pub struct EventQueue {
+    pending: Mutex<Vec<u32>>,
+    flush_queued: AtomicBool,
+    dropped: AtomicU32,
+    capacity_words: usize,
+}
+
+impl EventQueue {
+    pub const fn new(capacity_words: usize) -> Self {
+        Self {
+            pending: Mutex::new(Vec::new()),
+            flush_queued: AtomicBool::new(false),
+            dropped: AtomicU32::new(0),
+            capacity_words,
+        }
+    }
+
+    /// Clears stale state and preallocates so pushes never allocate.
+    pub fn reset(&self) {
+        let mut pending = self.pending.lock().unwrap_or_else(|e| e.into_inner());
+        pending.clear();
+        pending.reserve(self.capacity_words);
+        self.flush_queued.store(false, Ordering::SeqCst);
+    }
+
+    /// Appends one record. Returns true when the caller must schedule a
+    /// flush (no drain is pending yet). A full queue drops the record unless
+    /// `release` is set: key and button releases are always kept, since a
+    /// lost one leaves the input stuck on the target. They are bounded by
+    /// the presses before them, so the overflow stays small.
+    pub fn push(&self, record: &[u32], release: bool) -> bool {
+        {
+            let mut pending = self.pending.lock().unwrap_or_else(|e| e.into_inner());
+            if !release && pending.len() + record.len() > self.capacity_words {
+                // JS is not draining; drop rather than grow without bound
+                self.dropped.fetch_add(1, Ordering::Relaxed);
+                return false;
+            }
+            pending.extend_from_slice(record);
+        }
+        !self.flush_queued.swap(true, Ordering::SeqCst)
+    }
+
+    /// Called when scheduling the flush failed, so the next push retries.
+    pub fn flush_failed(&self) {
+        self.flush_queued.store(false, Ordering::SeqCst);
+    }
+
+    /// Takes every pending record. Runs on the JS thread.
+    pub fn drain(&self) -> Vec<u32> {
+        // Clear the flag before draining so a record pushed meanwhile queues a new call
+        self.flush_queued.store(false, Ordering::SeqCst);
+        let mut pending = self.pending.lock().unwrap_or_else(|e| e.into_inner());
+        std::mem::replace(&mut *pending, Vec::with_capacity(self.capacity_words))
+    }
+
+    pub fn dropped(&self) -> u32 {
+        self.dropped.load(Ordering::Relaxed)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn first_push_after_drain_schedules_one_flush() {
+        let queue = EventQueue::new(8);
+        queue.reset();
+        assert!(queue.push(&[1, 2], false));
+        assert!(!queue.push(&[3, 4], false));
+        assert_eq!(queue.drain(), vec![1, 2, 3, 4]);
+        assert!(queue.push(&[5, 6], false));
+    }
+
+    #[test]
+    fn full_queue_drops_and_counts_presses() {
+        let queue = EventQueue::new(4);
+        queue.reset();
+        queue.push(&[1, 2], false);
+        queue.push(&[3, 4], false);
+        queue.push(&[5, 6], false);
+        queue.push(&[7, 8], false);
+        assert_eq!(queue.dropped(), 2);
+        assert_eq!(queue.drain(), vec![1, 2, 3, 4]);
+        // The count is cumulative, drains do not reset it
+        assert_eq!(queue.dropped(), 2);
+    }
+
+    #[test]
+    fn full_queue_keeps_releases() {
+        let queue = EventQueue::new(4);
+        queue.reset();
+        queue.push(&[1, 2], false);
+        queue.push(&[3, 4], false);
+        queue.push(&[5, 6], true);
+        queue.push(&[7, 8], false);
+        assert_eq!(queue.dropped(), 1);
+        assert_eq!(queue.drain(), vec![1, 2, 3, 4, 5, 6]);
+    }
+
+    #[test]
+    fn failed_flush_lets_the_next_push_retry() {
+        let queue = EventQueue::new(8);
+        queue.reset();
+        assert!(queue.push(&[1], false));
+        queue.flush_failed();
+        assert!(queue.push(&[2], false));
+    }
+}
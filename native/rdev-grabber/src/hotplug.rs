@@ -0,0 +1,266 @@
+// hidraw hotplug notifications (Linux).
+//
+// Listens on the udev netlink group for hidraw add/remove uevents and reports
+// only those belonging to one VID/PID, so the app can enumerate and reconnect
+// the moment the controller appears instead of polling HID.devices().
+// The udev group (rather than the raw kernel group) is used because udev
+// re-broadcasts an event only after its rules ran, i.e. once the hidraw node
+// has the permissions from 99-hidraw-permissions.rules and can be opened.
+
+use std::io;
+use std::mem;
+use std::sync::Mutex;
+use std::thread::{self, JoinHandle};
+
+const UDEV_MONITOR_GROUP: u32 = 2;
+const UDEV_PREFIX: &[u8] = b"libudev\0";
+
+pub struct HotplugEvent {
+    // "add" or "remove"
+    pub action: String,
+    // Device node, e.g. /dev/hidraw3
+    pub devnode: String,
+}
+
+struct Worker {
+    stop_fd: libc::c_int,
+    thread: JoinHandle<()>,
+}
+
+static WORKER: Mutex<Option<Worker>> = Mutex::new(None);
+
+pub fn start<F>(vendor_id: u16, product_id: u16, sink: F) -> io::Result<()>
+where
+    F: FnMut(HotplugEvent) + Send + 'static,
+{
+    let mut worker = WORKER.lock().unwrap_or_else(|e| e.into_inner());
+    if worker.is_some() {
+        return Ok(());
+    }
+
+    let sock = unsafe {
+        libc::socket(
+            libc::AF_NETLINK,
+            libc::SOCK_DGRAM | libc::SOCK_CLOEXEC,
+            libc::NETLINK_KOBJECT_UEVENT,
+        )
+    };
+    if sock < 0 {
+        return Err(io::Error::last_os_error());
+    }
+
+    let mut addr: libc::sockaddr_nl = unsafe { mem::zeroed() };
+    addr.nl_family = libc::AF_NETLINK as libc::sa_family_t;
+    addr.nl_groups = UDEV_MONITOR_GROUP;
+    let bound = unsafe {
+        libc::bind(
+            sock,
+            &addr as *const libc::sockaddr_nl as *const libc::sockaddr,
+            mem::size_of::<libc::sockaddr_nl>() as libc::socklen_t,
+        )
+    };
+    if bound < 0 {
+        let err = io::Error::last_os_error();
+        unsafe { libc::close(sock) };
+        return Err(err);
+    }
+
+    let stop_fd = unsafe { libc::eventfd(0, libc::EFD_CLOEXEC | libc::EFD_NONBLOCK) };
+    if stop_fd < 0 {
+        let err = io::Error::last_os_error();
+        unsafe { libc::close(sock) };
+        return Err(err);
+    }
+
+    // hidraw uevents carry the HID id in DEVPATH: .../0003:413D:2107.0004/hidraw/hidraw3
+    let id_tag = format!(":{:04X}:{:04X}.", vendor_id, product_id);
+    let thread = thread::spawn(move || run(sock, stop_fd, &id_tag, sink));
+    *worker = Some(Worker { stop_fd, thread });
+    Ok(())
+}
+
+pub fn stop() {
+    let worker = WORKER.lock().unwrap_or_else(|e| e.into_inner()).take();
+    if let Some(worker) = worker {
+        let one: u64 = 1;
+        unsafe {
+            libc::write(
+                worker.stop_fd,
+                &one as *const u64 as *const libc::c_void,
+                mem::size_of::<u64>(),
+            )
+        };
+        let _ = worker.thread.join();
+        unsafe { libc::close(worker.stop_fd) };
+    }
+}
+
+fn run<F>(sock: libc::c_int, stop_fd: libc::c_int, id_tag: &str, mut sink: F)
+where
+    F: FnMut(HotplugEvent),
+{
+    let mut buf = vec![0u8; 8192];
+    let mut fds = [
+        libc::pollfd {
+            fd: sock,
+            events: libc::POLLIN,
+            revents: 0,
+        },
+        libc::pollfd {
+            fd: stop_fd,
+            events: libc::POLLIN,
+            revents: 0,
+        },
+    ];
+
+    loop {
+        let n = unsafe { libc::poll(fds.as_mut_ptr(), fds.len() as libc::nfds_t, -1) };
+        if n < 0 {
+            if io::Error::last_os_error().kind() == io::ErrorKind::Interrupted {
+                continue;
+            }
+            break;
+        }
+        if fds[1].revents != 0 {
+            break;
+        }
+        if fds[0].revents == 0 {
+            continue;
+        }
+
+        let len = unsafe { libc::recv(sock, buf.as_mut_ptr() as *mut libc::c_void, buf.len(), 0) };
+        if len <= 0 {
+            continue;
+        }
+        if let Some(event) = parse_uevent(&buf[..len as usize], id_tag) {
+            sink(event);
+        }
+    }
+
+    unsafe { libc::close(sock) };
+}
+
+fn parse_uevent(msg: &[u8], id_tag: &str) -> Option<HotplugEvent> {
+    let props = if msg.starts_with(UDEV_PREFIX) {
+        // struct udev_monitor_netlink_header: prefix[8], magic, header_size,
+        // properties_off, properties_len, ... (host byte order after magic)
+        let field = |at: usize| -> Option<usize> {
+            let bytes = msg.get(at..at + 4)?;
+            Some(u32::from_ne_bytes([bytes[0], bytes[1], bytes[2], bytes[3]]) as usize)
+        };
+        let off = field(16)?;
+        let len = field(20)?;
+        msg.get(off..off.checked_add(len)?)?
+    } else {
+        // Raw kernel format: "action@devpath\0KEY=VALUE\0..."
+        let header_end = msg.iter().position(|&b| b == 0)?;
+        &msg[header_end + 1..]
+    };
+
+    let mut action = None;
+    let mut subsystem = None;
+    let mut devpath = None;
+    let mut devname = None;
+    for entry in props.split(|&b| b == 0) {
+        let entry = match std::str::from_utf8(entry) {
+            Ok(entry) => entry,
+            Err(_) => continue,
+        };
+        if let Some((key, value)) = entry.split_once('=') {
+            match key {
+                "ACTION" => action = Some(value),
+                "SUBSYSTEM" => subsystem = Some(value),
+                "DEVPATH" => devpath = Some(value),
+                "DEVNAME" => devname = Some(value),
+                _ => {}
+            }
+        }
+    }
+
+    if subsystem != Some("hidraw") || !devpath?.contains(id_tag) {
+        return None;
+    }
+    let action = action?;
+    if action != "add" && action != "remove" {
+        return None;
+    }
+    let devname = devname.unwrap_or("");
+    Some(HotplugEvent {
+        action: action.to_string(),
+        devnode: if devname.starts_with('/') {
+            devname.to_string()
+        } else {
+            format!("/dev/{}", devname)
+        },
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const ID_TAG: &str = ":413D:2107.";
+    const DEVPATH: &str =
+        "/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/0003:413D:2107.0004/hidraw/hidraw3";
+
+    fn props(action: &str, subsystem: &str, devpath: &str, devname: &str) -> Vec<u8> {
+        format!(
+            "ACTION={}\0DEVPATH={}\0SUBSYSTEM={}\0DEVNAME={}\0SEQNUM=4242\0",
+            action, devpath, subsystem, devname
+        )
+        .into_bytes()
+    }
+
+    fn kernel_msg(action: &str, subsystem: &str, devpath: &str, devname: &str) -> Vec<u8> {
+        let mut msg = format!("{}@{}\0", action, devpath).into_bytes();
+        msg.extend(props(action, subsystem, devpath, devname));
+        msg
+    }
+
+    fn udev_msg(action: &str, subsystem: &str, devpath: &str, devname: &str) -> Vec<u8> {
+        let body = props(action, subsystem, devpath, devname);
+        let header_len = 40;
+        let mut msg = Vec::from(UDEV_PREFIX);
+        msg.extend(0xfeedcafeu32.to_be_bytes());
+        msg.extend((header_len as u32).to_ne_bytes());
+        msg.extend((header_len as u32).to_ne_bytes());
+        msg.extend((body.len() as u32).to_ne_bytes());
+        msg.resize(header_len, 0);
+        msg.extend(body);
+        msg
+    }
+
+    #[test]
+    fn kernel_add_for_the_controller_is_reported() {
+        let msg = kernel_msg("add", "hidraw", DEVPATH, "hidraw3");
+        let event = parse_uevent(&msg, ID_TAG).expect("event");
+        assert_eq!(event.action, "add");
+        assert_eq!(event.devnode, "/dev/hidraw3");
+    }
+
+    #[test]
+    fn udev_remove_reads_properties_from_the_header_offset() {
+        let msg = udev_msg("remove", "hidraw", DEVPATH, "/dev/hidraw3");
+        let event = parse_uevent(&msg, ID_TAG).expect("event");
+        assert_eq!(event.action, "remove");
+        assert_eq!(event.devnode, "/dev/hidraw3");
+    }
+
+    #[test]
+    fn other_devices_subsystems_and_actions_are_ignored() {
+        let other = DEVPATH.replace("413D:2107", "046D:C52B");
+        assert!(parse_uevent(&kernel_msg("add", "hidraw", &other, "hidraw3"), ID_TAG).is_none());
+        assert!(parse_uevent(&kernel_msg("add", "hid", DEVPATH, ""), ID_TAG).is_none());
+        assert!(
+            parse_uevent(&kernel_msg("change", "hidraw", DEVPATH, "hidraw3"), ID_TAG).is_none()
+        );
+    }
+
+    #[test]
+    fn truncated_messages_are_rejected() {
+        let msg = udev_msg("add", "hidraw", DEVPATH, "hidraw3");
+        assert!(parse_uevent(&msg[..20], ID_TAG).is_none());
+        assert!(parse_uevent(&msg[..msg.len() - 1], ID_TAG).is_none());
+        assert!(parse_uevent(b"add@/devices/no-terminator", ID_TAG).is_none());
+    }
+}
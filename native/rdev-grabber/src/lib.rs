@@ -1,7 +1,9 @@
 #![deny(clippy::all)]
 
 use napi::bindgen_prelude::*;
-use napi::threadsafe_function::{ErrorStrategy, ThreadsafeFunction, ThreadsafeFunctionCallMode};
+use napi::threadsafe_function::{
+    ErrorStrategy, ThreadSafeCallContext, ThreadsafeFunction, ThreadsafeFunctionCallMode,
+};
 use napi_derive::napi;
 use rdev::{Event, EventType, Key};
 #[cfg(any(target_os = "windows", target_os = "macos"))]
@@ -13,7 +15,24 @@ use rdev::set_is_main_thread;
 #[cfg(target_os = "windows")]
 use rdev::set_event_popup;
 use std::sync::atomic::{AtomicBool, Ordering};
+#[cfg(target_os = "linux")]
+use std::sync::atomic::AtomicU32;
+#[cfg(target_os = "linux")]
+use std::sync::Mutex;
+#[cfg(not(target_os = "linux"))]
+use std::sync::OnceLock;
 use std::thread;
+#[cfg(not(target_os = "linux"))]
+use std::time::Instant;
+
+mod direct_hid;
+mod event_queue;
+#[cfg(target_os = "linux")]
+mod evdev;
+#[cfg(target_os = "linux")]
+mod hotplug;
+
+use event_queue::EventQueue;
 
 static RUNNING: AtomicBool = AtomicBool::new(false);
 static KEYBOARD_HOOKED: AtomicBool = AtomicBool::new(false);
@@ -31,19 +50,48 @@ static IS_ALT_GR_DOWN: AtomicBool = AtomicBool::new(false);
 #[cfg(target_os = "macos")]
 static IS_LEFT_OPTION_DOWN: AtomicBool = AtomicBool::new(false);
 
-#[napi(object)]
-pub struct KeyEvent {
-    pub key: String,
-    pub code: String,
-    pub event_type: String,
-    pub ctrl: bool,
-    pub alt: bool,
-    pub shift: bool,
-    pub meta: bool,
-    pub platform_code: u32,
-    pub scan_code: u32,
-    pub usb_hid: u32,
-}
+// Packed key event ABI. Each event is two u32 words delivered to JS in a
+// Uint32Array batch:
+//   word 0: HID usage (bits 0-15) | modifier mask (bits 16-23) | flags (bits 24-31)
+//   word 1: grab timestamp in microseconds (see now_us), wrapping
+const EVENT_WORDS: usize = 2;
+const MAX_PENDING_EVENTS: usize = 256;
+
+const FLAG_DOWN: u32 = 0x01;
+// Already written to the controller by the native direct HID path
+const FLAG_HANDLED: u32 = 0x02;
+
+// Modifier mask uses the left-hand HID modifier bits
+const MOD_CTRL: u32 = 0x01;
+const MOD_SHIFT: u32 = 0x02;
+const MOD_ALT: u32 = 0x04;
+const MOD_META: u32 = 0x08;
+
+// Packed evdev record ABI (Linux backend). Each record is four u32 words:
+//   word 0: HID usage or mouse button mask (bits 0-15) | modifier mask (bits 16-23) | flags (bits 24-31)
+//   word 1: kernel event timestamp in microseconds (CLOCK_MONOTONIC, see now_us), wrapping
+//   word 2: dx (i16, bits 0-15) | dy (i16, bits 16-31)
+//   word 3: wheel (i16) | hwheel (i16) << 16, in 1/120 detent units
+#[cfg(target_os = "linux")]
+const EVDEV_RECORD_WORDS: usize = 4;
+// Mice report at 1000 Hz or more, so allow more headroom than for keys
+#[cfg(target_os = "linux")]
+const MAX_PENDING_EVDEV_RECORDS: usize = 1024;
+#[cfg(target_os = "linux")]
+const FLAG_MOUSE: u32 = 0x04;
+
+type GrabTsfn = ThreadsafeFunction<(), ErrorStrategy::Fatal>;
+
+// Events waiting for the JS thread; at most one TSFN call is queued at a time
+// and it drains everything accumulated up to that point.
+static KEY_QUEUE: EventQueue = EventQueue::new(MAX_PENDING_EVENTS * EVENT_WORDS);
+#[cfg(target_os = "linux")]
+static EVDEV_QUEUE: EventQueue = EventQueue::new(MAX_PENDING_EVDEV_RECORDS * EVDEV_RECORD_WORDS);
+// Button mask of the last evdev mouse record, to spot releases
+#[cfg(target_os = "linux")]
+static EVDEV_BUTTONS: AtomicU32 = AtomicU32::new(0);
+#[cfg(not(target_os = "linux"))]
+static EPOCH: OnceLock<Instant> = OnceLock::new();
 
 #[napi(js_name = "start_grab")]
 pub fn start_grab(callback: JsFunction) -> Result<()> {
@@ -52,12 +100,15 @@ pub fn start_grab(callback: JsFunction) -> Result<()> {
     }
     std::env::set_var("KEYBOARD_ONLY", "y");
 
-    let tsfn: ThreadsafeFunction<KeyEvent, ErrorStrategy::Fatal> =
-        callback.create_threadsafe_function(0, |ctx| {
-            eprintln!("TSFN callback invoked in JS thread");
-            Ok(vec![ctx.value])
-        })?;
+    now_us();
+    KEY_QUEUE.reset();
+    let tsfn: GrabTsfn = callback
+        .create_threadsafe_function(1, |_ctx| Ok(vec![Uint32Array::new(KEY_QUEUE.drain())]))?;
+
+    #[cfg(target_os = "linux")]
+    linux_grab::send(linux_grab::GrabCmd::Enable(tsfn));
 
+    #[cfg(any(target_os = "windows", target_os = "macos"))]
     thread::spawn(move || {
         KEYBOARD_HOOKED.store(true, Ordering::SeqCst);
         #[cfg(target_os = "macos")]
@@ -67,77 +118,109 @@ pub fn start_grab(callback: JsFunction) -> Result<()> {
 
         eprintln!("rdev grab thread starting");
 
-        #[cfg(any(target_os = "windows", target_os = "macos"))]
         if let Err(err) = grab(move |event: Event| handle_event(&tsfn, event)) {
             eprintln!("rdev grab error: {:?}", err);
         }
 
-        #[cfg(target_os = "linux")]
-        {
-            // On Linux, start_grab_listen() is NOT blocking - it spawns background threads and returns immediately
-            // Order is CRITICAL:
-            // 1. Call start_grab_listen() FIRST to create the grab service and channels
-            // 2. Then call enable_grab() to actually start grabbing keyboard
-            // 3. Keep this thread alive by looping while RUNNING is true
-            eprintln!("Calling start_grab_listen()...");
-            if let Err(err) = start_grab_listen(move |event: Event| {
-                eprintln!("start_grab_listen callback received event: {:?}", event.event_type);
-                match event.event_type {
-                    EventType::KeyPress(key) | EventType::KeyRelease(key) => {
-                        let is_press = matches!(event.event_type, EventType::KeyPress(_));
-                        update_modifiers(&key, is_press);
-                        // On Linux, event.usb_hid is always 0 in rdev's Event struct,
-                        // so we MUST use usb_hid_keycode_from_key to get the correct USB HID code
-                        let usb_hid = usb_hid_keycode_from_key(key)
-                            .unwrap_or(0);
-                        eprintln!("Linux key event: {:?}, usb_hid: 0x{:02X}", key, usb_hid);
-                        emit_event(
-                            &tsfn,
-                            &key,
-                            is_press,
-                            event.platform_code as u32,
-                            event.position_code,
-                            usb_hid,
-                        );
-                        None
-                    }
-                    _ => Some(event),
-                }
-            }) {
-                eprintln!("rdev grab error: {:?}", err);
+        eprintln!("rdev grab thread exiting");
+        KEYBOARD_HOOKED.store(false, Ordering::SeqCst);
+        RUNNING.store(false, Ordering::SeqCst);
+        reset_modifiers();
+    });
+
+    Ok(())
+}
+
+// On Linux the rdev grab service is started once and then kept parked on a
+// channel; control-mode and focus changes only toggle enable_grab/disable_grab
+// on it, so releasing the keyboard does not wait on a polling loop or a
+// thread respawn.
+#[cfg(target_os = "linux")]
+mod linux_grab {
+    use super::*;
+    use std::sync::mpsc::{channel, Receiver, Sender};
+
+    pub enum GrabCmd {
+        Enable(GrabTsfn),
+        Disable,
+        Exit,
+    }
+
+    static SERVICE: Mutex<Option<Sender<GrabCmd>>> = Mutex::new(None);
+    // Callback of the current grab session, set on Enable and dropped on
+    // Disable so a released JS callback no longer keeps Node alive
+    static TSFN: Mutex<Option<GrabTsfn>> = Mutex::new(None);
+
+    pub fn send(cmd: GrabCmd) {
+        let mut service = SERVICE.lock().unwrap_or_else(|e| e.into_inner());
+        if service.is_none() {
+            if matches!(cmd, GrabCmd::Enable(_)) {
+                let (tx, rx) = channel();
+                thread::spawn(move || run(rx));
+                *service = Some(tx);
             } else {
-                eprintln!("start_grab_listen() returned Ok - background threads started");
-                // Now that the grab service is running, enable actual keyboard grabbing
-                enable_grab();
-                eprintln!("enable_grab() called - keyboard grabbing enabled");
-
-                // Keep this thread alive while RUNNING is true
-                // The background threads spawned by start_grab_listen() need this parent thread to stay alive
-                use std::time::Duration;
-                while RUNNING.load(Ordering::SeqCst) {
-                    thread::sleep(Duration::from_millis(100));
-                }
-                eprintln!("RUNNING flag set to false, exiting grab thread");
+                return;
             }
         }
+        let exiting = matches!(cmd, GrabCmd::Exit);
+        if let Some(tx) = service.as_ref() {
+            let _ = tx.send(cmd);
+        }
+        if exiting {
+            *service = None;
+        }
+    }
 
-        #[cfg(any(target_os = "windows", target_os = "macos"))]
-        {
-            eprintln!("rdev grab thread exiting");
-            KEYBOARD_HOOKED.store(false, Ordering::SeqCst);
+    fn run(rx: Receiver<GrabCmd>) {
+        // start_grab_listen() is NOT blocking - it spawns rdev's grab threads and
+        // returns; enable_grab() must only be called after it succeeded.
+        eprintln!("rdev grab service starting");
+        if let Err(err) = start_grab_listen(move |event: Event| match event.event_type {
+            EventType::KeyPress(key) | EventType::KeyRelease(key) => {
+                let is_press = matches!(event.event_type, EventType::KeyPress(_));
+                update_modifiers(&key, is_press);
+                // On Linux, event.usb_hid is always 0 in rdev's Event struct,
+                // so we MUST use usb_hid_keycode_from_key to get the correct USB HID code
+                let usb_hid = usb_hid_keycode_from_key(key).unwrap_or(0);
+                if !KEYBOARD_HOOKED.load(Ordering::SeqCst) {
+                    return None;
+                }
+                if let Some(tsfn) = TSFN.lock().unwrap_or_else(|e| e.into_inner()).as_ref() {
+                    emit_event(tsfn, is_press, usb_hid);
+                }
+                None
+            }
+            _ => Some(event),
+        }) {
+            eprintln!("rdev grab error: {:?}", err);
             RUNNING.store(false, Ordering::SeqCst);
-            reset_modifiers();
+            *SERVICE.lock().unwrap_or_else(|e| e.into_inner()) = None;
+            return;
         }
 
-        #[cfg(target_os = "linux")]
-        {
-            eprintln!("rdev grab thread exiting");
-            KEYBOARD_HOOKED.store(false, Ordering::SeqCst);
-            reset_modifiers();
+        // Parked here between commands; no polling.
+        while let Ok(cmd) = rx.recv() {
+            match cmd {
+                GrabCmd::Enable(tsfn) => {
+                    *TSFN.lock().unwrap_or_else(|e| e.into_inner()) = Some(tsfn);
+                    KEYBOARD_HOOKED.store(true, Ordering::SeqCst);
+                    enable_grab();
+                }
+                GrabCmd::Disable => {
+                    let _ = disable_grab();
+                    KEYBOARD_HOOKED.store(false, Ordering::SeqCst);
+                    *TSFN.lock().unwrap_or_else(|e| e.into_inner()) = None;
+                }
+                GrabCmd::Exit => break,
+            }
         }
-    });
 
-    Ok(())
+        let _ = disable_grab();
+        let _ = exit_grab_listen();
+        KEYBOARD_HOOKED.store(false, Ordering::SeqCst);
+        *TSFN.lock().unwrap_or_else(|e| e.into_inner()) = None;
+        eprintln!("rdev grab service exiting");
+    }
 }
 
 #[napi(js_name = "stop_grab")]
@@ -149,41 +232,186 @@ pub fn stop_grab() -> Result<()> {
             let _ = exit_grab();
         }
         #[cfg(target_os = "linux")]
-        {
-            let _ = exit_grab_listen();
-            let _ = disable_grab();
-        }
+        linux_grab::send(linux_grab::GrabCmd::Disable);
         reset_modifiers();
+        direct_hid::release_all();
     }
     Ok(())
 }
 
-#[cfg(any(target_os = "windows", target_os = "macos"))]
-fn handle_event(tsfn: &ThreadsafeFunction<KeyEvent, ErrorStrategy::Fatal>, event: Event) -> Option<Event> {
-    // Only log keyboard events, not mouse movements
-    match event.event_type {
-        EventType::KeyPress(_) | EventType::KeyRelease(_) => {
-            eprintln!("handle_event: {:?}", event.event_type);
-        },
-        _ => {}
+/// Tears down the persistent grab service (Linux). stop_grab only disables
+/// grabbing so the next start_grab is immediate; call this on app exit.
+#[napi(js_name = "shutdown_grab")]
+pub fn shutdown_grab() -> Result<()> {
+    stop_grab()?;
+    #[cfg(target_os = "linux")]
+    linux_grab::send(linux_grab::GrabCmd::Exit);
+    Ok(())
+}
+
+/// Opens the controller at `path` so grabbed keys are written to it directly
+/// from the grab thread instead of being forwarded through JS.
+#[napi(js_name = "open_direct_hid")]
+pub fn open_direct_hid(path: String) -> Result<()> {
+    direct_hid::open(&path).map_err(|e| Error::new(Status::GenericFailure, e))
+}
+
+#[napi(js_name = "close_direct_hid")]
+pub fn close_direct_hid() -> Result<()> {
+    direct_hid::close();
+    Ok(())
+}
+
+/// Selects the controller firmware extensions the direct HID path may use
+/// (bit 0x01: 16-bit relative mouse command, bit 0x02: high-resolution
+/// wheel and horizontal pan).
+#[napi(js_name = "set_direct_hid_features")]
+pub fn set_direct_hid_features(features: u32) {
+    direct_hid::set_features(features);
+}
+
+/// Applies a key change from JS (virtual keyboard, paste) to the native key
+/// state and writes the report, so that while the direct HID path is open
+/// it alone owns the keyboard state. Returns false when no device is open
+/// or the write failed.
+#[napi(js_name = "direct_hid_key")]
+pub fn direct_hid_key(usage: u32, is_down: bool) -> bool {
+    direct_hid::key_event(usage, is_down)
+}
+
+/// Releases every key held on the direct HID path and writes the empty
+/// report. Returns false when no device is open or the write failed.
+#[napi(js_name = "direct_hid_release_keys")]
+pub fn direct_hid_release_keys() -> bool {
+    direct_hid::release_keys()
+}
+
+#[napi(js_name = "is_direct_hid_open")]
+pub fn is_direct_hid_open() -> bool {
+    direct_hid::is_open()
+}
+
+/// Current value of the clock used for event timestamps, for measuring
+/// grab-to-USB latency from JS.
+#[napi(js_name = "now_us")]
+pub fn now_us_js() -> u32 {
+    now_us()
+}
+
+/// DOM code name for a HID usage carried in a packed event.
+#[napi(js_name = "usage_name")]
+pub fn usage_name(usage: u32) -> String {
+    usage_to_code(usage).to_string()
+}
+
+/// Number of events dropped because the JS side stopped draining the queue.
+#[napi(js_name = "dropped_events")]
+pub fn dropped_events() -> u32 {
+    KEY_QUEUE.dropped()
+}
+
+/// Watches for the controller's hidraw nodes appearing or disappearing
+/// (Linux udev netlink). The callback receives the action ("add"/"remove")
+/// and the device node. Returns false where hotplug notifications are not
+/// supported, in which case the caller has to keep polling.
+#[napi(js_name = "watch_hotplug")]
+pub fn watch_hotplug(vendor_id: u32, product_id: u32, callback: JsFunction) -> Result<bool> {
+    #[cfg(target_os = "linux")]
+    {
+        let tsfn: ThreadsafeFunction<hotplug::HotplugEvent, ErrorStrategy::Fatal> = callback
+            .create_threadsafe_function(0, |ctx: ThreadSafeCallContext<hotplug::HotplugEvent>| {
+                Ok(vec![ctx.value.action, ctx.value.devnode])
+            })?;
+        hotplug::start(vendor_id as u16, product_id as u16, move |event| {
+            tsfn.call(event, ThreadsafeFunctionCallMode::NonBlocking);
+        })
+        .map_err(|e| Error::new(Status::GenericFailure, e.to_string()))?;
+        Ok(true)
+    }
+    #[cfg(not(target_os = "linux"))]
+    {
+        let _ = (vendor_id, product_id, callback);
+        Ok(false)
+    }
+}
+
+#[napi(js_name = "unwatch_hotplug")]
+pub fn unwatch_hotplug() -> Result<()> {
+    #[cfg(target_os = "linux")]
+    hotplug::stop();
+    Ok(())
+}
+
+#[napi(object)]
+pub struct EvdevGrabOptions {
+    pub keyboard: Option<bool>,
+    pub mouse: Option<bool>,
+}
+
+/// Starts the Linux evdev backend: grabs keyboards and/or mice with EVIOCGRAB
+/// and delivers raw events in packed four-word records. Returns the number of
+/// devices grabbed.
+#[napi(js_name = "start_evdev_grab")]
+pub fn start_evdev_grab(callback: JsFunction, options: Option<EvdevGrabOptions>) -> Result<u32> {
+    #[cfg(target_os = "linux")]
+    {
+        let options = evdev::Options {
+            keyboard: options.as_ref().and_then(|o| o.keyboard).unwrap_or(true),
+            mouse: options.as_ref().and_then(|o| o.mouse).unwrap_or(true),
+        };
+        EVDEV_QUEUE.reset();
+        EVDEV_BUTTONS.store(0, Ordering::Relaxed);
+        let tsfn: GrabTsfn = callback
+            .create_threadsafe_function(1, |_ctx| Ok(vec![Uint32Array::new(EVDEV_QUEUE.drain())]))?;
+        let count = evdev::start(options, move |event| emit_evdev_event(&tsfn, event))
+            .map_err(|e| Error::new(Status::GenericFailure, e.to_string()))?;
+        Ok(count as u32)
     }
+    #[cfg(not(target_os = "linux"))]
+    {
+        let _ = (callback, options);
+        Err(Error::new(
+            Status::GenericFailure,
+            "evdev backend is only available on Linux".to_string(),
+        ))
+    }
+}
 
+#[napi(js_name = "stop_evdev_grab")]
+pub fn stop_evdev_grab() -> Result<()> {
+    #[cfg(target_os = "linux")]
+    if evdev::is_running() {
+        evdev::stop();
+        direct_hid::release_all();
+    }
+    Ok(())
+}
+
+/// Number of evdev records dropped because the JS side stopped draining.
+#[napi(js_name = "dropped_evdev_events")]
+pub fn dropped_evdev_events() -> u32 {
+    #[cfg(target_os = "linux")]
+    {
+        EVDEV_QUEUE.dropped()
+    }
+    #[cfg(not(target_os = "linux"))]
+    {
+        0
+    }
+}
+
+#[cfg(any(target_os = "windows", target_os = "macos"))]
+fn handle_event(tsfn: &GrabTsfn, event: Event) -> Option<Event> {
     match event.event_type {
-        EventType::KeyPress(key) => {
-            eprintln!("KeyPress: {:?}", key);
-            try_handle_keyboard(tsfn, event, key, true)
-        },
-        EventType::KeyRelease(key) => {
-            eprintln!("KeyRelease: {:?}", key);
-            try_handle_keyboard(tsfn, event, key, false)
-        },
+        EventType::KeyPress(key) => try_handle_keyboard(tsfn, event, key, true),
+        EventType::KeyRelease(key) => try_handle_keyboard(tsfn, event, key, false),
         _ => Some(event),
     }
 }
 
 #[cfg(any(target_os = "windows", target_os = "macos"))]
 fn try_handle_keyboard(
-    tsfn: &ThreadsafeFunction<KeyEvent, ErrorStrategy::Fatal>,
+    tsfn: &GrabTsfn,
     event: Event,
     key: Key,
     is_press: bool,
@@ -230,14 +458,7 @@ fn try_handle_keyboard(
     update_modifiers(&key, effective_is_press);
     // Use our own USB HID mapping - rdev's usb_hid values are often incorrect
     let usb_hid = key_to_usb_hid(&key);
-    emit_event(
-        tsfn,
-        &key,
-        effective_is_press,
-        event.platform_code as u32,
-        event.position_code,
-        usb_hid,
-    );
+    emit_event(tsfn, effective_is_press, usb_hid);
 
     // Keep CapsLock/NumLock behavior intact on host OS, but still emit to JS.
     if key == Key::CapsLock || key == Key::NumLock {
@@ -276,39 +497,82 @@ fn try_handle_keyboard(
     }
 }
 
-fn emit_event(
-    tsfn: &ThreadsafeFunction<KeyEvent, ErrorStrategy::Fatal>,
-    key: &Key,
-    is_press: bool,
-    platform_code: u32,
-    scan_code: u32,
-    usb_hid: u32,
-) {
-    let (ctrl, alt, shift, meta) = current_modifiers();
-    let key_str = key_to_string(key);
-    let code_str = key_to_code(key);
-    let event_type_str = if is_press { "down" } else { "up" }.to_string();
-
-    eprintln!("Creating KeyEvent: type={}, key={}, code={}, usb_hid={}",
-        event_type_str, key_str, code_str, usb_hid
-    );
-
-    let payload = KeyEvent {
-        key: key_str,
-        code: code_str,
-        event_type: event_type_str,
-        ctrl,
-        alt,
-        shift,
-        meta,
-        platform_code,
-        scan_code,
-        usb_hid,
+fn emit_event(tsfn: &GrabTsfn, is_press: bool, usb_hid: u32) {
+    let mut flags = if is_press { FLAG_DOWN } else { 0 };
+    if direct_hid::key_event(usb_hid, is_press) {
+        flags |= FLAG_HANDLED;
+    }
+    let word0 = (usb_hid & 0xFFFF) | (modifier_mask() << 16) | (flags << 24);
+    schedule_flush(&KEY_QUEUE, tsfn, &[word0, now_us()], !is_press);
+}
+
+#[cfg(target_os = "linux")]
+fn emit_evdev_event(tsfn: &GrabTsfn, event: evdev::InputEvent) {
+    let mut release = false;
+    let record = match event {
+        evdev::InputEvent::Key {
+            usage,
+            down,
+            modifiers,
+            time_us,
+        } => {
+            let mut flags = if down { FLAG_DOWN } else { 0 };
+            if direct_hid::key_event(usage, down) {
+                flags |= FLAG_HANDLED;
+            }
+            release = !down;
+            [
+                (usage & 0xFFFF) | (hid_modifiers_to_mask(modifiers) << 16) | (flags << 24),
+                time_us,
+                0,
+                0,
+            ]
+        }
+        evdev::InputEvent::Mouse {
+            buttons,
+            dx,
+            dy,
+            wheel,
+            hwheel,
+            time_us,
+        } => {
+            let mut flags = FLAG_MOUSE;
+            if direct_hid::mouse_event(buttons, dx, dy, wheel, hwheel) {
+                flags |= FLAG_HANDLED;
+            }
+            // The record carries the whole button state; keep it when a
+            // button went up
+            let before = EVDEV_BUTTONS.swap(buttons, Ordering::Relaxed);
+            release = before & !buttons != 0;
+            [
+                (buttons & 0xFFFF) | (flags << 24),
+                time_us,
+                pack_i16_pair(dx, dy),
+                pack_i16_pair(wheel, hwheel),
+            ]
+        }
     };
+    schedule_flush(&EVDEV_QUEUE, tsfn, &record, release);
+}
+
+#[cfg(target_os = "linux")]
+fn pack_i16_pair(lo: i32, hi: i32) -> u32 {
+    let lo = lo.clamp(i16::MIN as i32, i16::MAX as i32) as i16 as u16 as u32;
+    let hi = hi.clamp(i16::MIN as i32, i16::MAX as i32) as i16 as u16 as u32;
+    lo | (hi << 16)
+}
 
-    eprintln!("Calling tsfn.call()...");
-    let status = tsfn.call(payload, ThreadsafeFunctionCallMode::NonBlocking);
-    eprintln!("tsfn.call() returned: {:?}", status);
+// Folds the eight HID modifier bits into the left/right-agnostic mask used by
+// the packed ABI.
+#[cfg(target_os = "linux")]
+fn hid_modifiers_to_mask(bits: u32) -> u32 {
+    (bits | (bits >> 4)) & 0x0F
+}
+
+fn schedule_flush(queue: &EventQueue, tsfn: &GrabTsfn, record: &[u32], release: bool) {
+    if queue.push(record, release) && tsfn.call((), ThreadsafeFunctionCallMode::NonBlocking) != Status::Ok {
+        queue.flush_failed();
+    }
 }
 
 fn update_modifiers(key: &Key, is_down: bool) {
@@ -329,16 +593,33 @@ fn update_modifiers(key: &Key, is_down: bool) {
     }
 }
 
-fn current_modifiers() -> (bool, bool, bool, bool) {
+fn modifier_mask() -> u32 {
     // Include phantom states for Ctrl/Alt to handle macOS rdev bug
-    let ctrl = CTRL_HELD.load(Ordering::SeqCst) || CTRL_PHANTOM.load(Ordering::SeqCst);
-    let alt = ALT_HELD.load(Ordering::SeqCst) || ALT_PHANTOM.load(Ordering::SeqCst);
-    (
-        ctrl,
-        alt,
-        SHIFT_HELD.load(Ordering::SeqCst),
-        META_HELD.load(Ordering::SeqCst),
-    )
+    let mut mask = 0;
+    if CTRL_HELD.load(Ordering::SeqCst) || CTRL_PHANTOM.load(Ordering::SeqCst) {
+        mask |= MOD_CTRL;
+    }
+    if ALT_HELD.load(Ordering::SeqCst) || ALT_PHANTOM.load(Ordering::SeqCst) {
+        mask |= MOD_ALT;
+    }
+    if SHIFT_HELD.load(Ordering::SeqCst) {
+        mask |= MOD_SHIFT;
+    }
+    if META_HELD.load(Ordering::SeqCst) {
+        mask |= MOD_META;
+    }
+    mask
+}
+
+// On Linux this is CLOCK_MONOTONIC so it matches evdev kernel timestamps
+#[cfg(target_os = "linux")]
+fn now_us() -> u32 {
+    evdev::monotonic_us()
+}
+
+#[cfg(not(target_os = "linux"))]
+fn now_us() -> u32 {
+    EPOCH.get_or_init(Instant::now).elapsed().as_micros() as u32
 }
 
 fn reset_modifiers() {
@@ -354,10 +635,6 @@ fn reset_modifiers() {
     IS_LEFT_OPTION_DOWN.store(false, Ordering::SeqCst);
 }
 
-fn key_to_string(key: &Key) -> String {
-    format!("{:?}", key)
-}
-
 fn key_to_usb_hid(key: &Key) -> u32 {
     // USB HID Usage IDs for Keyboard/Keypad Page (0x07)
     // Reference: https://usb.org/sites/default/files/hut1_21.pdf
@@ -499,100 +776,143 @@ fn key_to_usb_hid(key: &Key) -> u32 {
     }
 }
 
-fn key_to_code(key: &Key) -> String {
-    let s = match key {
-        Key::Alt => "AltLeft",
-        Key::AltGr => "AltRight",
-        Key::Backspace => "Backspace",
-        Key::CapsLock => "CapsLock",
-        Key::ControlLeft => "ControlLeft",
-        Key::ControlRight => "ControlRight",
-        Key::MetaLeft => "MetaLeft",
-        Key::MetaRight => "MetaRight",
-        Key::ShiftLeft => "ShiftLeft",
-        Key::ShiftRight => "ShiftRight",
-        Key::Tab => "Tab",
-        Key::Return => "Enter",
-        Key::Escape => "Escape",
-        Key::Space => "Space",
-        Key::LeftArrow => "ArrowLeft",
-        Key::RightArrow => "ArrowRight",
-        Key::UpArrow => "ArrowUp",
-        Key::DownArrow => "ArrowDown",
-        Key::Home => "Home",
-        Key::End => "End",
-        Key::PageUp => "PageUp",
-        Key::PageDown => "PageDown",
-        Key::Delete => "Delete",
-        Key::Insert => "Insert",
-        Key::F1 => "F1",
-        Key::F2 => "F2",
-        Key::F3 => "F3",
-        Key::F4 => "F4",
-        Key::F5 => "F5",
-        Key::F6 => "F6",
-        Key::F7 => "F7",
-        Key::F8 => "F8",
-        Key::F9 => "F9",
-        Key::F10 => "F10",
-        Key::F11 => "F11",
-        Key::F12 => "F12",
-        Key::F13 => "F13",
-        Key::F14 => "F14",
-        Key::F15 => "F15",
-        Key::F16 => "F16",
-        Key::F17 => "F17",
-        Key::F18 => "F18",
-        Key::F19 => "F19",
-        Key::F20 => "F20",
-        Key::KeyA => "KeyA",
-        Key::KeyB => "KeyB",
-        Key::KeyC => "KeyC",
-        Key::KeyD => "KeyD",
-        Key::KeyE => "KeyE",
-        Key::KeyF => "KeyF",
-        Key::KeyG => "KeyG",
-        Key::KeyH => "KeyH",
-        Key::KeyI => "KeyI",
-        Key::KeyJ => "KeyJ",
-        Key::KeyK => "KeyK",
-        Key::KeyL => "KeyL",
-        Key::KeyM => "KeyM",
-        Key::KeyN => "KeyN",
-        Key::KeyO => "KeyO",
-        Key::KeyP => "KeyP",
-        Key::KeyQ => "KeyQ",
-        Key::KeyR => "KeyR",
-        Key::KeyS => "KeyS",
-        Key::KeyT => "KeyT",
-        Key::KeyU => "KeyU",
-        Key::KeyV => "KeyV",
-        Key::KeyW => "KeyW",
-        Key::KeyX => "KeyX",
-        Key::KeyY => "KeyY",
-        Key::KeyZ => "KeyZ",
-        Key::Num1 => "Digit1",
-        Key::Num2 => "Digit2",
-        Key::Num3 => "Digit3",
-        Key::Num4 => "Digit4",
-        Key::Num5 => "Digit5",
-        Key::Num6 => "Digit6",
-        Key::Num7 => "Digit7",
-        Key::Num8 => "Digit8",
-        Key::Num9 => "Digit9",
-        Key::Num0 => "Digit0",
-        Key::Minus => "Minus",
-        Key::Equal => "Equal",
-        Key::LeftBracket => "BracketLeft",
-        Key::RightBracket => "BracketRight",
-        Key::BackSlash => "Backslash",
-        Key::SemiColon => "Semicolon",
-        Key::Quote => "Quote",
-        Key::Comma => "Comma",
-        Key::Dot => "Period",
-        Key::Slash => "Slash",
-        Key::BackQuote => "Backquote",
-        _ => return key_to_string(key),
-    };
-    s.to_string()
+/// DOM `KeyboardEvent.code` name for a HID usage, resolved only when the UI
+/// actually needs a name (quit-key detection).
+fn usage_to_code(usage: u32) -> &'static str {
+    match usage {
+        // Letters
+        0x04 => "KeyA",
+        0x05 => "KeyB",
+        0x06 => "KeyC",
+        0x07 => "KeyD",
+        0x08 => "KeyE",
+        0x09 => "KeyF",
+        0x0A => "KeyG",
+        0x0B => "KeyH",
+        0x0C => "KeyI",
+        0x0D => "KeyJ",
+        0x0E => "KeyK",
+        0x0F => "KeyL",
+        0x10 => "KeyM",
+        0x11 => "KeyN",
+        0x12 => "KeyO",
+        0x13 => "KeyP",
+        0x14 => "KeyQ",
+        0x15 => "KeyR",
+        0x16 => "KeyS",
+        0x17 => "KeyT",
+        0x18 => "KeyU",
+        0x19 => "KeyV",
+        0x1A => "KeyW",
+        0x1B => "KeyX",
+        0x1C => "KeyY",
+        0x1D => "KeyZ",
+
+        // Numbers
+        0x1E => "Digit1",
+        0x1F => "Digit2",
+        0x20 => "Digit3",
+        0x21 => "Digit4",
+        0x22 => "Digit5",
+        0x23 => "Digit6",
+        0x24 => "Digit7",
+        0x25 => "Digit8",
+        0x26 => "Digit9",
+        0x27 => "Digit0",
+
+        // Special keys
+        0x28 => "Enter",
+        0x29 => "Escape",
+        0x2A => "Backspace",
+        0x2B => "Tab",
+        0x2C => "Space",
+        0x2D => "Minus",
+        0x2E => "Equal",
+        0x2F => "BracketLeft",
+        0x30 => "BracketRight",
+        0x31 => "Backslash",
+        0x33 => "Semicolon",
+        0x34 => "Quote",
+        0x35 => "Backquote",
+        0x36 => "Comma",
+        0x37 => "Period",
+        0x38 => "Slash",
+        0x39 => "CapsLock",
+
+        // Function keys
+        0x3A => "F1",
+        0x3B => "F2",
+        0x3C => "F3",
+        0x3D => "F4",
+        0x3E => "F5",
+        0x3F => "F6",
+        0x40 => "F7",
+        0x41 => "F8",
+        0x42 => "F9",
+        0x43 => "F10",
+        0x44 => "F11",
+        0x45 => "F12",
+
+        // Navigation keys
+        0x46 => "PrintScreen",
+        0x47 => "ScrollLock",
+        0x48 => "Pause",
+        0x49 => "Insert",
+        0x4A => "Home",
+        0x4B => "PageUp",
+        0x4C => "Delete",
+        0x4D => "End",
+        0x4E => "PageDown",
+        0x4F => "ArrowRight",
+        0x50 => "ArrowLeft",
+        0x51 => "ArrowDown",
+        0x52 => "ArrowUp",
+
+        // Keypad
+        0x53 => "NumLock",
+        0x54 => "NumpadDivide",
+        0x55 => "NumpadMultiply",
+        0x56 => "NumpadSubtract",
+        0x57 => "NumpadAdd",
+        0x58 => "NumpadEnter",
+        0x59 => "Numpad1",
+        0x5A => "Numpad2",
+        0x5B => "Numpad3",
+        0x5C => "Numpad4",
+        0x5D => "Numpad5",
+        0x5E => "Numpad6",
+        0x5F => "Numpad7",
+        0x60 => "Numpad8",
+        0x61 => "Numpad9",
+        0x62 => "Numpad0",
+        0x63 => "NumpadDecimal",
+
+        // Additional keys
+        0x64 => "IntlBackslash",
+        0x68 => "F13",
+        0x69 => "F14",
+        0x6A => "F15",
+        0x6B => "F16",
+        0x6C => "F17",
+        0x6D => "F18",
+        0x6E => "F19",
+        0x6F => "F20",
+        0x70 => "F21",
+        0x71 => "F22",
+        0x72 => "F23",
+        0x73 => "F24",
+
+        // Modifiers
+        0xE0 => "ControlLeft",
+        0xE1 => "ShiftLeft",
+        0xE2 => "AltLeft",
+        0xE3 => "MetaLeft",
+        0xE4 => "ControlRight",
+        0xE5 => "ShiftRight",
+        0xE6 => "AltRight",
+        0xE7 => "MetaRight",
+
+        // Unknown usage
+        _ => "Unknown",
+    }
 }
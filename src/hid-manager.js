@@ -3,6 +3,7 @@ const HID = require('node-hid');
 class HIDManager {
   constructor() {
     this.device = null;
+    this.devicePath = null;
     this.connected = false;
     this.vendorId = 0x413D;
     this.productId = 0x2107;
@@ -11,47 +12,136 @@ class HIDManager {
     // Track current modifier and key states
     this.modifierState = 0;
     this.activeKeys = new Set(); // Track which keys are currently pressed
+    // Last keyboard report written; OS auto-repeat of a held key changes
+    // nothing and is not sent, so the controller only sees key edges
+    this.lastKeyboardReport = null;
+    // Native direct HID path, see setDirectKeyboard()
+    this.directKeyboard = null;
     
     // Track last known mouse position and button state
     this.lastX = 0;
     this.lastY = 0;
     this.currentButtonState = 0; // Track currently pressed mouse buttons
+
+    // Optional controller firmware extensions; stock firmware supports none.
+    // connect() asks the firmware (command 0x11); firmware that does not
+    // answer gets the features assumed with setFeatures().
+    this.features = { mouseRel16: false, hiResScroll: false, absInterpolation: false };
+    this.assumedFeatures = { ...this.features };
+    this.capabilities = null;
+
+    // Sub-notch scroll not yet sent, in 1/120 notch units (legacy wheel path)
+    this.scrollRemainder = 0;
+
+    // Firmware settings by id, re-sent on every connect
+    this.config = new Map();
+
+    // Heartbeat for the firmware watchdog, see setHostTimeout()
+    this.heartbeatMs = 0;
+    this.heartbeatTimer = null;
+
+    // Break plus settle time of a KVM switch, see setSwitchTiming()
+    this.switchTimingMs = 20;
+
+    // Queries waiting for their reply, see query()
+    this.pendingQueries = [];
+  }
+
+  // While the native direct HID path is open, its grab thread owns the
+  // keyboard state and writes every keyboard report. JS key changes are
+  // handed to it ({ key(usage, isDown), releaseKeys() }) instead of being
+  // written here, so the two never overwrite each other's reports.
+  setDirectKeyboard(direct) {
+    this.directKeyboard = direct;
+    this.modifierState = 0;
+    this.activeKeys.clear();
+    this.lastKeyboardReport = null;
+  }
+
+  // Drops held keys; the native path writes its own release
+  clearKeyboardState() {
+    this.modifierState = 0;
+    this.activeKeys.clear();
+    this.lastKeyboardReport = null;
+    if (this.directKeyboard) {
+      this.directKeyboard.releaseKeys();
+    }
+  }
+
+  setFeatures(features) {
+    this.assumedFeatures = { ...this.assumedFeatures, ...features };
+    this.features = { ...this.features, ...features };
+  }
+
+  // Whether the connected firmware takes an optional command (CAP_*).
+  // Without an answer to command 0x11, only what setFeatures() assumed
+  // for that capability counts (see ASSUMED_FEATURES).
+  supports(capability) {
+    if (this.capabilities) {
+      return (this.capabilities.features & capability) !== 0;
+    }
+    const name = HIDManager.ASSUMED_FEATURES[capability];
+    return name !== undefined && this.assumedFeatures[name] === true;
+  }
+
+  // Command 0x0B: [id, value16 LE]. Needs firmware from this repository.
+  setConfig(id, value) {
+    this.config.set(id, value);
+    if (this.connected && this.device && this.supports(HIDManager.CAP_CONFIG)) {
+      this.writeCommand(0x0B, [id, value, value >> 8]);
+    }
+  }
+
+  applyConfig() {
+    if (!this.supports(HIDManager.CAP_CONFIG)) {
+      return;
+    }
+    for (const [id, value] of this.config) {
+      this.writeCommand(0x0B, [id, value, value >> 8]);
+    }
+  }
+
+  // The firmware releases every key and button when it hears nothing for ms
+  // while input is held (app crash, cable pulled). Any command resets its
+  // timer; a heartbeat (command 0x0C) keeps held input alive while idle.
+  setHostTimeout(ms) {
+    this.heartbeatMs = ms > 0 ? Math.max(50, Math.floor(ms / 4)) : 0;
+    this.setConfig(HIDManager.CONFIG_HOST_TIMEOUT, ms);
+    this.startHeartbeat();
+  }
+
+  startHeartbeat() {
+    this.stopHeartbeat();
+    if (!this.heartbeatMs || !this.connected || !this.supports(HIDManager.CAP_HOST_WATCHDOG)) {
+      return;
+    }
+    this.heartbeatTimer = setInterval(() => {
+      if (!this.connected || !this.device) {
+        return;
+      }
+      try {
+        this.writeCommand(0x0C, []);
+      } catch (error) {
+        // An unplugged controller is handled by the reconnect logic
+      }
+    }, this.heartbeatMs);
+  }
+
+  stopHeartbeat() {
+    if (this.heartbeatTimer) {
+      clearInterval(this.heartbeatTimer);
+      this.heartbeatTimer = null;
+    }
   }
 
   getDevices() {
     try {
-      const devices = HID.devices();
-      console.log('All HID devices:', devices.map(d => ({
-        path: d.path,
-        vendorId: d.vendorId,
-        productId: d.productId,
-        usagePage: d.usagePage,
-        product: d.product
-      })));
-      
-      // First try with specific filters
-      let filteredDevices = devices.filter(device => 
-        device.vendorId === this.vendorId && 
-        device.productId === this.productId &&
-        device.usagePage === this.usagePage
-      );
-      
-      // If no devices found with usage page filter, try without it
-      if (filteredDevices.length === 0) {
-        filteredDevices = devices.filter(device => 
-          device.vendorId === this.vendorId && 
-          device.productId === this.productId
-        );
-        console.log('Fallback: devices without usagePage filter:', filteredDevices);
-      }
-      
-      // Also include any OSRBOT devices for debugging
-      const osrbotDevices = devices.filter(device => 
-        device.product && device.product.includes('OSRBOT')
-      );
-      console.log('OSRBOT devices found:', osrbotDevices);
-      
-      return filteredDevices;
+      // Enumerate only the controller's VID/PID instead of every HID device
+      const devices = HID.devices(this.vendorId, this.productId);
+
+      // Prefer the vendor-defined interface, fall back to any interface
+      const vendorInterfaces = devices.filter(device => device.usagePage === this.usagePage);
+      return vendorInterfaces.length > 0 ? vendorInterfaces : devices;
     } catch (error) {
       console.error('Error getting HID devices:', error);
       return [];
@@ -63,13 +153,19 @@ class HIDManager {
       if (this.device) {
         this.device.close();
         this.device = null;
+
+        // Wait a bit for previous connection to close
+        await new Promise(resolve => setTimeout(resolve, 200));
       }
 
-      // Wait a bit for previous connection to close
-      await new Promise(resolve => setTimeout(resolve, 200));
-      
       this.device = new HID.HID(devicePath);
+      this.devicePath = devicePath;
       this.connected = true;
+      this.lastKeyboardReport = null;
+      this.listen(this.device);
+      await this.negotiate();
+      this.applyConfig();
+      this.startHeartbeat();
       
       console.log('Connected to HID device:', devicePath);
       console.log('Device info:', this.device.getDeviceInfo());
@@ -84,7 +180,7 @@ class HIDManager {
         console.log('Trying alternative connection method...');
         try {
           // Try opening with just vendor/product ID instead of path
-          const devices = HID.devices();
+          const devices = HID.devices(this.vendorId, this.productId);
           const targetDevice = devices.find(d => 
             d.vendorId === this.vendorId && 
             d.productId === this.productId &&
@@ -93,7 +189,13 @@ class HIDManager {
           
           if (targetDevice) {
             this.device = new HID.HID(this.vendorId, this.productId);
+            this.devicePath = targetDevice.path;
             this.connected = true;
+            this.lastKeyboardReport = null;
+            this.listen(this.device);
+            await this.negotiate();
+            this.applyConfig();
+            this.startHeartbeat();
             console.log('Connected using vendor/product ID method');
             return { success: true };
           }
@@ -108,16 +210,24 @@ class HIDManager {
 
   disconnect() {
     try {
-      if (this.device) {
-        this.device.close();
-        this.device = null;
-      }
+      // Clear state first: closing a handle whose device was unplugged can throw
+      const device = this.device;
+      this.device = null;
+      this.devicePath = null;
       this.connected = false;
-      
+      this.capabilities = null;
+      this.stopHeartbeat();
+      this.cancelQueries();
+
       // Reset key states
       this.modifierState = 0;
       this.activeKeys.clear();
-      
+      this.lastKeyboardReport = null;
+
+      if (device) {
+        device.close();
+      }
+
       return { success: true };
     } catch (error) {
       console.error('Error disconnecting HID device:', error);
@@ -135,17 +245,15 @@ class HIDManager {
 
       switch (data.type) {
         case 'move':
-          const deltaX = Math.max(-127, Math.min(127, data.x));
-          const deltaY = Math.max(-127, Math.min(127, data.y));
-          const deltaX_byte = deltaX < 0 ? (256 + deltaX) : deltaX;
-          const deltaY_byte = deltaY < 0 ? (256 + deltaY) : deltaY;
           // Include button state for dragging support in relative mode
           const moveButtonState = data.buttonsPressed !== undefined ? data.buttonsPressed : 0;
           if (data.buttonsPressed !== undefined) {
             this.currentButtonState = data.buttonsPressed;
           }
-          buffer = [7, 0, moveButtonState, deltaX_byte, deltaY_byte, 0, 0, 0, 0];
-          break;
+          if (!this.writeRelativeMotion(moveButtonState, Math.round(data.x), Math.round(data.y))) {
+            return { success: false, error: 'Invalid motion delta' };
+          }
+          return { success: true };
         case 'abs':
           const x_scaled = Math.max(0, Math.min(0x7FFF, data.x));
           const y_scaled = Math.max(0, Math.min(0x7FFF, data.y));
@@ -156,6 +264,12 @@ class HIDManager {
           const x_high = (x_int >> 8) & 0x7F;
           const y_low = y_int & 0xFF;
           const y_high = (y_int >> 8) & 0x7F;
+          if (this.features.absInterpolation && data.timeStamp !== undefined) {
+            // Command 0x0A: the firmware glides between timestamped samples at the poll rate
+            const stamp = Math.round(data.timeStamp) & 0xFFFF;
+            this.writeCommand(0x0A, [buttonState, x_low, x_high, y_low, y_high, stamp, stamp >> 8]);
+            return { success: true };
+          }
           buffer = [2, 0, buttonState, x_low, x_high, y_low, y_high, 0, 0];
           break;
         case 'mousedown':
@@ -212,6 +326,19 @@ class HIDManager {
             buffer = [7, 0, wheelButtonState, 0, 0, wheelDelta, 0, 0, 0];
           }
           break;
+        case 'scroll':
+          const scrollButtonState = data.buttonsPressed !== undefined ? data.buttonsPressed : this.currentButtonState;
+          if (data.buttonsPressed !== undefined) {
+            this.currentButtonState = data.buttonsPressed;
+          }
+          if (data.x !== undefined && data.y !== undefined) {
+            this.lastX = Math.max(0, Math.min(0x7FFF, Math.round(data.x)));
+            this.lastY = Math.max(0, Math.min(0x7FFF, Math.round(data.y)));
+            this.writeScroll(scrollButtonState, data.deltaY || 0, data.deltaX || 0, true);
+          } else {
+            this.writeScroll(scrollButtonState, data.deltaY || 0, data.deltaX || 0, false);
+          }
+          return { success: true };
         case 'reset':
           this.currentButtonState = 0;
           this.lastX = 0;
@@ -238,13 +365,12 @@ class HIDManager {
     }
 
     try {
-      // Keyboard HID report: [report_id, reserved, modifier_byte, reserved, key1-6, reserved]
-      let buffer = [1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0];
-
+      let usage = 0;
       if (data.type === 'reset') {
         // Reset all keys and internal state
         this.modifierState = 0;
         this.activeKeys.clear();
+        this.lastKeyboardReport = null;
         console.log('Keyboard reset');
       } else if (data.type === 'keydown') {
         const modifierCode = this.getModifierCode(data.key, data.code);
@@ -252,12 +378,14 @@ class HIDManager {
         if (modifierCode > 0) {
           // Modifier key press
           this.modifierState |= modifierCode;
+          usage = 0xE0 + 31 - Math.clz32(modifierCode);
           console.log('Modifier DOWN:', data.key, 'state:', this.modifierState.toString(2).padStart(8, '0'));
         } else {
           // Regular key press
           const keyCode = this.getKeyCode(data.key, data.code, data.usbHid, data.scanCode, data.platformCode);
           if (keyCode > 0) {
             this.activeKeys.add(keyCode);
+            usage = keyCode;
             console.log('Key DOWN:', data.key, 'code:0x' + keyCode.toString(16));
           } else {
             console.warn('Unknown key:', data.key, data.code);
@@ -269,29 +397,59 @@ class HIDManager {
         if (modifierCode > 0) {
           // Modifier key release
           this.modifierState &= ~modifierCode;
+          usage = 0xE0 + 31 - Math.clz32(modifierCode);
           console.log('Modifier UP:', data.key, 'state:', this.modifierState.toString(2).padStart(8, '0'));
         } else {
           // Regular key release
           const keyCode = this.getKeyCode(data.key, data.code, data.usbHid, data.scanCode, data.platformCode);
           if (keyCode > 0) {
             this.activeKeys.delete(keyCode);
+            usage = keyCode;
             console.log('Key UP:', data.key, 'code:0x' + keyCode.toString(16));
           }
         }
       }
 
-      // Build HID report with current state
-      buffer[2] = this.modifierState;
-      const keyArray = Array.from(this.activeKeys).slice(0, 6);
-      for (let i = 0; i < keyArray.length; i++) {
-        buffer[4 + i] = keyArray[i];
+      if (this.directKeyboard) {
+        const written = data.type === 'reset'
+          ? this.directKeyboard.releaseKeys()
+          : !usage || this.directKeyboard.key(usage, data.type === 'keydown');
+        return written ? { success: true } : { success: false, error: 'Direct HID write failed' };
       }
+      this.writeKeyboardReport();
+      return { success: true };
+    } catch (error) {
+      console.error('Error sending keyboard event:', error);
+      return { success: false, error: error.message };
+    }
+  }
 
-      // Rotate buffer (Python: buffer[-1:] + buffer[:-1], then buffer[0] = 0)
-      const rotatedBuffer = [buffer[10], ...buffer.slice(0, 10)];
-      rotatedBuffer[0] = 0;
+  // Fast path for packed rdev events: the HID usage is already known, so no
+  // name lookups or logging happen per key.
+  sendKeyboardUsage(usage, isDown) {
+    if (!this.connected || !this.device) {
+      return { success: false, error: 'Device not connected' };
+    }
+    if (!usage) {
+      return { success: false, error: 'Unknown key' };
+    }
+    if (this.directKeyboard) {
+      return this.directKeyboard.key(usage, isDown)
+        ? { success: true }
+        : { success: false, error: 'Direct HID write failed' };
+    }
 
-      this.device.write(rotatedBuffer);
+    try {
+      if (usage >= 0xE0 && usage <= 0xE7) {
+        const bit = 1 << (usage - 0xE0);
+        this.modifierState = isDown ? (this.modifierState | bit) : (this.modifierState & ~bit);
+      } else if (isDown) {
+        this.activeKeys.add(usage);
+      } else {
+        this.activeKeys.delete(usage);
+      }
+
+      this.writeKeyboardReport();
       return { success: true };
     } catch (error) {
       console.error('Error sending keyboard event:', error);
@@ -299,6 +457,318 @@ class HIDManager {
     }
   }
 
+  writeKeyboardReport() {
+    // Keyboard HID report: [report_id, reserved, modifier_byte, reserved, key1-6, reserved]
+    const buffer = [1, 0, this.modifierState, 0, 0, 0, 0, 0, 0, 0, 0];
+    let i = 0;
+    for (const keyCode of this.activeKeys) {
+      if (i >= 6) break;
+      buffer[4 + i++] = keyCode;
+    }
+
+    // Rotate buffer (Python: buffer[-1:] + buffer[:-1], then buffer[0] = 0)
+    const rotatedBuffer = [buffer[10], ...buffer.slice(0, 10)];
+    rotatedBuffer[0] = 0;
+
+    const report = rotatedBuffer.join(',');
+    if (report === this.lastKeyboardReport) {
+      return;
+    }
+    this.device.write(rotatedBuffer);
+    this.lastKeyboardReport = report;
+  }
+
+  // Controller command: [report_id=0, cmd, 0, payload (8 bytes)]
+  writeCommand(cmd, payload) {
+    const buffer = [0, cmd, 0, 0, 0, 0, 0, 0, 0, 0, 0];
+    for (let i = 0; i < payload.length && i < 8; i++) {
+      buffer[3 + i] = payload[i] & 0xFF;
+    }
+    this.device.write(buffer);
+  }
+
+  // Controller replies arrive through node-hid's 'data' event, so waiting
+  // for one never blocks the main process
+  listen(device) {
+    device.on('data', (data) => this.handleReply(device, data));
+    device.on('error', (error) => {
+      if (device === this.device) {
+        console.error('HID read error:', error.message);
+        this.cancelQueries();
+      }
+    });
+  }
+
+  // Each reply goes to the oldest query for its command byte that accepts
+  // it; anything else (a late reply after a timeout) is dropped. The
+  // standalone firmware reports commands it had to drop unasked.
+  handleReply(device, data) {
+    if (device !== this.device) {
+      return;
+    }
+    const reply = Array.from(data);
+    const index = this.pendingQueries.findIndex(q => q.cmd === reply[0] && q.accepts(reply));
+    if (index < 0) {
+      if (reply[0] === 0x0D && reply[1] === HIDManager.TELEMETRY_CMD_DROPS) {
+        console.warn('Controller command queue overflowed, commands dropped so far:', reply[2] | (reply[3] << 8));
+      }
+      return;
+    }
+    const [query] = this.pendingQueries.splice(index, 1);
+    clearTimeout(query.timer);
+    query.resolve(reply);
+  }
+
+  cancelQueries() {
+    const pending = this.pendingQueries;
+    this.pendingQueries = [];
+    for (const query of pending) {
+      clearTimeout(query.timer);
+      query.resolve(null);
+    }
+  }
+
+  // Sends a command and resolves with the reply, which starts with the
+  // command byte and is checked by accepts(reply). Resolves with null when
+  // the controller does not answer in time (stock firmware).
+  query(cmd, payload, timeoutMs = 100, accepts = () => true) {
+    return new Promise((resolve) => {
+      const query = { cmd, accepts, resolve, timer: null };
+      query.timer = setTimeout(() => {
+        const index = this.pendingQueries.indexOf(query);
+        if (index >= 0) {
+          this.pendingQueries.splice(index, 1);
+        }
+        resolve(null);
+      }, timeoutMs);
+      this.pendingQueries.push(query);
+      try {
+        this.writeCommand(cmd, payload);
+      } catch (error) {
+        clearTimeout(query.timer);
+        this.pendingQueries.splice(this.pendingQueries.indexOf(query), 1);
+        throw error;
+      }
+    });
+  }
+
+  setSwitchTiming(breakMs, settleMs) {
+    this.setConfig(HIDManager.CONFIG_SWITCH_BREAK_MS, breakMs);
+    this.setConfig(HIDManager.CONFIG_SWITCH_SETTLE_MS, settleMs);
+    this.switchTimingMs = breakMs + settleMs;
+  }
+
+  // Command 0x6F: move keyboard and mouse to another target (0-2). The
+  // firmware releases held input on the old target first and answers once
+  // the new one got neutral reports. Local key and button state is dropped
+  // so nothing is re-sent as held. Stock firmware switches without answering.
+  async switchTarget(target) {
+    if (!this.connected || !this.device) {
+      return { success: false, error: 'Device not connected' };
+    }
+    try {
+      this.clearKeyboardState();
+      this.currentButtonState = 0;
+      const reply = await this.query(0x6F, [target], 100 + this.switchTimingMs);
+      return { success: true, confirmed: reply !== null && reply[2] === target };
+    } catch (error) {
+      console.error('Error switching target:', error);
+      return { success: false, error: error.message };
+    }
+  }
+
+  // Command 0x10: recovers the target side without touching the controller
+  // link, so the device stays open. RESET_QUEUES drops queued reports and
+  // sends neutral ones; RESET_HID_PORT also detaches the keyboard/mouse
+  // port for detachMs (1-255, 0 = firmware default) so the target
+  // re-enumerates it. The firmware answers once done.
+  async resetTarget(scope, detachMs = 0) {
+    if (!this.connected || !this.device) {
+      return { success: false, error: 'Device not connected' };
+    }
+    try {
+      this.clearKeyboardState();
+      this.currentButtonState = 0;
+      const reply = await this.query(0x10, [scope, detachMs], 100 + (detachMs || 10),
+        r => r[2] === scope);
+      if (reply && reply[2] === scope && reply[3] === 1) {
+        return { success: false, error: 'Controller busy' };
+      }
+      if (reply && reply[2] === scope && reply[3] === 2) {
+        return { success: false, error: 'Reset scope not supported' };
+      }
+      return { success: true, confirmed: reply !== null && reply[2] === scope };
+    } catch (error) {
+      console.error('Error resetting target:', error);
+      return { success: false, error: error.message };
+    }
+  }
+
+  // Once per connect: use the fastest input paths the firmware reports
+  // (16-bit relative motion, hi-res scroll, interpolated absolute motion).
+  // Firmware that does not answer keeps the features from setFeatures().
+  async negotiate() {
+    this.capabilities = await this.readCapabilities();
+    const caps = this.capabilities;
+    if (!caps) {
+      this.features = { ...this.assumedFeatures };
+      return;
+    }
+    this.features = {
+      mouseRel16: (caps.features & HIDManager.CAP_REL16) !== 0,
+      hiResScroll: (caps.features & HIDManager.CAP_HIRES_SCROLL) !== 0,
+      absInterpolation: (caps.features & HIDManager.CAP_ABS_TIMESTAMPS) !== 0
+    };
+    console.log('Controller protocol', caps.version, 'capabilities:', caps);
+  }
+
+  // Command 0x11: [0] -> [0x11, 0, version, features16 LE, command queue
+  // depth, commands per packet, keyboard/abs mouse/rel mouse bInterval].
+  // null for firmware that does not answer (stock or older builds).
+  async readCapabilities() {
+    if (!this.connected || !this.device) {
+      return null;
+    }
+    try {
+      const reply = await this.query(0x11, [0], 100, r => r[1] === 0);
+      if (!reply || reply[1] !== 0 || reply[2] === 0) {
+        return null;
+      }
+      return {
+        version: reply[2],
+        features: reply[3] | (reply[4] << 8),
+        commandQueue: reply[5],
+        commandsPerPacket: reply[6],
+        keyboardIntervalMs: reply[7],
+        mouseAbsIntervalMs: reply[8],
+        mouseRelIntervalMs: reply[9]
+      };
+    } catch (error) {
+      console.error('Error reading controller capabilities:', error);
+      return null;
+    }
+  }
+
+  // Command 0x0D: firmware event counters, or null without extended firmware
+  async readTelemetry() {
+    if (!this.connected || !this.device) {
+      return null;
+    }
+    try {
+      const reply = await this.query(0x0D, [0], 100, r => r[1] === 0);
+      if (!reply) {
+        return null;
+      }
+      // Four counters per reply; older firmware answers zeros past its last
+      const more = await this.query(0x0D, [4], 100, r => r[1] === 4);
+      const counter = (i) => {
+        const r = i < 4 ? reply : more;
+        const at = 2 + 2 * (i % 4);
+        return r ? r[at] | (r[at + 1] << 8) : 0;
+      };
+      return {
+        watchdogReleases: counter(0),
+        typematicStops: counter(1),
+        commandDrops: counter(2),
+        linkErrors: counter(3),
+        portResets: counter(4),
+        duplicateReports: counter(5)
+      };
+    } catch (error) {
+      console.error('Error reading controller telemetry:', error);
+      return null;
+    }
+  }
+
+  // Command 0x0F: the crash record the firmware's fault handler left in
+  // DataFlash, as a Buffer, or null when there is none or the firmware
+  // does not answer. tools/crash-dump.js decodes it.
+  async readCrashRecord() {
+    if (!this.connected || !this.device) {
+      return null;
+    }
+    try {
+      const record = Buffer.alloc(HIDManager.CRASH_RECORD_LEN);
+      for (let chunk = 0; chunk * 8 < record.length; chunk++) {
+        const reply = await this.query(0x0F, [chunk], 100, r => r[1] === chunk);
+        if (!reply || reply[1] !== chunk) {
+          return null;
+        }
+        Buffer.from(reply.slice(2, 10)).copy(record, chunk * 8);
+        if (chunk === 0 && record.readUInt32LE(0) !== HIDManager.CRASH_MAGIC) {
+          return null;
+        }
+      }
+      return record;
+    } catch (error) {
+      console.error('Error reading crash record:', error);
+      return null;
+    }
+  }
+
+  async clearCrashRecord() {
+    if (!this.connected || !this.device) {
+      return false;
+    }
+    try {
+      return (await this.query(0x0F, [0xFF], 200, r => r[1] === 0xFF)) !== null;
+    } catch (error) {
+      console.error('Error clearing crash record:', error);
+      return false;
+    }
+  }
+
+  // Deltas arrive over IPC; returns false for non-finite ones, which are
+  // dropped rather than written.
+  writeRelativeMotion(buttons, dx, dy) {
+    if (!Number.isFinite(dx) || !Number.isFinite(dy)) {
+      return false;
+    }
+    if (this.features.mouseRel16) {
+      // Command 8: [buttons, dx16 LE, dy16 LE, wheel, pan]
+      const x = Math.max(-32767, Math.min(32767, dx));
+      const y = Math.max(-32767, Math.min(32767, dy));
+      this.writeCommand(8, [buttons, x, x >> 8, y, y >> 8, 0, 0]);
+      return true;
+    }
+
+    // Command 7 carries +-127 per axis. Send one clamped report: on stock
+    // firmware back-to-back reports overwrite each other in the EP3 buffer,
+    // and the extended firmware splits motion across polls itself.
+    const x = Math.max(-127, Math.min(127, dx));
+    const y = Math.max(-127, Math.min(127, dy));
+    this.writeCommand(7, [buttons, x, y, 0]);
+    return true;
+  }
+
+  // Scroll deltas are in 1/120 notch units with the same sign convention as
+  // the 'wheel' event's delta.
+  writeScroll(buttons, deltaY, deltaX, absolute) {
+    if (this.features.hiResScroll) {
+      // Command 9: [target (0 relative, 1 absolute), buttons, wheel16 LE, pan16 LE]
+      const wheel = Math.max(-32767, Math.min(32767, Math.round(deltaY)));
+      const pan = Math.max(-32767, Math.min(32767, Math.round(deltaX)));
+      this.writeCommand(9, [absolute ? 1 : 0, buttons, wheel, wheel >> 8, pan, pan >> 8]);
+      return;
+    }
+
+    // Stock firmware only has whole notches and no pan: both axes drive the
+    // vertical wheel as before, and the rounding error carries to the next event
+    this.scrollRemainder += deltaY + deltaX;
+    const notches = Math.max(-127, Math.min(127, Math.round(this.scrollRemainder / 120)));
+    this.scrollRemainder -= notches * 120;
+    if (notches === 0) {
+      return;
+    }
+    if (absolute) {
+      const x = this.lastX;
+      const y = this.lastY;
+      this.writeCommand(2, [buttons, x, (x >> 8) & 0x7F, y, (y >> 8) & 0x7F, notches]);
+    } else {
+      this.writeCommand(7, [buttons, 0, 0, notches]);
+    }
+  }
+
   getMouseButtonCode(button) {
     const buttonMap = {
       0: 1,  // Left
@@ -445,6 +915,7 @@ class HIDManager {
   }
 
   close() {
+    this.stopHeartbeat();
     if (this.device) {
       this.device.close();
       this.device = null;
@@ -453,4 +924,53 @@ class HIDManager {
   }
 }
 
+// Firmware setting ids for setConfig()
+HIDManager.CONFIG_POINTER_CURVE = 0x01;
+HIDManager.CONFIG_ABS_EMULATION = 0x02;
+HIDManager.CONFIG_EMU_WIDTH = 0x03;
+HIDManager.CONFIG_EMU_HEIGHT = 0x04;
+HIDManager.CONFIG_EMU_HOME_MS = 0x05;
+HIDManager.CONFIG_EMU_STEP = 0x06;
+HIDManager.CONFIG_TYPEMATIC_DELAY = 0x07;
+HIDManager.CONFIG_TYPEMATIC_PERIOD = 0x08;
+HIDManager.CONFIG_HOST_TIMEOUT = 0x09;
+HIDManager.CONFIG_SWITCH_BREAK_MS = 0x0A;
+HIDManager.CONFIG_SWITCH_SETTLE_MS = 0x0B;
+
+// resetTarget() scopes
+HIDManager.RESET_QUEUES = 0;
+HIDManager.RESET_HID_PORT = 1;
+
+// Command 0x0D counter the firmware also reports unasked
+HIDManager.TELEMETRY_CMD_DROPS = 2;
+
+// Crash record layout, see CrashRecord in HID_CompliantDev/src/Main.c
+HIDManager.CRASH_MAGIC = 0x48535243;
+HIDManager.CRASH_RECORD_LEN = 224;
+
+// Command 0x11 feature bits
+HIDManager.CAP_REL16 = 0x0001;
+HIDManager.CAP_HIRES_SCROLL = 0x0002;
+HIDManager.CAP_ABS_TIMESTAMPS = 0x0004;
+HIDManager.CAP_CONFIG = 0x0008;
+HIDManager.CAP_HOST_WATCHDOG = 0x0010;
+HIDManager.CAP_TELEMETRY = 0x0020;
+HIDManager.CAP_LOCAL_INPUT = 0x0040;
+HIDManager.CAP_CRASH_RECORD = 0x0080;
+HIDManager.CAP_PORT_RESET = 0x0100;
+HIDManager.CAP_SWITCH_REPLY = 0x0200;
+HIDManager.CAP_MOUSE_COMPOSITE = 0x0400;
+HIDManager.CAP_TRACE = 0x0800;
+HIDManager.CAP_DUP_SUPPRESSION = 0x1000;
+
+// setFeatures() names of the capabilities the client can be told to assume
+// for firmware that does not answer command 0x11
+HIDManager.ASSUMED_FEATURES = {
+  [HIDManager.CAP_REL16]: 'mouseRel16',
+  [HIDManager.CAP_HIRES_SCROLL]: 'hiResScroll',
+  [HIDManager.CAP_ABS_TIMESTAMPS]: 'absInterpolation',
+  [HIDManager.CAP_CONFIG]: 'config',
+  [HIDManager.CAP_HOST_WATCHDOG]: 'hostWatchdog'
+};
+
 module.exports = HIDManager;
@@ -8,6 +8,66 @@ let rdevRunning = false;
 let isInControlMode = false;
 let isWindowFocused = false;
 
+// Optional native key path: the rdev grab thread writes keyboard reports to the
+// controller itself and JS only receives notifications. Enable with KVM_DIRECT_HID=1.
+const useDirectHid = process.env.KVM_DIRECT_HID === '1';
+
+// Controller firmware from this repository (HID_CompliantDev) understands the
+// extended commands; stock KVM firmware does not. Current builds report what
+// they support on connect; KVM_EXTENDED_FIRMWARE=1 assumes all of it for
+// builds older than that.
+const useExtendedFirmware = process.env.KVM_EXTENDED_FIRMWARE === '1';
+
+// Firmware pointer ballistics for relative mode (extended firmware only):
+// KVM_POINTER_CURVE=precise|default|fast. Disable the target's own acceleration.
+const POINTER_CURVES = { off: 0, precise: 1, default: 2, fast: 3 };
+const pointerCurve = POINTER_CURVES[process.env.KVM_POINTER_CURVE] || 0;
+
+// Absolute mode for targets that only drive the boot mouse (BIOS/UEFI setup):
+// the firmware turns positions into relative steps (extended firmware only).
+// KVM_ABS_EMULATION=1 or =WIDTHxHEIGHT of the target screen in mouse counts;
+// KVM_ABS_EMULATION_HOME_MS and KVM_ABS_EMULATION_STEP tune homing and speed.
+function absEmulationConfig() {
+  const value = process.env.KVM_ABS_EMULATION;
+  if (!value || value === '0') {
+    return null;
+  }
+  const size = /^(\d+)x(\d+)$/.exec(value);
+  return {
+    width: size ? Number(size[1]) : 0,
+    height: size ? Number(size[2]) : 0,
+    homeMs: process.env.KVM_ABS_EMULATION_HOME_MS,
+    step: process.env.KVM_ABS_EMULATION_STEP
+  };
+}
+
+// Key repeat generated by the firmware instead of the target (extended firmware
+// only): KVM_TYPEMATIC_DELAY_MS enables it, KVM_TYPEMATIC_PERIOD_MS sets the rate.
+// Keys stay held on the target; held input with no key event for 30 s is
+// released, so a lost key-up cannot repeat forever.
+const typematicDelay = Number(process.env.KVM_TYPEMATIC_DELAY_MS) || 0;
+const typematicPeriod = Number(process.env.KVM_TYPEMATIC_PERIOD_MS) || 0;
+
+// Firmware watchdog (extended firmware only): when the controller hears nothing
+// from the client for this long while input is held, it releases everything.
+// KVM_HOST_TIMEOUT_MS overrides the default; 0 turns it off.
+const hostTimeout = process.env.KVM_HOST_TIMEOUT_MS !== undefined
+  ? Number(process.env.KVM_HOST_TIMEOUT_MS) || 0
+  : 2000;
+
+// KVM switch timing (extended firmware only): KVM_SWITCH_BREAK_MS detaches the
+// keyboard/mouse port from USB for that long while switching (default 0, stays
+// attached); KVM_SWITCH_SETTLE_MS waits before the new target gets neutral input.
+const switchBreakMs = Number(process.env.KVM_SWITCH_BREAK_MS) || 0;
+const switchSettleMs = process.env.KVM_SWITCH_SETTLE_MS !== undefined
+  ? Number(process.env.KVM_SWITCH_SETTLE_MS) || 0
+  : 20;
+
+// Optional Linux capture backend: grab /dev/input keyboards and mice directly
+// with EVIOCGRAB instead of rdev + pointer lock. Enable with KVM_INPUT_BACKEND=evdev.
+const useEvdevBackend = process.platform === 'linux' && process.env.KVM_INPUT_BACKEND === 'evdev';
+let evdevActive = false;
+
 function loadRdevGrabber() {
   const basePath = path.join(__dirname, '..', 'native', 'rdev-grabber');
   const asarUnpackedPath = basePath.replace('app.asar', 'app.asar.unpacked');
@@ -46,6 +106,121 @@ function loadRdevGrabber() {
   return null;
 }
 
+// Packed rdev event layout, see native/rdev-grabber/index.d.ts
+const KEY_FLAG_DOWN = 0x01;
+const KEY_FLAG_HANDLED = 0x02;
+const KEY_FLAG_MOUSE = 0x04;
+const KEY_MOD_CTRL = 0x01;
+const KEY_MOD_SHIFT = 0x02;
+const KEY_MOD_ALT = 0x04;
+const KEY_MOD_META = 0x08;
+
+// Grab-to-USB latency of keys forwarded through JS, in microseconds
+const keyLatency = { count: 0, totalUs: 0, maxUs: 0 };
+
+function handleGrabbedKey(word, timestampUs) {
+  const usage = word & 0xFFFF;
+  const modifiers = (word >>> 16) & 0xFF;
+  const flags = (word >>> 24) & 0xFF;
+  const isDown = (flags & KEY_FLAG_DOWN) !== 0;
+
+  if (!(flags & KEY_FLAG_HANDLED) && isInControlMode && hidManager && hidManager.connected) {
+    const result = hidManager.sendKeyboardUsage(usage, isDown);
+    if (result.success) {
+      const latencyUs = (rdevGrabber.now_us() - timestampUs) >>> 0;
+      keyLatency.count++;
+      keyLatency.totalUs += latencyUs;
+      keyLatency.maxUs = Math.max(keyLatency.maxUs, latencyUs);
+    } else {
+      console.error('✗ HID send failed:', result.error, 'usage:0x' + usage.toString(16));
+    }
+  }
+
+  // The renderer only needs key names for quit key detection on keydown
+  if (isDown && mainWindow && mainWindow.webContents) {
+    const code = rdevGrabber.usage_name(usage);
+    mainWindow.webContents.send('global-key-pressed', {
+      key: code,
+      code,
+      eventType: 'down',
+      ctrlKey: (modifiers & KEY_MOD_CTRL) !== 0,
+      altKey: (modifiers & KEY_MOD_ALT) !== 0,
+      shiftKey: (modifiers & KEY_MOD_SHIFT) !== 0,
+      metaKey: (modifiers & KEY_MOD_META) !== 0,
+      usbHid: usage,
+    });
+  }
+}
+
+// Raw evdev motion, forwarded as relative reports when the direct HID path
+// did not already write it. Wheel is in 1/120 detent units.
+
+function handleGrabbedMouse(word, dxdy, wheels) {
+  const flags = (word >>> 24) & 0xFF;
+  if ((flags & KEY_FLAG_HANDLED) || !isInControlMode || !hidManager || !hidManager.connected) {
+    return;
+  }
+
+  const buttonsPressed = word & 0xFF;
+  const dx = (dxdy << 16) >> 16;
+  const dy = dxdy >> 16;
+  const wheel = (wheels << 16) >> 16;
+  const hwheel = wheels >> 16;
+
+  if (dx !== 0 || dy !== 0 || (wheel === 0 && hwheel === 0)) {
+    hidManager.sendMouseEvent({ type: 'move', x: dx, y: dy, buttonsPressed });
+  }
+
+  if (wheel !== 0 || hwheel !== 0) {
+    // Without pan support in the firmware, horizontal wheel would scroll vertically
+    const pan = hidManager.features.hiResScroll ? hwheel : 0;
+    hidManager.sendMouseEvent({ type: 'scroll', deltaY: wheel, deltaX: pan, buttonsPressed });
+  }
+}
+
+function startEvdevGrab() {
+  const count = rdevGrabber.start_evdev_grab((batch) => {
+    if (!batch) {
+      return;
+    }
+    for (let i = 0; i + 3 < batch.length; i += 4) {
+      if ((batch[i] >>> 24) & KEY_FLAG_MOUSE) {
+        handleGrabbedMouse(batch[i], batch[i + 2], batch[i + 3]);
+      } else {
+        handleGrabbedKey(batch[i], batch[i + 1]);
+      }
+    }
+  }, { keyboard: true, mouse: true });
+  evdevActive = true;
+  console.log(`✓ evdev grab started - ${count} input device(s) grabbed`);
+}
+
+function logKeyLatency() {
+  if (keyLatency.count === 0) {
+    return;
+  }
+  console.log('Key grab-to-USB latency:', {
+    keys: keyLatency.count,
+    avgUs: Math.round(keyLatency.totalUs / keyLatency.count),
+    maxUs: keyLatency.maxUs,
+    dropped: typeof rdevGrabber.dropped_events === 'function' ? rdevGrabber.dropped_events() : 0,
+    droppedEvdev: evdevActive && typeof rdevGrabber.dropped_evdev_events === 'function'
+      ? rdevGrabber.dropped_evdev_events()
+      : 0
+  });
+  keyLatency.count = 0;
+  keyLatency.totalUs = 0;
+  keyLatency.maxUs = 0;
+}
+
+function stopGrabBackend() {
+  if (evdevActive) {
+    rdevGrabber.stop_evdev_grab();
+  } else {
+    rdevGrabber.stop_grab();
+  }
+}
+
 // Start/stop rdev grab based on focus + control state
 function updateGrabState() {
   const shouldGrab = isInControlMode && isWindowFocused;
@@ -57,67 +232,23 @@ function updateGrabState() {
       return;
     }
 
+    if (useEvdevBackend && typeof rdevGrabber.start_evdev_grab === 'function') {
+      try {
+        startEvdevGrab();
+        rdevRunning = true;
+        return;
+      } catch (err) {
+        console.error('Failed to start evdev backend, falling back to rdev:', err.message);
+      }
+    }
+
     try {
-      rdevGrabber.start_grab((event) => {
-        if (!event) {
-          console.warn('rdev callback received null event');
+      rdevGrabber.start_grab((batch) => {
+        if (!batch) {
           return;
         }
-
-        // Normalize event data from rdev
-        const payload = {
-          key: event.key || 'Unknown',
-          code: event.code || event.key || '',
-          eventType: event.event_type || event.eventType || 'down',
-          ctrlKey: !!(event.ctrl ?? event.ctrlKey),
-          altKey: !!(event.alt ?? event.altKey),
-          shiftKey: !!(event.shift ?? event.shiftKey),
-          metaKey: !!(event.meta ?? event.metaKey),
-          platformCode: event.platform_code ?? event.platformCode ?? null,
-          scanCode: event.scan_code ?? event.scanCode ?? null,
-          usbHid: event.usb_hid ?? event.usbHid ?? null,
-        };
-
-        console.log('━━━ RDEV EVENT ━━━', {
-          type: payload.eventType,
-          key: payload.key,
-          code: payload.code,
-          usbHid: payload.usbHid,
-          modifiers: {
-            ctrl: payload.ctrlKey,
-            alt: payload.altKey,
-            shift: payload.shiftKey,
-            meta: payload.metaKey
-          },
-          isInControlMode,
-          hidConnected: hidManager?.connected
-        });
-
-        // In control mode: send directly to HID
-        if (isInControlMode && hidManager && hidManager.connected) {
-          console.log('→ Sending to HID:', payload.key, payload.code);
-          const result = hidManager.sendKeyboardEvent({
-            type: payload.eventType === 'up' ? 'keyup' : 'keydown',
-            key: payload.key,
-            code: payload.code,
-            usbHid: payload.usbHid,
-            scanCode: payload.scanCode,
-            platformCode: payload.platformCode,
-            metaKey: payload.metaKey,
-            ctrlKey: payload.ctrlKey,
-            altKey: payload.altKey,
-            shiftKey: payload.shiftKey,
-          });
-          if (!result.success) {
-            console.error('✗ HID send failed:', result.error);
-          }
-        } else {
-          console.log('✗ Not sending to HID:', { isInControlMode, hidConnected: hidManager?.connected });
-        }
-
-        // Also send to renderer for quit key detection
-        if (mainWindow && mainWindow.webContents) {
-          mainWindow.webContents.send('global-key-pressed', payload);
+        for (let i = 0; i + 1 < batch.length; i += 2) {
+          handleGrabbedKey(batch[i], batch[i + 1]);
         }
       });
       rdevRunning = true;
@@ -127,12 +258,14 @@ function updateGrabState() {
     }
   } else if (!shouldGrab && rdevRunning && rdevGrabber && typeof rdevGrabber.stop_grab === 'function') {
     try {
-      rdevGrabber.stop_grab();
+      stopGrabBackend();
     } catch (err) {
       console.warn('Failed to stop rdev grabber:', err);
     }
     rdevRunning = false;
     console.log('✓ rdev grab stopped - keyboard released');
+    logKeyLatency();
+    evdevActive = false;
   } else if (shouldGrab && rdevRunning) {
     console.log('⚠ rdev already running');
   } else if (!shouldGrab && !rdevRunning) {
@@ -142,6 +275,105 @@ function updateGrabState() {
 
 rdevGrabber = loadRdevGrabber();
 
+// Mirrors HIDManager.features as the direct HID path's feature bits
+function directHidFeatureMask() {
+  return (hidManager.features.mouseRel16 ? 0x01 : 0) |
+    (hidManager.features.hiResScroll ? 0x02 : 0);
+}
+
+// Hand the connected controller to the native grabber (KVM_DIRECT_HID=1 only)
+function openDirectHid(devicePath) {
+  if (!useDirectHid || !rdevGrabber || typeof rdevGrabber.open_direct_hid !== 'function') {
+    return;
+  }
+  try {
+    rdevGrabber.open_direct_hid(devicePath);
+    if (typeof rdevGrabber.set_direct_hid_features === 'function') {
+      rdevGrabber.set_direct_hid_features(directHidFeatureMask());
+    }
+    // Keyboard state lives on the native side while it is open
+    if (typeof rdevGrabber.direct_hid_key === 'function') {
+      hidManager.setDirectKeyboard({
+        key: (usage, isDown) => rdevGrabber.direct_hid_key(usage, isDown),
+        releaseKeys: () => rdevGrabber.direct_hid_release_keys()
+      });
+    }
+    console.log('✓ Native direct HID path opened:', devicePath);
+  } catch (err) {
+    console.warn('Native direct HID path unavailable, keys go through JS:', err.message);
+  }
+}
+
+function closeDirectHid() {
+  if (hidManager && hidManager.directKeyboard) {
+    hidManager.setDirectKeyboard(null);
+  }
+  if (!rdevGrabber || typeof rdevGrabber.close_direct_hid !== 'function') {
+    return;
+  }
+  try {
+    rdevGrabber.close_direct_hid();
+  } catch (err) {
+    console.warn('Failed to close native direct HID path:', err);
+  }
+}
+
+// Controller hotplug: where the native addon supports it (Linux udev netlink),
+// add/remove of the KVM hidraw nodes is pushed to the renderer, which then
+// re-enumerates and reconnects; it keeps only a slow fallback poll of HID.devices().
+let hotplugWatching = false;
+let hotplugAddTimer = null;
+// A composite controller exposes several hidraw nodes; coalesce their adds
+const HOTPLUG_ADD_SETTLE_MS = 20;
+
+function notifyHidDevicesChanged(change) {
+  if (mainWindow && mainWindow.webContents) {
+    mainWindow.webContents.send('hid-devices-changed', change);
+  }
+}
+
+function handleHotplug(action, devnode) {
+  if (action === 'remove') {
+    if (hidManager && hidManager.connected && hidManager.devicePath === devnode) {
+      console.log('KVM controller removed:', devnode);
+      closeDirectHid();
+      hidManager.disconnect();
+      notifyHidDevicesChanged({ action, wasConnected: true });
+    }
+    return;
+  }
+
+  clearTimeout(hotplugAddTimer);
+  hotplugAddTimer = setTimeout(() => {
+    hotplugAddTimer = null;
+    notifyHidDevicesChanged({ action, wasConnected: false });
+  }, HOTPLUG_ADD_SETTLE_MS);
+}
+
+function startHotplugWatch() {
+  if (!rdevGrabber || typeof rdevGrabber.watch_hotplug !== 'function') {
+    return false;
+  }
+  try {
+    hotplugWatching = rdevGrabber.watch_hotplug(hidManager.vendorId, hidManager.productId, handleHotplug);
+  } catch (err) {
+    console.warn('Hotplug notifications unavailable, falling back to polling:', err.message);
+    hotplugWatching = false;
+  }
+  return hotplugWatching;
+}
+
+function stopHotplugWatch() {
+  if (hotplugWatching && typeof rdevGrabber.unwatch_hotplug === 'function') {
+    try {
+      rdevGrabber.unwatch_hotplug();
+    } catch (err) {
+      console.warn('Failed to stop hotplug watch:', err);
+    }
+  }
+  hotplugWatching = false;
+}
+
 // Check macOS permissions (following RustDesk's approach)
 function checkMacOSPermissions() {
   if (process.platform !== 'darwin') {
@@ -279,6 +511,45 @@ app.whenReady().then(() => {
 
   // Initialize HID manager
   hidManager = new HIDManager();
+  if (useExtendedFirmware) {
+    hidManager.setFeatures({
+      mouseRel16: true,
+      hiResScroll: true,
+      absInterpolation: true,
+      config: true,
+      hostWatchdog: true
+    });
+  }
+  // Settings only reach firmware that takes them, see HIDManager.supports()
+  hidManager.setConfig(HIDManager.CONFIG_POINTER_CURVE, pointerCurve);
+
+  const emulation = absEmulationConfig();
+  if (emulation) {
+    // Geometry first, so enabling homes against the right screen size
+    if (emulation.width && emulation.height) {
+      hidManager.setConfig(HIDManager.CONFIG_EMU_WIDTH, emulation.width);
+      hidManager.setConfig(HIDManager.CONFIG_EMU_HEIGHT, emulation.height);
+    }
+    if (emulation.homeMs !== undefined) {
+      hidManager.setConfig(HIDManager.CONFIG_EMU_HOME_MS, Number(emulation.homeMs));
+    }
+    if (emulation.step !== undefined) {
+      hidManager.setConfig(HIDManager.CONFIG_EMU_STEP, Number(emulation.step));
+    }
+    hidManager.setConfig(HIDManager.CONFIG_ABS_EMULATION, 1);
+  }
+
+  if (typematicDelay) {
+    if (typematicPeriod) {
+      hidManager.setConfig(HIDManager.CONFIG_TYPEMATIC_PERIOD, typematicPeriod);
+    }
+    hidManager.setConfig(HIDManager.CONFIG_TYPEMATIC_DELAY, typematicDelay);
+  }
+
+  hidManager.setHostTimeout(hostTimeout);
+  hidManager.setSwitchTiming(switchBreakMs, switchSettleMs);
+
+  startHotplugWatch();
 
   app.on('activate', () => {
     if (BrowserWindow.getAllWindows().length === 0) {
@@ -303,7 +574,8 @@ app.whenReady().then(() => {
     // Stop grab when window closes
     if (rdevGrabber && typeof rdevGrabber.stop_grab === 'function' && rdevRunning) {
       try {
-        rdevGrabber.stop_grab();
+        stopGrabBackend();
+        evdevActive = false;
         rdevRunning = false;
         console.log('✓ rdev grab stopped on window close');
       } catch (err) {
@@ -326,14 +598,25 @@ app.on('before-quit', () => {
   // Unregister global shortcuts
   globalShortcut.unregisterAll();
   
-  if (rdevGrabber && typeof rdevGrabber.stop_grab === 'function') {
+  if (rdevGrabber && typeof rdevGrabber.stop_evdev_grab === 'function') {
+    try {
+      rdevGrabber.stop_evdev_grab();
+    } catch (err) {
+      console.warn('Failed to stop evdev backend:', err);
+    }
+  }
+
+  if (rdevGrabber && typeof rdevGrabber.shutdown_grab === 'function') {
     try {
-      rdevGrabber.stop_grab();
+      rdevGrabber.shutdown_grab();
     } catch (err) {
       console.warn('Failed to stop rdev grabber:', err);
     }
   }
 
+  stopHotplugWatch();
+  closeDirectHid();
+
   if (hidManager) {
     hidManager.close();
   }
@@ -344,11 +627,21 @@ ipcMain.handle('get-hid-devices', async () => {
   return hidManager.getDevices();
 });
 
+ipcMain.handle('is-hotplug-supported', async () => {
+  return hotplugWatching;
+});
+
 ipcMain.handle('connect-hid-device', async (event, devicePath) => {
-  return hidManager.connect(devicePath);
+  closeDirectHid();
+  const result = await hidManager.connect(devicePath);
+  if (result.success) {
+    openDirectHid(devicePath);
+  }
+  return result;
 });
 
 ipcMain.handle('disconnect-hid-device', async () => {
+  closeDirectHid();
   return hidManager.disconnect();
 });
 
@@ -360,6 +653,22 @@ ipcMain.handle('send-keyboard-event', async (event, data) => {
   return hidManager.sendKeyboardEvent(data);
 });
 
+ipcMain.handle('switch-target', async (event, target) => {
+  return hidManager.switchTarget(target);
+});
+
+ipcMain.handle('reset-target', async (event, scope, detachMs) => {
+  return hidManager.resetTarget(scope, detachMs);
+});
+
+ipcMain.handle('get-controller-capabilities', async () => {
+  return hidManager.capabilities;
+});
+
+ipcMain.handle('get-controller-telemetry', async () => {
+  return hidManager.readTelemetry();
+});
+
 ipcMain.handle('get-stream-url', async () => {
   return null;
 });
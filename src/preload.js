@@ -5,8 +5,14 @@ contextBridge.exposeInMainWorld('electronAPI', {
   getHIDDevices: () => ipcRenderer.invoke('get-hid-devices'),
   connectHIDDevice: (devicePath) => ipcRenderer.invoke('connect-hid-device', devicePath),
   disconnectHIDDevice: () => ipcRenderer.invoke('disconnect-hid-device'),
+  isHotplugSupported: () => ipcRenderer.invoke('is-hotplug-supported'),
+  onHIDDevicesChanged: (callback) => ipcRenderer.on('hid-devices-changed', callback),
   sendMouseEvent: (data) => ipcRenderer.invoke('send-mouse-event', data),
   sendKeyboardEvent: (data) => ipcRenderer.invoke('send-keyboard-event', data),
+  switchTarget: (target) => ipcRenderer.invoke('switch-target', target),
+  resetTarget: (scope, detachMs) => ipcRenderer.invoke('reset-target', scope, detachMs),
+  getControllerCapabilities: () => ipcRenderer.invoke('get-controller-capabilities'),
+  getControllerTelemetry: () => ipcRenderer.invoke('get-controller-telemetry'),
   
   // Global key events from main process
   onGlobalKeyPressed: (callback) => ipcRenderer.on('global-key-pressed', callback),
@@ -161,6 +161,7 @@ class KVMClient {
         this.initializeElements();
         this.bindEvents();
         this.setupGlobalKeyHandler();  // Setup rdev global key handler for quit key
+        this.setupHIDHotplugHandler();
         this.initializeVideo();
         this.applyLoadedSettings();
     }
@@ -1355,7 +1356,7 @@ class KVMClient {
         }
     }
 
-    async loadHIDDevices() {
+    async loadHIDDevices({ silent = false } = {}) {
         try {
             const devices = await window.electronAPI.getHIDDevices();
             this.hidDevicesSelect.innerHTML = '<option value="">Select HID Device</option>';
@@ -1396,7 +1397,7 @@ class KVMClient {
                 this.showAutoConnectNotification(`${deviceName} detected, connecting...`);
 
                 try {
-                    await this.connectHID();
+                    await this.connectHID({ silent });
                     if (this.hidConnected) {
                         this.showAutoConnectNotification(`✅ ${deviceName} connected successfully!`, 'success');
                     }
@@ -1410,7 +1411,7 @@ class KVMClient {
         }
     }
 
-    async connectHID() {
+    async connectHID({ silent = false } = {}) {
         const devicePath = this.hidDevicesSelect.value;
         if (!devicePath) {
             alert(this.t('selectHIDDevice'));
@@ -1426,12 +1427,16 @@ class KVMClient {
                 
                 // Stop monitoring when successfully connected
                 this.stopHIDMonitoring();
+            } else if (silent) {
+                console.warn('HID connect failed:', result.error);
             } else {
                 alert(`${this.t('connectHIDFailed')}: ${result.error}`);
             }
         } catch (error) {
             console.error('Error connecting HID:', error);
-            alert(this.t('connectHIDError'));
+            if (!silent) {
+                alert(this.t('connectHIDError'));
+            }
         }
     }
 
@@ -1724,7 +1729,8 @@ class KVMClient {
                     type: 'abs',
                     x: x,
                     y: y,
-                    buttonsPressed: this.mouseButtonsPressed // Include button state for dragging
+                    buttonsPressed: this.mouseButtonsPressed, // Include button state for dragging
+                    timeStamp: event.timeStamp // Lets the firmware interpolate between samples
                 });
             } catch (error) {
                 console.error('Error sending absolute mouse position:', error);
@@ -1816,6 +1822,15 @@ class KVMClient {
             // Apply scroll direction preference
             const scrollMultiplier = this.reverseScroll ? -1 : 1;
 
+            // One combined event per DOM wheel event; deltas stay fractional
+            // (1/120 notch units) and the backend carries remainders
+            const scroll = {
+                type: 'scroll',
+                deltaY: event.deltaY * scrollMultiplier,
+                deltaX: event.deltaX * scrollMultiplier,
+                buttonsPressed: this.mouseButtonsPressed
+            };
+
             if (this.mouseMode === 'absolute') {
                 // Absolute mode: Include current mouse position with wheel event
                 const videoRect = this.videoElement.getBoundingClientRect();
@@ -1823,47 +1838,12 @@ class KVMClient {
                 const relativeY = event.clientY - videoRect.top;
                 const clampedX = Math.max(0, Math.min(relativeX, videoRect.width));
                 const clampedY = Math.max(0, Math.min(relativeY, videoRect.height));
-                const x = Math.round((clampedX / videoRect.width) * 0x7FFF);
-                const y = Math.round((clampedY / videoRect.height) * 0x7FFF);
+                scroll.x = Math.round((clampedX / videoRect.width) * 0x7FFF);
+                scroll.y = Math.round((clampedY / videoRect.height) * 0x7FFF);
+            }
 
-                // Send wheel events for both X and Y scroll
-                if (Math.abs(event.deltaY) > 0) {
-                    await window.electronAPI.sendMouseEvent({
-                        type: 'wheel',
-                        delta: event.deltaY * scrollMultiplier,
-                        x: x,
-                        y: y,
-                        buttonsPressed: this.mouseButtonsPressed
-                    });
-                }
-                if (Math.abs(event.deltaX) > 0) {
-                    await window.electronAPI.sendMouseEvent({
-                        type: 'wheel',
-                        delta: event.deltaX * scrollMultiplier,
-                        x: x,
-                        y: y,
-                        buttonsPressed: this.mouseButtonsPressed
-                    });
-                }
-            } else {
-                // Relative mode: Send wheel delta without position (use zeros for relative deltas)
-                // The HID backend will handle this as a relative mode wheel event
-                if (Math.abs(event.deltaY) > 0) {
-                    await window.electronAPI.sendMouseEvent({
-                        type: 'wheel',
-                        delta: event.deltaY * scrollMultiplier,
-                        buttonsPressed: this.mouseButtonsPressed
-                        // No x, y in relative mode - backend uses lastX/lastY or zeros
-                    });
-                }
-                if (Math.abs(event.deltaX) > 0) {
-                    await window.electronAPI.sendMouseEvent({
-                        type: 'wheel',
-                        delta: event.deltaX * scrollMultiplier,
-                        buttonsPressed: this.mouseButtonsPressed
-                        // No x, y in relative mode - backend uses lastX/lastY or zeros
-                    });
-                }
+            if (scroll.deltaY !== 0 || scroll.deltaX !== 0) {
+                await window.electronAPI.sendMouseEvent(scroll);
             }
         } catch (error) {
             console.error('Error sending mouse wheel:', error);
@@ -2508,15 +2488,65 @@ class KVMClient {
         this.updateCombinationDisplay();
     }
 
-    startHIDMonitoring() {
-        // Check for new HID devices every 3 seconds
+    async startHIDMonitoring() {
+        if (this.hidHotplugSupported === undefined) {
+            this.hidHotplugSupported = window.electronAPI.isHotplugSupported
+                ? await window.electronAPI.isHotplugSupported()
+                : false;
+        }
+        if (this.hidMonitorInterval) {
+            return;
+        }
+
+        // With hotplug notifications the poll is only a fallback for hosts
+        // where nothing broadcasts uevents (no udevd, e.g. containers)
+        const intervalMs = this.hidHotplugSupported ? 30000 : 3000;
         this.hidMonitorInterval = setInterval(async () => {
             if (!this.hidConnected && !this.manualHIDDisconnect) {
                 await this.loadHIDDevices();
             }
-        }, 3000);
-        
-        console.log('HID device monitoring started - checking every 3 seconds');
+        }, intervalMs);
+
+        console.log(`HID device monitoring started - checking every ${intervalMs / 1000} seconds`);
+    }
+
+    setupHIDHotplugHandler() {
+        if (!window.electronAPI || !window.electronAPI.onHIDDevicesChanged) {
+            return;
+        }
+        window.electronAPI.onHIDDevicesChanged(async (event, change) => {
+            if (change.action === 'remove' && change.wasConnected) {
+                console.log('HID device unplugged, waiting for it to come back');
+                this.hidConnected = false;
+                this.updateHIDStatus();
+                if (this.mouseCaptured) {
+                    await this.releaseMouseCapture();
+                }
+                this.startHIDMonitoring();
+            }
+            if (change.action === 'add') {
+                await this.retryHIDConnect();
+            } else if (!this.hidConnected && !this.manualHIDDisconnect) {
+                await this.loadHIDDevices();
+            }
+        });
+    }
+
+    async retryHIDConnect() {
+        // The hidraw node can appear before udev rules grant access to it,
+        // so a connect right after 'add' may fail; retry at a short fixed
+        // interval so the connect lands within one interval of the fix-up
+        const intervalMs = 50;
+        const attempts = 40;
+        for (let i = 0; i < attempts; i++) {
+            if (this.hidConnected || this.manualHIDDisconnect) {
+                return;
+            }
+            if (i > 0) {
+                await new Promise(resolve => setTimeout(resolve, intervalMs));
+            }
+            await this.loadHIDDevices({ silent: i < attempts - 1 });
+        }
     }
 
     stopHIDMonitoring() {